@@ -0,0 +1,144 @@
+/** arena.cpp **/
+
+#include "arena.hpp"
+#include <iostream>
+#include <cstdio>
+
+arena_c::arena_c(cchar *name, const size_t capacity): name(name), used(0), total(0), peak(0), stage_amount(0) {
+	first = NULL;
+	current = NULL;
+	first = add_block(capacity);
+	current = first;
+}
+
+arena_c::~arena_c() {
+	while(first != NULL) {
+		block_c *next = first->next;
+		delete [] first->data;
+		delete first;
+		first = next;
+	}
+}
+
+//Adds a new block after the current one
+arena_c::block_c *arena_c::add_block(const size_t capacity) {
+	block_c *block = new block_c;
+	block->capacity = capacity;
+	//Some extra space so that the beginning of the block can be aligned
+	block->data = new uchar[capacity + ARENA_ALIGN];
+	block->next = NULL;
+	if(current != NULL) {
+		block->next = current->next;
+		current->next = block;
+	}
+	return block;
+}
+
+//Returns memory aligned to ARENA_ALIGN
+void *arena_c::alloc(const size_t bytes) {
+	uchar *base = (uchar*)(((size_t)current->data + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN);
+	size_t start = (used + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+	if(start + bytes > current->capacity) {
+		//The rest of the current block is skipped
+		total+= current->capacity - used;
+		if(current->next == NULL || current->next->capacity < bytes) add_block(bytes > first->capacity ? bytes : first->capacity);
+		current = current->next;
+		base = (uchar*)(((size_t)current->data + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN);
+		start = 0;
+		used = 0;
+	}
+	total+= start + bytes - used;
+	used = start + bytes;
+	if(total > peak) peak = total;
+	if(stage_amount > 0 && total > stage_peaks[stage_amount - 1]) stage_peaks[stage_amount - 1] = total;
+	return base + start;
+}
+
+//Returns the current position that can later be given to rewind
+size_t arena_c::mark() const {
+	return total;
+}
+
+//Frees everything that has been allocated after the position was marked
+void arena_c::rewind(const size_t position) {
+	size_t start = 0;
+	block_c *block = first;
+	while(block->next != NULL && position > start + block->capacity) {
+		start+= block->capacity;
+		block = block->next;
+	}
+	current = block;
+	used = position - start;
+	total = position;
+}
+
+//Frees everything
+//If more than one block was needed they are replaced by a single block big enough for all of them
+void arena_c::reset() {
+	if(first->next != NULL) {
+		size_t capacity = 0;
+		while(first != NULL) {
+			block_c *next = first->next;
+			capacity+= first->capacity;
+			delete [] first->data;
+			delete first;
+			first = next;
+		}
+		current = NULL;
+		first = add_block(capacity);
+	}
+	current = first;
+	used = 0;
+	total = 0;
+}
+
+//Starts a new stage for the memory report
+void arena_c::stage(cchar *stage_name) {
+	if(stage_amount == ARENA_STAGES) stage_amount--;
+	stage_names[stage_amount] = stage_name;
+	stage_peaks[stage_amount] = total;
+	stage_amount++;
+}
+
+//Prints the peak memory usage of every stage
+void arena_c::report() const {
+	#ifdef OUTPUT
+		std::cout << "     " << name << " memory: " << (peak + 1023) / 1024 << " KB at peak" << std::endl;
+		for(uchar i=0;i<stage_amount;i++) {
+			std::cout << "          " << stage_names[i] << ": " << (stage_peaks[i] + 1023) / 1024 << " KB" << std::endl;
+		}
+	#endif
+}
+
+size_t arena_c::get_peak() const {
+	return peak;
+}
+
+size_t arena_c::get_capacity() const {
+	size_t capacity = 0;
+	for(const block_c *block=first;block!=NULL;block=block->next) capacity+= block->capacity;
+	return capacity;
+}
+
+//Linux keeps the resident and the highest resident memory of the process in /proc
+bool process_memory(size_t &resident, size_t &peak) {
+	resident = 0;
+	peak = 0;
+	FILE *file = fopen("/proc/self/status", "r");
+	if(file == NULL) return false;
+	char line[256];
+	uint found = 0;
+	while(fgets(line, sizeof(line), file) != NULL) {
+		unsigned long kilobytes;
+		if(sscanf(line, "VmRSS: %lu", &kilobytes) == 1) {
+			resident = (size_t)kilobytes * 1024;
+			found++;
+		}
+		else if(sscanf(line, "VmHWM: %lu", &kilobytes) == 1) {
+			peak = (size_t)kilobytes * 1024;
+			found++;
+		}
+	}
+	fclose(file);
+	return found == 2;
+}
@@ -0,0 +1,56 @@
+/** arena.hpp **/
+
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include "global.hpp"
+#include <cstddef>
+
+#define ARENA_ALIGN 64 //Every allocation starts at a cache line
+#define ARENA_STAGES 16 //Maximum amount of stages that are remembered for the memory report
+
+//This class hands out memory from big blocks instead of allocating every buffer separately
+//The first block is allocated up front and should be big enough for everything the arena is used for
+//	If it isn't, another block is added; memory that has been handed out never moves
+//Nothing is freed separately: mark and rewind free everything allocated after the mark and reset frees everything
+//	The blocks themselves are kept so the arena can be reused for the next frame without touching the heap
+//The highest amount of memory in use is recorded separately for every stage for the memory report
+class arena_c {
+	private:
+		class block_c {
+			public:
+				uchar *data;
+				size_t capacity;
+				block_c *next;
+		};
+		cchar *name;
+		block_c *first;
+		block_c *current;
+		size_t used; //Used bytes in the current block
+		size_t total; //Used bytes in all blocks
+		size_t peak;
+		cchar *stage_names[ARENA_STAGES];
+		size_t stage_peaks[ARENA_STAGES];
+		uchar stage_amount;
+		block_c *add_block(const size_t capacity);
+
+	public:
+		arena_c(cchar *name, const size_t capacity);
+		~arena_c();
+		void *alloc(const size_t bytes);
+		template <class T> T *alloc(const size_t count) {
+			return (T*)alloc(count * sizeof(T));
+		}
+		size_t mark() const;
+		void rewind(const size_t position);
+		void reset();
+		void stage(cchar *stage_name);
+		void report() const;
+		size_t get_peak() const;
+		size_t get_capacity() const;
+};
+
+//The memory of the whole process in bytes, for checking what the arenas don't see; false where it isn't known
+bool process_memory(size_t &resident, size_t &peak);
+
+#endif
@@ -0,0 +1,193 @@
+/** bench.cpp **/
+
+#include "bench.hpp"
+#include "arena.hpp"
+#include "shade.hpp"
+#include "lightmap.hpp"
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <cmath>
+
+//Traces the frame and returns the milliseconds it took
+static double time_frame(const scene_c &scene, const render_params_c &params, float *image, float *depth_buffer) {
+	double best = 0;
+	for(uint i=0;i<BENCH_RUNS;i++) {
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		trace_frame(scene, params, image, depth_buffer, params.width, 0, params.width, 0, params.height);
+		cdouble time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		if(i == 0 || time < best) best = time;
+	}
+	return best;
+}
+
+//Traces the hits of every pixel and shades them one by one and in batches on one thread to time the stages separately
+//Both ways of shading must give the same colors
+static bool time_shading(const scene_c &scene, const render_params_c &params, arena_c &arena) {
+	cuint pixels = params.width * params.height;
+	float sunx, suny, sunz;
+	params.sun_direction(sunx, suny, sunz);
+	float *hits = arena.alloc<float>(pixels * 5); //The position, the light and the diffuse light of every hit
+	uint *polygons = arena.alloc<uint>(pixels);
+	float *single_image = arena.alloc<float>(pixels * 3);
+	float *batch_image = arena.alloc<float>(pixels * 3);
+	float *depth_buffer = arena.alloc<float>(pixels);
+	uint count = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(uint i=0;i<params.width;i++) {
+		cfloat column = (float)i / (float)params.width;
+		for(uint j=0;j<params.height;j++) {
+			cfloat row = (float)j / (float)params.height;
+			cfloat x = params.target_x + params.right_x * column + params.up_x * row;
+			cfloat y = params.target_y + params.right_y * column + params.up_y * row;
+			cfloat z = params.target_z + params.right_z * column + params.up_z * row;
+			float *hit = hits + count * 5;
+			if(!trace_primary(scene, params.camera_x, params.camera_y, params.camera_z, x, y, z, hit[0], hit[1], hit[2], polygons[count])) continue;
+			if(params.lightmap == NULL || !params.lightmap->lookup(hit[0], hit[1], hit[2], hit[3], hit[4])) {
+				hit[3] = trace_shadow(scene, hit[0], hit[1], hit[2], polygons[count], sunx, suny, sunz) ? 0 : 1;
+				hit[4] = -1;
+			}
+			count++;
+		}
+	}
+	cdouble trace_time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	double single_time = 0, batch_time = 0;
+	for(uint run=0;run<BENCH_RUNS;run++) {
+		start = std::chrono::steady_clock::now();
+		for(uint i=0;i<count;i++) {
+			cfloat *hit = hits + i * 5;
+			shade_hit(scene, params, hit[0], hit[1], hit[2], scene.polygons[polygons[i]], hit[3], hit[4], sunx, suny, sunz, single_image + i * 3, depth_buffer[i]);
+		}
+		cdouble time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		if(run == 0 || time < single_time) single_time = time;
+		start = std::chrono::steady_clock::now();
+		hit_batch_c batch;
+		for(uint i=0;i<count;i++) {
+			cfloat *hit = hits + i * 5;
+			if(batch.add(hit[0], hit[1], hit[2], scene.polygons[polygons[i]], hit[3], hit[4], batch_image + i * 3, depth_buffer + i)) shade_hits(scene, params, sunx, suny, sunz, batch);
+		}
+		shade_hits(scene, params, sunx, suny, sunz, batch);
+		cdouble batch_time_run = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		if(run == 0 || batch_time_run < batch_time) batch_time = batch_time_run;
+	}
+	std::cout << "Tracing " << count << " hits with shadows took " << (int)trace_time << " ms on one thread" << std::endl;
+	std::cout << "Shading them took " << int(single_time * 10.0 + 0.5) / 10.0 << " ms one by one and " << int(batch_time * 10.0 + 0.5) / 10.0 << " ms in batches of " << SHADE_BATCH;
+	if(memcmp(single_image, batch_image, count * 3 * sizeof(float)) != 0) {
+		std::cout << " (the colors differ!)" << std::endl;
+		return false;
+	}
+	std::cout << std::endl;
+	return true;
+}
+
+//Post processes the same traced frame with float and half float buffers and compares the final images
+//The memory the passes go through is the peak of their arena
+static void time_post_process(const scene_c &scene, const render_params_c &params, arena_c &arena) {
+	cuint pixels = params.width * params.height;
+	cuint final_size = (params.width / params.scale_down) * (params.height / params.scale_down) * 3;
+	float *image = arena.alloc<float>(pixels * 3);
+	float *depth_buffer = arena.alloc<float>(pixels);
+	float *work_image = arena.alloc<float>(pixels * 3);
+	float *work_depth = arena.alloc<float>(pixels);
+	uchar *finals[2] = {arena.alloc<uchar>(final_size), arena.alloc<uchar>(final_size)};
+	trace_frame(scene, params, image, depth_buffer, params.width, 0, params.width, 0, params.height);
+	double times[2];
+	size_t memory[2];
+	for(uint half=0;half<2;half++) {
+		render_params_c post_params = params;
+		post_params.half_frame = half;
+		arena_c post_arena("Post processing", (size_t)pixels * sizeof(float) * 8);
+		for(uint run=0;run<BENCH_RUNS;run++) {
+			memcpy(work_image, image, pixels * 3 * sizeof(float));
+			memcpy(work_depth, depth_buffer, pixels * sizeof(float));
+			const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			post_process(post_params, work_image, work_depth, post_arena);
+			cdouble time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			if(run == 0 || time < times[half]) times[half] = time;
+		}
+		memory[half] = post_arena.get_peak();
+		finish_frame(post_params, work_image, finals[half], params.width / params.scale_down * 3);
+	}
+	uint most = 0;
+	double error = 0;
+	for(uint i=0;i<final_size;i++) {
+		cuint difference = abs((int)finals[0][i] - (int)finals[1][i]);
+		if(difference > most) most = difference;
+		error+= difference * difference;
+	}
+	std::cout << "Post processing took " << (int)times[0] << " ms with floats (" << (memory[0] + 1023) / 1024 << " KB) and ";
+	std::cout << (int)times[1] << " ms with half floats (" << (memory[1] + 1023) / 1024 << " KB)" << std::endl;
+	std::cout << "The half float frame is at most " << most << " levels off";
+	if(error > 0) std::cout << " (PSNR " << int(10.0 * log10(255.0 * 255.0 * final_size / error) * 10.0 + 0.5) / 10.0 << " dB)";
+	std::cout << std::endl;
+}
+
+//Traces the frame with the cubes tested one by one and with the quads for every amount of cube levels up to CUBE_AMOUNT
+//This tells how fast the quads are compared to the cubes and what CUBE_AMOUNT should be without building the scene again
+//The frames of both ways must be the same
+//Tracing the rays in streams is compared to the frame with every level
+//The tracing, shading and post processing stages are timed separately after that
+bool run_benchmark(scene_c &scene, const render_params_c &params) {
+	#ifdef CUBE_AMOUNT
+		cuint pixels = params.width * params.height;
+		arena_c arena("Benchmark", (size_t)pixels * sizeof(float) * 13 + 6 * ARENA_ALIGN);
+		float *depth_buffer = arena.alloc<float>(pixels);
+		float *cubes_image = arena.alloc<float>(pixels * 3);
+		float *quads_image = arena.alloc<float>(pixels * 3);
+		render_params_c frame_params = params;
+		frame_params.progress = false;
+		bool same = true;
+		double pixel_time = 0;
+		size_t cube_memory = 0, quad_memory = 0;
+		for(uint i=0;i<CUBE_AMOUNT;i++) {
+			cube_memory+= scene.cube_count[i] * sizeof(cube_c);
+			quad_memory+= scene.quad_count[i] * sizeof(quad_c);
+		}
+		std::cout << "Cubes: " << (cube_memory + 1023) / 1024 << " KB, quads: " << (quad_memory + 1023) / 1024 << " KB with ";
+		if(QUAD_BITS == 0) std::cout << "float bounds" << std::endl;
+		else std::cout << QUAD_BITS << " bit bounds" << std::endl;
+		std::cout << "Tracing " << params.width << "x" << params.height << " frames" << std::endl;
+		std::cout << "Levels      Cubes      Quads    Speedup" << std::endl;
+		for(uint levels=1;levels<=CUBE_AMOUNT;levels++) {
+			scene.cube_levels = levels;
+			scene.quad_test = false;
+			cdouble cubes_time = time_frame(scene, frame_params, cubes_image, depth_buffer);
+			scene.quad_test = true;
+			cdouble quads_time = time_frame(scene, frame_params, quads_image, depth_buffer);
+			pixel_time = quads_time;
+			std::cout.width(6);
+			std::cout << levels;
+			std::cout.width(9);
+			std::cout << (int)cubes_time << " ms";
+			std::cout.width(8);
+			std::cout << (int)quads_time << " ms";
+			std::cout.width(10);
+			std::cout << int(cubes_time / quads_time * 100.0 + 0.5) / 100.0 << "x";
+			if(memcmp(cubes_image, quads_image, pixels * 3 * sizeof(float)) != 0) {
+				std::cout << " (the frames differ!)";
+				same = false;
+			}
+			std::cout << std::endl;
+		}
+		//The last frame above was traced pixel by pixel with every level and the quads
+		scene.cube_levels = CUBE_AMOUNT;
+		frame_params.ray_streams = true;
+		cdouble stream_time = time_frame(scene, frame_params, cubes_image, depth_buffer);
+		frame_params.ray_streams = false;
+		std::cout << "Tracing in ray streams took " << (int)stream_time << " ms, " << int(pixel_time / stream_time * 100.0 + 0.5) / 100.0 << "x the speed of tracing pixel by pixel";
+		if(memcmp(cubes_image, quads_image, pixels * 3 * sizeof(float)) != 0) {
+			std::cout << " (the frames differ!)";
+			same = false;
+		}
+		std::cout << std::endl;
+		arena.reset();
+		if(!time_shading(scene, frame_params, arena)) same = false;
+		arena.reset();
+		time_post_process(scene, frame_params, arena);
+		arena.report();
+		return same;
+	#else
+		std::cout << "There are no cubes to benchmark without CUBE_AMOUNT!" << std::endl;
+		return false;
+	#endif
+}
@@ -0,0 +1,14 @@
+/** bench.hpp **/
+
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+#include "global.hpp"
+#include "scene.hpp"
+#include "render.hpp"
+
+#define BENCH_RUNS 1 //Frames traced for every case; the fastest one counts
+
+bool run_benchmark(scene_c &scene, const render_params_c &params);
+
+#endif
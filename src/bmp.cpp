@@ -3,31 +3,12 @@
 #include "global.hpp"
 #include <iostream>
 #include <fstream>
+#include <cstdio>
+#include <cstring>
 
-//Returns data in RGB format starting from top left corner of the image
-uchar *load_source_image() {
-	cuchar width = 192;
-	cuchar height = 128;
-	FILE *file = fopen("malli.bmp", "rb");
-	if(file == NULL) {
-		std::cout << "Couldn't open malli.bmp!" << std::endl;
-		return NULL;
-	}
-	for(uchar i=0;i<54;i++) getc(file);
-	uchar *pixels = new uchar[width * height];
-	for(uchar i=0;i<height;i++) {
-		for(uchar j=0;j<width;j++) {
-			pixels[/*(height -*/ i /*- 1)*/ * width + j] = getc(file);
-			getc(file); getc(file);
-		}
-	}
-	fclose(file);
-	return pixels;
-}
-
-//Returns data in RGB format starting from top left corner of the image
-//Supports 24 and 32 bit bmp:s without alpha
-uchar *load_bmp(cchar *path, uint &width, uint &height) {
+//Opens the file and reads the header
+//Returns NULL if the file can't be opened or the format is not supported
+static FILE *open_bmp(cchar *path, uint &width, uint &height, uchar &bpp) {
 	width = 0;
 	height = 0;
 	FILE *file = fopen(path, "rb");
@@ -39,63 +20,110 @@ uchar *load_bmp(cchar *path, uint &width, uint &height) {
 	for(uchar i=0;i<4;i++) width+= getc(file) << (i * 8);
 	for(uchar i=0;i<4;i++) height+= getc(file) << (i * 8);
 	getc(file); getc(file);
-	uchar bpp = getc(file); //Bits per pixel
+	bpp = getc(file); //Bits per pixel
 	if(bpp != 24 && bpp != 32) {
 		std::cout << "Bitmap format " << (int)bpp << " bits per pixel not supported!" << std::endl;
+		fclose(file);
 		return NULL;
 	}
 	for(uchar i=0;i<25;i++) getc(file);
-	uchar *pixels = new uchar[width * height * 3];
+	return file;
+}
+
+//The rows are read whole as getc takes a lock for every byte once the program has more than one thread
+static void read_bmp(FILE *file, uchar *pixels, cuint width, cuint height, cuchar bpp) {
+	cuint bytes = bpp / 8;
+	cuint row_size = (width * bytes + 3) / 4 * 4;
+	uchar *row = new uchar[row_size];
 	for(uint i=0;i<height;i++) {
+		if(fread(row, 1, row_size, file) != row_size) memset(row, 255, row_size); //getc gave 255 past the end of the file
+		uchar *pixel = pixels + (height - i - 1) * width * 3;
 		for(uint j=0;j<width;j++) {
-			pixels[((height - i - 1) * width + j) * 3 + 2] = getc(file);
-			pixels[((height - i - 1) * width + j) * 3 + 1] = getc(file);
-			pixels[((height - i - 1) * width + j) * 3] = getc(file);
-			if(bpp == 32) getc(file);
-		}
-		if(bpp == 24 && width % 4 != 0) {
-			 for(uchar i=0;i<4-width*3%4;i++) getc(file);
+			pixel[j * 3 + 2] = row[j * bytes];
+			pixel[j * 3 + 1] = row[j * bytes + 1];
+			pixel[j * 3] = row[j * bytes + 2];
 		}
 	}
+	delete [] row;
 	fclose(file);
-	return pixels;
 }
 
-inline void put_special(std::ofstream &file, cuint value) {
-	for(uchar i=0;i<4;i++) file.put((value & (255 << (i * 8))) >> (i * 8));
+//Returns data in RGB format starting from top left corner of the image
+//Supports 24 and 32 bit bmp:s without alpha
+uchar *load_bmp(cchar *path, uint &width, uint &height) {
+	uchar bpp;
+	FILE *file = open_bmp(path, width, height, bpp);
+	if(file == NULL) return NULL;
+	uchar *pixels = new uchar[width * height * 3];
+	read_bmp(file, pixels, width, height, bpp);
+	return pixels;
 }
 
-void save_bmp(cuchar *data, cushort width, cushort height) {
-	std::ifstream temp_file;
-	std::ofstream file("teos.bmp", std::ios::binary);
-	if(!file.good()) {
-		std::cout << "Couldn't create teos.bmp!" << std::endl;
-		return;
+//Same as above but reads the data into pixels which must have room for an image of the given size
+//Fails if the image is of different size
+bool load_bmp(cchar *path, uchar *pixels, cuint width, cuint height) {
+	uint file_width, file_height;
+	uchar bpp;
+	FILE *file = open_bmp(path, file_width, file_height, bpp);
+	if(file == NULL) return false;
+	if(file_width != width || file_height != height) {
+		std::cout << path << " is not " << width << "x" << height << "!" << std::endl;
+		fclose(file);
+		return false;
 	}
+	read_bmp(file, pixels, width, height, bpp);
+	return true;
+}
+
+inline void put_special(uchar *&out, cuint value) {
+	for(uchar i=0;i<4;i++) *out++ = (value & (255 << (i * 8))) >> (i * 8);
+}
+
+//Size of the bmp file encode_bmp creates
+uint bmp_size(cuint width, cuint height) {
+	return width * height * 3 + width % 4 * height + 54;
+}
+
+//Writes a whole 24 bit bmp file into out which must have room for bmp_size bytes
+void encode_bmp(cuchar *data, cuint width, cuint height, uchar *out) {
 	cuchar padding = width % 4;
-	file.put(66); //B
-	file.put(77); //M
-	put_special(file, width * height * 3 + padding * height + 54); //size of the file
-	for(uchar i=0;i<4;i++) file.put(0);
-	file.put(54); //offset to image data
-	for(uchar i=0;i<3;i++) file.put(0);
-	file.put(40); //size of this header
-	for(uchar i=0;i<3;i++) file.put(0);
-	put_special(file, width); //width of the bitmap
-	put_special(file, height); //height of the bitmap
-	file.put(1);
-	file.put(0);
-	file.put(24); //bits per pixel
-	for(uchar i=0;i<5;i++) file.put(0);
-	put_special(file, width * height * 3); //size of the pixel data
-	for(uchar i=0;i<16;i++) file.put(0);
-	for(ushort i=0;i<height;i++) {
-		for(ushort j=0;j<width;j++) {
-			file.put(data[(i * width + j) * 3 + 2]);
-			file.put(data[(i * width + j) * 3 + 1]);
-			file.put(data[(i * width + j) * 3]);
+	*out++ = 66; //B
+	*out++ = 77; //M
+	put_special(out, bmp_size(width, height)); //size of the file
+	for(uchar i=0;i<4;i++) *out++ = 0;
+	*out++ = 54; //offset to image data
+	for(uchar i=0;i<3;i++) *out++ = 0;
+	*out++ = 40; //size of this header
+	for(uchar i=0;i<3;i++) *out++ = 0;
+	put_special(out, width); //width of the bitmap
+	put_special(out, height); //height of the bitmap
+	*out++ = 1;
+	*out++ = 0;
+	*out++ = 24; //bits per pixel
+	for(uchar i=0;i<5;i++) *out++ = 0;
+	put_special(out, width * height * 3); //size of the pixel data
+	for(uchar i=0;i<16;i++) *out++ = 0;
+	for(uint i=0;i<height;i++) {
+		for(uint j=0;j<width;j++) {
+			*out++ = data[(i * width + j) * 3 + 2];
+			*out++ = data[(i * width + j) * 3 + 1];
+			*out++ = data[(i * width + j) * 3];
 		}
-		for(uchar j=0;j<padding;j++) file.put(0);
+		for(uchar j=0;j<padding;j++) *out++ = 0;
+	}
+}
+
+bool save_bmp(cuchar *data, cushort width, cushort height, cchar *path) {
+	std::ofstream file(path, std::ios::binary);
+	if(!file.good()) {
+		std::cout << "Couldn't create " << path << "!" << std::endl;
+		return false;
 	}
+	cuint size = bmp_size(width, height);
+	uchar *bmp = new uchar[size];
+	encode_bmp(data, width, height, bmp);
+	file.write((cchar*)bmp, size);
+	delete [] bmp;
 	file.close();
+	return file.good();
 }
@@ -5,8 +5,10 @@
 
 #include "global.hpp"
 
-uchar *load_source_image();
 uchar *load_bmp(cchar *path, uint &width, uint &height);
-void save_bmp(cuchar *data, cushort width = 192, cushort height = 128);
+bool load_bmp(cchar *path, uchar *pixels, cuint width, cuint height);
+uint bmp_size(cuint width, cuint height);
+void encode_bmp(cuchar *data, cuint width, cuint height, uchar *out);
+bool save_bmp(cuchar *data, cushort width = 192, cushort height = 128, cchar *path = "teos.bmp");
 
 #endif
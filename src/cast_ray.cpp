@@ -52,7 +52,7 @@ bool cast_ray2(float &a, float &b, float &c, float &rx, float &ry, float &rz,
 //c is the multiplier of the viewer vector for the collision (kind of like the distance from the viewer)
 	//c is used for depth testing and testing if something is between a light and a position in 3D space
 //returns false if the ray doesn't hit the cube around the polygon
-bool cast_ray(polygon_c &polygon, float &a, float &b, float &c, float &rx, float &ry, float &rz,
+bool cast_ray(const polygon_c &polygon, float &a, float &b, float &c, float &rx, float &ry, float &rz,
 		cfloat J, cfloat K, cfloat L, cfloat x, cfloat y, cfloat z) {
 	cfloat M = x - J;
 	cfloat N = y - K;
@@ -79,23 +79,31 @@ bool cast_ray(polygon_c &polygon, float &a, float &b, float &c, float &rx, float
 		rz = L + c * O;
 		return true;
 	#endif
-	//Try to make the calculation three times and swap the polygon if it failed
-	//Only swap 3 times at max because after 3 swaps the order of the vertexes in the polygon is the same as it originally was
+	//Try to make the calculation three times and rotate the vertexes if it failed
+	//Only rotate 3 times at max because after 3 rotations the order of the vertexes is the same as it originally was
+	//The vertexes are rotated in local copies so that the polygon itself is never written to
+	//	This keeps the scene read-only which is needed when it is mapped straight from a scene cache file
+	float vx1 = polygon.x1, vy1 = polygon.y1, vz1 = polygon.z1;
+	float vx2 = polygon.x2, vy2 = polygon.y2, vz2 = polygon.z2;
+	float vx3 = polygon.x3, vy3 = polygon.y3, vz3 = polygon.z3;
 	for(uchar t=0;t<3;t++) {
-		cfloat A = polygon.x1;
-		cfloat B = polygon.y1;
-		cfloat C = polygon.z1;
-		cfloat D = polygon.x2 - A;
-		cfloat E = polygon.y2 - B;
-		cfloat F = polygon.z2 - C;
-		cfloat G = polygon.x3 - A;
-		cfloat H = polygon.y3 - B;
-		cfloat I = polygon.z3 - C;
+		cfloat A = vx1;
+		cfloat B = vy1;
+		cfloat C = vz1;
+		cfloat D = vx2 - A;
+		cfloat E = vy2 - B;
+		cfloat F = vz2 - C;
+		cfloat G = vx3 - A;
+		cfloat H = vy3 - B;
+		cfloat I = vz3 - C;
 		//Try with different orders of the values
 		if(cast_ray2(a, b, c, rx, ry, rz, A, B, C, D, E, F, G, H, I, J, K, L, M, N, O)) return true;
 		if(cast_ray2(a, b, c, rz, rx, ry, C, A, B, F, D, E, I, G, H, L, J, K, O, M, N)) return true;
 		if(cast_ray2(a, b, c, ry, rz, rx, B, C, A, E, F, D, H, I, G, K, L, J, N, O, M)) return true;
-		polygon.swap();
+		cfloat xtemp = vx1, ytemp = vy1, ztemp = vz1;
+		vx1 = vx2; vy1 = vy2; vz1 = vz2;
+		vx2 = vx3; vy2 = vy3; vz2 = vz3;
+		vx3 = xtemp; vy3 = ytemp; vz3 = ztemp;
 	}
 	return false; //It should be impossible to ever get this far
 }
@@ -3,27 +3,64 @@
 #include "cube.hpp"
 #include "math.hpp"
 
-cube_c::cube_c(const std::vector<polygon_c> &polygons, cuint id1, cuint id2, cuint id3, cuint id4): hit(false) {
-	minx = min(polygons.at(id1).minx, min(polygons.at(id2).minx, min(polygons.at(id3).minx, polygons.at(id4).minx)));
-	maxx = max(polygons.at(id1).maxx, max(polygons.at(id2).maxx, max(polygons.at(id3).maxx, polygons.at(id4).maxx)));
-	miny = min(polygons.at(id1).miny, min(polygons.at(id2).miny, min(polygons.at(id3).miny, polygons.at(id4).miny)));
-	maxy = max(polygons.at(id1).maxy, max(polygons.at(id2).maxy, max(polygons.at(id3).maxy, polygons.at(id4).maxy)));
-	minz = min(polygons.at(id1).minz, min(polygons.at(id2).minz, min(polygons.at(id3).minz, polygons.at(id4).minz)));
-	maxz = max(polygons.at(id1).maxz, max(polygons.at(id2).maxz, max(polygons.at(id3).maxz, polygons.at(id4).maxz)));
+#include <cmath>
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+cube_c::cube_c(const polygon_c *polygons, cuint id1, cuint id2, cuint id3, cuint id4): hit(false) {
+	minx = min(polygons[id1].minx, min(polygons[id2].minx, min(polygons[id3].minx, polygons[id4].minx)));
+	maxx = max(polygons[id1].maxx, max(polygons[id2].maxx, max(polygons[id3].maxx, polygons[id4].maxx)));
+	miny = min(polygons[id1].miny, min(polygons[id2].miny, min(polygons[id3].miny, polygons[id4].miny)));
+	maxy = max(polygons[id1].maxy, max(polygons[id2].maxy, max(polygons[id3].maxy, polygons[id4].maxy)));
+	minz = min(polygons[id1].minz, min(polygons[id2].minz, min(polygons[id3].minz, polygons[id4].minz)));
+	maxz = max(polygons[id1].maxz, max(polygons[id2].maxz, max(polygons[id3].maxz, polygons[id4].maxz)));
 }
 
-cube_c::cube_c(const std::vector<cube_c> &cubes, cuint id1, cuint id2, cuint id3, cuint id4): hit(false) {
-	minx = min(cubes.at(id1).minx, min(cubes.at(id2).minx, min(cubes.at(id3).minx, cubes.at(id4).minx)));
-	maxx = max(cubes.at(id1).maxx, max(cubes.at(id2).maxx, max(cubes.at(id3).maxx, cubes.at(id4).maxx)));
-	miny = min(cubes.at(id1).miny, min(cubes.at(id2).miny, min(cubes.at(id3).miny, cubes.at(id4).miny)));
-	maxy = max(cubes.at(id1).maxy, max(cubes.at(id2).maxy, max(cubes.at(id3).maxy, cubes.at(id4).maxy)));
-	minz = min(cubes.at(id1).minz, min(cubes.at(id2).minz, min(cubes.at(id3).minz, cubes.at(id4).minz)));
-	maxz = max(cubes.at(id1).maxz, max(cubes.at(id2).maxz, max(cubes.at(id3).maxz, cubes.at(id4).maxz)));
+cube_c::cube_c(const cube_c *cubes, cuint id1, cuint id2, cuint id3, cuint id4): hit(false) {
+	minx = min(cubes[id1].minx, min(cubes[id2].minx, min(cubes[id3].minx, cubes[id4].minx)));
+	maxx = max(cubes[id1].maxx, max(cubes[id2].maxx, max(cubes[id3].maxx, cubes[id4].maxx)));
+	miny = min(cubes[id1].miny, min(cubes[id2].miny, min(cubes[id3].miny, cubes[id4].miny)));
+	maxy = max(cubes[id1].maxy, max(cubes[id2].maxy, max(cubes[id3].maxy, cubes[id4].maxy)));
+	minz = min(cubes[id1].minz, min(cubes[id2].minz, min(cubes[id3].minz, cubes[id4].minz)));
+	maxz = max(cubes[id1].maxz, max(cubes[id2].maxz, max(cubes[id3].maxz, cubes[id4].maxz)));
 }
 
+//A cube around a single polygon that can be grown with add
+cube_c::cube_c(const polygon_c &polygon): minx(polygon.minx), maxx(polygon.maxx), miny(polygon.miny), maxy(polygon.maxy), minz(polygon.minz), maxz(polygon.maxz), hit(false) {}
+
 //This is an empty cube and any ray will always hit it
 cube_c::cube_c(): hit(true) {}
 
+void cube_c::add(const polygon_c &polygon) {
+	minx = min(minx, polygon.minx);
+	maxx = max(maxx, polygon.maxx);
+	miny = min(miny, polygon.miny);
+	maxy = max(maxy, polygon.maxy);
+	minz = min(minz, polygon.minz);
+	maxz = max(maxz, polygon.maxz);
+}
+
+void cube_c::add(const cube_c &cube) {
+	hit|= cube.hit;
+	minx = min(minx, cube.minx);
+	maxx = max(maxx, cube.maxx);
+	miny = min(miny, cube.miny);
+	maxy = max(maxy, cube.maxy);
+	minz = min(minz, cube.minz);
+	maxz = max(maxz, cube.maxz);
+}
+
+void cube_c::grow(cfloat margin) {
+	minx-= margin;
+	maxx+= margin;
+	miny-= margin;
+	maxy+= margin;
+	minz-= margin;
+	maxz+= margin;
+}
+
 bool cube_c::test_hit(cfloat J, cfloat K, cfloat L, cfloat x, cfloat y, cfloat z) const {
 	if(hit) return true;
 	cfloat M = x - J;
@@ -44,3 +81,207 @@ bool cube_c::test_hit(cfloat J, cfloat K, cfloat L, cfloat x, cfloat y, cfloat z
 	if(minv > maxv) return false;
 	return true;
 }
+
+//Same as above but only the part of the ray starting from J, K, L is tested
+bool cube_c::test_ray(cfloat J, cfloat K, cfloat L, cfloat x, cfloat y, cfloat z) const {
+	if(hit) return true;
+	cfloat M = x - J;
+	cfloat N = y - K;
+	cfloat O = z - L;
+	cfloat x1 = (minx - J) / M;
+	cfloat x2 = (maxx - J) / M;
+	cfloat y1 = (miny - K) / N;
+	cfloat y2 = (maxy - K) / N;
+	cfloat z1 = (minz - L) / O;
+	cfloat z2 = (maxz - L) / O;
+	cfloat minv = max(max(min(x1, x2), min(y1, y2)), min(z1, z2));
+	cfloat maxv = min(min(max(x1, x2), max(y1, y2)), max(z1, z2));
+	return minv <= maxv && maxv >= 0;
+}
+
+#if QUAD_BITS == 0
+//Copies the boxes of the cubes first to first + 3 that are below count
+quad_c::quad_c(const cube_c *cubes, cuint first, cuint count) {
+	for(uint i=0;i<QUAD_SIZE;i++) {
+		if(first + i >= count) {
+			minx[i] = miny[i] = minz[i] = QUAD_FAR;
+			maxx[i] = maxy[i] = maxz[i] = -QUAD_FAR;
+		}
+		else if(cubes[first + i].hit) {
+			minx[i] = miny[i] = minz[i] = -QUAD_FAR;
+			maxx[i] = maxy[i] = maxz[i] = QUAD_FAR;
+		}
+		else {
+			const cube_c &cube = cubes[first + i];
+			minx[i] = cube.minx; maxx[i] = cube.maxx;
+			miny[i] = cube.miny; maxy[i] = cube.maxy;
+			minz[i] = cube.minz; maxz[i] = cube.maxz;
+		}
+	}
+}
+#else
+//The step so that origin + QUAD_STEPS * scale isn't below high
+static float quad_scale(cfloat origin, cfloat high) {
+	if(high <= origin) return 0;
+	float scale = (high - origin) / QUAD_STEPS;
+	while(origin + float(QUAD_STEPS) * scale < high) scale = nextafterf(scale, QUAD_FAR);
+	return scale;
+}
+
+//Rounds the bounds outwards to the steps so that the quantized box always covers the real one
+static void quantize(cfloat origin, cfloat scale, cfloat low, cfloat high, quad_value &qlow, quad_value &qhigh) {
+	if(scale == 0) {
+		qlow = 0;
+		qhigh = 0;
+		return;
+	}
+	float q = clampf(floor((low - origin) / scale), 0, QUAD_STEPS);
+	while(q > 0 && origin + q * scale > low) q--;
+	qlow = (quad_value)q;
+	q = clampf(ceil((high - origin) / scale), 0, QUAD_STEPS);
+	while(q < QUAD_STEPS && origin + q * scale < high) q++;
+	qhigh = (quad_value)q;
+}
+
+//Quantizes the boxes of the cubes first to first + 3 that are below count inside a box around them
+quad_c::quad_c(const cube_c *cubes, cuint first, cuint count): always(0), never(0) {
+	float high_x = -QUAD_FAR, high_y = -QUAD_FAR, high_z = -QUAD_FAR;
+	origin_x = origin_y = origin_z = QUAD_FAR;
+	for(uint i=0;i<QUAD_SIZE;i++) {
+		if(first + i >= count) never|= 1 << i;
+		else if(cubes[first + i].hit) always|= 1 << i;
+		else {
+			const cube_c &cube = cubes[first + i];
+			origin_x = min(origin_x, cube.minx); high_x = max(high_x, cube.maxx);
+			origin_y = min(origin_y, cube.miny); high_y = max(high_y, cube.maxy);
+			origin_z = min(origin_z, cube.minz); high_z = max(high_z, cube.maxz);
+		}
+	}
+	if(origin_x > high_x) origin_x = origin_y = origin_z = high_x = high_y = high_z = 0;
+	scale_x = quad_scale(origin_x, high_x);
+	scale_y = quad_scale(origin_y, high_y);
+	scale_z = quad_scale(origin_z, high_z);
+	for(uint i=0;i<QUAD_SIZE;i++) {
+		minx[i] = maxx[i] = miny[i] = maxy[i] = minz[i] = maxz[i] = 0;
+		if((always | never) & (1 << i)) continue;
+		const cube_c &cube = cubes[first + i];
+		quantize(origin_x, scale_x, cube.minx, cube.maxx, minx[i], maxx[i]);
+		quantize(origin_y, scale_y, cube.miny, cube.maxy, miny[i], maxy[i]);
+		quantize(origin_z, scale_z, cube.minz, cube.maxz, minz[i], maxz[i]);
+	}
+}
+#endif
+
+#ifdef __SSE2__
+	//Loads the 4 bounds of an axis as floats
+	#if QUAD_BITS == 0
+		static inline __m128 load_bounds(cfloat *bounds, const __m128, const __m128) {
+			return _mm_loadu_ps(bounds);
+		}
+	#else
+		static inline __m128 load_bounds(const quad_value *bounds, const __m128 origin, const __m128 scale) {
+			#if QUAD_BITS == 8
+				const __m128i bytes = _mm_cvtsi32_si128(bounds[0] | bounds[1] << 8 | bounds[2] << 16 | bounds[3] << 24);
+				const __m128i values = _mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, _mm_setzero_si128()), _mm_setzero_si128());
+			#else
+				const __m128i values = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)bounds), _mm_setzero_si128());
+			#endif
+			return _mm_add_ps(origin, _mm_mul_ps(_mm_cvtepi32_ps(values), scale));
+		}
+	#endif
+#endif
+
+//Tests the ray from J, K, L with the inverse direction ix, iy, iz against the 4 boxes at once
+//Returns a bit for every box the ray enters before limit and writes where it enters them into entry
+//The ray is in the same units as c of cast_ray
+uint quad_c::test_ray(cfloat J, cfloat K, cfloat L, cfloat ix, cfloat iy, cfloat iz, cfloat limit, float *entry) const {
+	#if QUAD_BITS == 0
+		const float origin_x = 0, origin_y = 0, origin_z = 0, scale_x = 1, scale_y = 1, scale_z = 1;
+	#endif
+	#ifdef __SSE2__
+		const __m128 ox = _mm_set1_ps(origin_x), oy = _mm_set1_ps(origin_y), oz = _mm_set1_ps(origin_z);
+		const __m128 sx = _mm_set1_ps(scale_x), sy = _mm_set1_ps(scale_y), sz = _mm_set1_ps(scale_z);
+		const __m128 j = _mm_set1_ps(J), k = _mm_set1_ps(K), l = _mm_set1_ps(L);
+		const __m128 vx = _mm_set1_ps(ix), vy = _mm_set1_ps(iy), vz = _mm_set1_ps(iz);
+		const __m128 x1 = _mm_mul_ps(_mm_sub_ps(load_bounds(minx, ox, sx), j), vx);
+		const __m128 x2 = _mm_mul_ps(_mm_sub_ps(load_bounds(maxx, ox, sx), j), vx);
+		const __m128 y1 = _mm_mul_ps(_mm_sub_ps(load_bounds(miny, oy, sy), k), vy);
+		const __m128 y2 = _mm_mul_ps(_mm_sub_ps(load_bounds(maxy, oy, sy), k), vy);
+		const __m128 z1 = _mm_mul_ps(_mm_sub_ps(load_bounds(minz, oz, sz), l), vz);
+		const __m128 z2 = _mm_mul_ps(_mm_sub_ps(load_bounds(maxz, oz, sz), l), vz);
+		const __m128 minv = _mm_max_ps(_mm_max_ps(_mm_min_ps(x1, x2), _mm_min_ps(y1, y2)), _mm_min_ps(z1, z2));
+		const __m128 maxv = _mm_min_ps(_mm_min_ps(_mm_max_ps(x1, x2), _mm_max_ps(y1, y2)), _mm_max_ps(z1, z2));
+		const __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmple_ps(minv, maxv), _mm_cmpge_ps(maxv, _mm_setzero_ps())), _mm_cmple_ps(minv, _mm_set1_ps(limit)));
+		_mm_storeu_ps(entry, minv);
+		uint hits = _mm_movemask_ps(inside);
+	#else
+		uint hits = 0;
+		for(uint i=0;i<QUAD_SIZE;i++) {
+			cfloat x1 = (origin_x + minx[i] * scale_x - J) * ix, x2 = (origin_x + maxx[i] * scale_x - J) * ix;
+			cfloat y1 = (origin_y + miny[i] * scale_y - K) * iy, y2 = (origin_y + maxy[i] * scale_y - K) * iy;
+			cfloat z1 = (origin_z + minz[i] * scale_z - L) * iz, z2 = (origin_z + maxz[i] * scale_z - L) * iz;
+			cfloat minv = max(max(min(x1, x2), min(y1, y2)), min(z1, z2));
+			cfloat maxv = min(min(max(x1, x2), max(y1, y2)), max(z1, z2));
+			entry[i] = minv;
+			if(minv <= maxv && maxv >= 0 && minv <= limit) hits|= 1 << i;
+		}
+	#endif
+	#if QUAD_BITS != 0
+		hits&= ~never;
+		if(always) {
+			for(uint i=0;i<QUAD_SIZE;i++) {
+				if(always & (1 << i)) entry[i] = -QUAD_FAR;
+			}
+			hits|= always;
+		}
+	#endif
+	return hits;
+}
+
+//The same as test_ray for the rays listed in rays, whose origins and inverse directions are in the arrays, with the bounds loaded only once
+//The bits of the ray n go into hits[n] and where it enters the boxes into entries[n * 4] to entries[n * 4 + 3]
+//limits holds the limit of every ray or is NULL for rays of any length
+void quad_c::test_rays(cuint count, cuint *rays, cfloat *J, cfloat *K, cfloat *L, cfloat *ix, cfloat *iy, cfloat *iz, cfloat *limits, uchar *hits, float *entries) const {
+	#ifdef __SSE2__
+		#if QUAD_BITS == 0
+			const float origin_x = 0, origin_y = 0, origin_z = 0, scale_x = 1, scale_y = 1, scale_z = 1;
+		#endif
+		const __m128 ox = _mm_set1_ps(origin_x), oy = _mm_set1_ps(origin_y), oz = _mm_set1_ps(origin_z);
+		const __m128 sx = _mm_set1_ps(scale_x), sy = _mm_set1_ps(scale_y), sz = _mm_set1_ps(scale_z);
+		const __m128 lowx = load_bounds(minx, ox, sx), highx = load_bounds(maxx, ox, sx);
+		const __m128 lowy = load_bounds(miny, oy, sy), highy = load_bounds(maxy, oy, sy);
+		const __m128 lowz = load_bounds(minz, oz, sz), highz = load_bounds(maxz, oz, sz);
+		for(uint n=0;n<count;n++) {
+			cuint r = rays[n];
+			const __m128 j = _mm_set1_ps(J[r]), k = _mm_set1_ps(K[r]), l = _mm_set1_ps(L[r]);
+			const __m128 vx = _mm_set1_ps(ix[r]), vy = _mm_set1_ps(iy[r]), vz = _mm_set1_ps(iz[r]);
+			const __m128 x1 = _mm_mul_ps(_mm_sub_ps(lowx, j), vx);
+			const __m128 x2 = _mm_mul_ps(_mm_sub_ps(highx, j), vx);
+			const __m128 y1 = _mm_mul_ps(_mm_sub_ps(lowy, k), vy);
+			const __m128 y2 = _mm_mul_ps(_mm_sub_ps(highy, k), vy);
+			const __m128 z1 = _mm_mul_ps(_mm_sub_ps(lowz, l), vz);
+			const __m128 z2 = _mm_mul_ps(_mm_sub_ps(highz, l), vz);
+			const __m128 minv = _mm_max_ps(_mm_max_ps(_mm_min_ps(x1, x2), _mm_min_ps(y1, y2)), _mm_min_ps(z1, z2));
+			const __m128 maxv = _mm_min_ps(_mm_min_ps(_mm_max_ps(x1, x2), _mm_max_ps(y1, y2)), _mm_max_ps(z1, z2));
+			const __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmple_ps(minv, maxv), _mm_cmpge_ps(maxv, _mm_setzero_ps())), _mm_cmple_ps(minv, _mm_set1_ps(limits == NULL ? QUAD_FAR : limits[r])));
+			float *entry = entries + n * QUAD_SIZE;
+			_mm_storeu_ps(entry, minv);
+			uint bits = _mm_movemask_ps(inside);
+			#if QUAD_BITS != 0
+				bits&= ~never;
+				if(always) {
+					for(uint i=0;i<QUAD_SIZE;i++) {
+						if(always & (1 << i)) entry[i] = -QUAD_FAR;
+					}
+					bits|= always;
+				}
+			#endif
+			hits[n] = bits;
+		}
+	#else
+		for(uint n=0;n<count;n++) {
+			cuint r = rays[n];
+			hits[n] = test_ray(J[r], K[r], L[r], ix[r], iy[r], iz[r], limits == NULL ? QUAD_FAR : limits[r], entries + n * QUAD_SIZE);
+		}
+	#endif
+}
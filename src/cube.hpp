@@ -5,21 +5,56 @@
 
 #include "global.hpp"
 #include "polygon.hpp"
-#include <vector>
 
 //This class represents a cuboid (not a cube a matter of fact)
 //Cubes are used to quickly test wether a ray can hit groups of polygons or cubes by placing cubes around them
 //Testing wether a ray hits a cube is way faster than testing wether it hits a polygon
 class cube_c {
+	friend class quad_c;
 	private:
 		float minx, maxx, miny, maxy, minz, maxz;
 		bool hit;
 
 	public:
-		cube_c(const std::vector<polygon_c> &polygons, cuint id1, cuint id2, cuint id3, cuint id4);
-		cube_c(const std::vector<cube_c> &cubes, cuint id1, cuint id2, cuint id3, cuint id4);
+		cube_c(const polygon_c *polygons, cuint id1, cuint id2, cuint id3, cuint id4);
+		cube_c(const cube_c *cubes, cuint id1, cuint id2, cuint id3, cuint id4);
+		cube_c(const polygon_c &polygon);
 		cube_c();
+		void add(const polygon_c &polygon);
+		void add(const cube_c &cube);
+		void grow(cfloat margin);
 		bool test_hit(cfloat J, cfloat K, cfloat L, cfloat x, cfloat y, cfloat z) const;
+		bool test_ray(cfloat J, cfloat K, cfloat L, cfloat x, cfloat y, cfloat z) const;
+};
+
+#define QUAD_SIZE 4 //Cubes or polygons under a cube
+#define QUAD_FAR 1e30f //Bounds of the cubes that are always or never hit and the limit of rays of any length
+#define QUAD_BITS 0 //The quads keep full float bounds with 0 or bounds quantized to 8 or 16 bits which take less cache
+
+#if QUAD_BITS == 8
+	typedef unsigned char quad_value;
+	#define QUAD_STEPS 255
+#elif QUAD_BITS == 16
+	typedef unsigned short quad_value;
+	#define QUAD_STEPS 65535
+#endif
+
+//The boxes of the 4 cubes under a cube side by side so that a ray can be tested against all of them at once
+//The quad m of a level holds the cubes 4m to 4m + 3 of the level; a missing cube is never hit and an empty cube is always hit
+//Quantized bounds are steps of scale from origin, which is the corner of a box around the 4 cubes, rounded outwards
+class quad_c {
+	public:
+		#if QUAD_BITS == 0
+			float minx[QUAD_SIZE], maxx[QUAD_SIZE], miny[QUAD_SIZE], maxy[QUAD_SIZE], minz[QUAD_SIZE], maxz[QUAD_SIZE];
+		#else
+			float origin_x, origin_y, origin_z;
+			float scale_x, scale_y, scale_z;
+			quad_value minx[QUAD_SIZE], maxx[QUAD_SIZE], miny[QUAD_SIZE], maxy[QUAD_SIZE], minz[QUAD_SIZE], maxz[QUAD_SIZE];
+			uchar always, never; //A bit for every cube that is always or never hit
+		#endif
+		quad_c(const cube_c *cubes, cuint first, cuint count);
+		uint test_ray(cfloat J, cfloat K, cfloat L, cfloat ix, cfloat iy, cfloat iz, cfloat limit, float *entry) const;
+		void test_rays(cuint count, cuint *rays, cfloat *J, cfloat *K, cfloat *L, cfloat *ix, cfloat *iy, cfloat *iz, cfloat *limits, uchar *hits, float *entries) const;
 };
 
 #endif
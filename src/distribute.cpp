@@ -0,0 +1,186 @@
+/** distribute.cpp **/
+
+/*
+
+	A frame can be traced by several processes that may run on other machines.
+	The coordinator splits the frame into tiles and gives them to the workers which are started with a command like:
+
+		<command> <render parameters> --tile x1,x2,y1,y2
+
+	where the command is the program itself for local workers or something like "ssh host ./raytracer_linux" for remote ones.
+	The worker writes a header of five 32 bit words (TILE_MAGIC, x1, x2, y1, y2) to its standard output followed by
+	the floats of the traced tile and its depth buffer, rows from bottom to top.
+	A worker that exits with an error or doesn't send the whole tile gets its tile tried again by another worker.
+	The post processing needs the whole frame so it is run by the coordinator after every tile has been merged.
+
+*/
+
+#include "distribute.hpp"
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+#ifdef _WIN32
+	#include <fcntl.h>
+	#include <io.h>
+	#define popen _popen
+	#define pclose _pclose
+#else
+	#include <sys/wait.h>
+#endif
+
+//Traces the tile and writes it into the standard output
+bool send_tile(const scene_c &scene, const render_params_c &params, cuint x1, cuint x2, cuint y1, cuint y2, arena_c &arena) {
+	cuint pixels = (x2 - x1) * (y2 - y1);
+	float *image = arena.alloc<float>(pixels * 3);
+	float *depth_buffer = arena.alloc<float>(pixels);
+	trace_frame(scene, params, image, depth_buffer, x2 - x1, x1, x2, y1, y2);
+	#ifdef _WIN32
+		_setmode(_fileno(stdout), _O_BINARY);
+	#endif
+	const uint header[5] = {TILE_MAGIC, x1, x2, y1, y2};
+	if(fwrite(header, sizeof(header), 1, stdout) != 1) return false;
+	if(fwrite(image, sizeof(float) * 3, pixels, stdout) != pixels) return false;
+	if(fwrite(depth_buffer, sizeof(float), pixels, stdout) != pixels) return false;
+	return fflush(stdout) == 0;
+}
+
+class tile_c {
+	public:
+		uint x1, x2, y1, y2;
+		uint tries;
+		int failed_worker; //The worker that failed this tile last; -1 if none
+};
+
+//Everything the threads waiting for the workers share
+class coordinator_c {
+	public:
+		const render_params_c *params;
+		float *image;
+		float *depth_buffer;
+		std::mutex mutex;
+		std::deque<tile_c> tiles;
+		uint remaining; //Tiles that haven't been merged yet
+		uint working; //Workers that haven't been given up on
+		bool failed;
+		std::condition_variable changed; //Signaled whenever a tile is done or given back
+};
+
+//Runs a worker for the tile and merges the result into the frame
+static bool run_tile(coordinator_c &coordinator, const std::string &command, const tile_c &tile, float *buffer) {
+	char range[64];
+	snprintf(range, sizeof(range), " --tile %u,%u,%u,%u ", tile.x1, tile.x2, tile.y1, tile.y2);
+	#ifdef _WIN32
+		FILE *pipe = popen((command + range).c_str(), "rb");
+	#else
+		FILE *pipe = popen((command + range).c_str(), "r");
+	#endif
+	if(pipe == NULL) return false;
+	cuint tile_width = tile.x2 - tile.x1;
+	cuint pixels = tile_width * (tile.y2 - tile.y1);
+	uint header[5];
+	bool good = fread(header, sizeof(header), 1, pipe) == 1;
+	good = good && header[0] == TILE_MAGIC && header[1] == tile.x1 && header[2] == tile.x2 && header[3] == tile.y1 && header[4] == tile.y2;
+	good = good && fread(buffer, sizeof(float) * 4, pixels, pipe) == pixels;
+	const int status = pclose(pipe);
+	#ifdef _WIN32
+		good = good && status == 0;
+	#else
+		good = good && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	#endif
+	if(!good) return false;
+	//The tiles don't overlap so they can be copied without locking
+	cuint width = coordinator.params->width;
+	for(uint j=0;j<tile.y2-tile.y1;j++) {
+		memcpy(coordinator.image + ((tile.y1 + j) * width + tile.x1) * 3, buffer + j * tile_width * 3, tile_width * 3 * sizeof(float));
+		memcpy(coordinator.depth_buffer + (tile.y1 + j) * width + tile.x1, buffer + pixels * 3 + j * tile_width, tile_width * sizeof(float));
+	}
+	return true;
+}
+
+//Takes tiles for a single worker until every tile is done
+static void coordinate_worker(coordinator_c &coordinator, const std::string &command, cuint worker) {
+	float *buffer = new float[TILE_SIZE * TILE_SIZE * 4];
+	uint failures = 0;
+	std::unique_lock<std::mutex> lock(coordinator.mutex);
+	while(coordinator.remaining > 0 && !coordinator.failed) {
+		//Another worker is preferred for the tile this one failed last
+		uint i = 0;
+		while(i < coordinator.tiles.size() && coordinator.tiles[i].failed_worker == (int)worker && coordinator.working > 1) i++;
+		if(i == coordinator.tiles.size()) {
+			//The tiles left are being traced by other workers which may still fail them
+			coordinator.changed.wait(lock);
+			continue;
+		}
+		tile_c tile = coordinator.tiles[i];
+		coordinator.tiles.erase(coordinator.tiles.begin() + i);
+		lock.unlock();
+		const bool done = run_tile(coordinator, command, tile, buffer);
+		lock.lock();
+		if(done) {
+			failures = 0;
+			coordinator.remaining--;
+			#ifdef OUTPUT
+				if(coordinator.params->progress) std::cout << "Tile " << tile.x1 << "," << tile.y1 << " done by worker " << worker << ", " << coordinator.remaining << " left" << std::endl;
+			#endif
+		}
+		else {
+			std::cout << "Worker " << worker << " failed tile " << tile.x1 << "," << tile.y1 << std::endl;
+			tile.tries++;
+			tile.failed_worker = worker;
+			if(tile.tries > TILE_RETRIES) coordinator.failed = true;
+			else coordinator.tiles.push_back(tile);
+			if(++failures >= WORKER_FAILURES) {
+				std::cout << "Giving up on worker " << worker << std::endl;
+				if(--coordinator.working == 0) coordinator.failed = true;
+				coordinator.changed.notify_all();
+				break;
+			}
+		}
+		coordinator.changed.notify_all();
+	}
+	lock.unlock();
+	delete [] buffer;
+}
+
+//Traces the whole frame into image and depth_buffer with the workers
+//args are the render parameters given to every worker and every command is a worker that takes a tile at a time
+bool render_distributed(const render_params_c &params, cchar *args, const std::vector<cchar*> &commands, float *image, float *depth_buffer) {
+	coordinator_c coordinator;
+	coordinator.params = &params;
+	coordinator.image = image;
+	coordinator.depth_buffer = depth_buffer;
+	coordinator.working = commands.size();
+	coordinator.failed = false;
+	for(uint y=0;y<params.height;y+=TILE_SIZE) {
+		for(uint x=0;x<params.width;x+=TILE_SIZE) {
+			tile_c tile;
+			tile.x1 = x;
+			tile.x2 = x + TILE_SIZE < params.width ? x + TILE_SIZE : params.width;
+			tile.y1 = y;
+			tile.y2 = y + TILE_SIZE < params.height ? y + TILE_SIZE : params.height;
+			tile.tries = 0;
+			tile.failed_worker = -1;
+			coordinator.tiles.push_back(tile);
+		}
+	}
+	coordinator.remaining = coordinator.tiles.size();
+	#ifdef OUTPUT
+		if(params.progress) std::cout << "Tracing " << coordinator.remaining << " tiles with " << commands.size() << " workers" << std::endl;
+	#endif
+	std::vector<std::thread> threads;
+	for(uint i=0;i<commands.size();i++) {
+		threads.push_back(std::thread(coordinate_worker, std::ref(coordinator), std::string(commands[i]) + " " + args, i));
+	}
+	for(uint i=0;i<threads.size();i++) threads[i].join();
+	if(coordinator.remaining > 0) {
+		std::cout << coordinator.remaining << " tiles couldn't be traced!" << std::endl;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,20 @@
+/** distribute.hpp **/
+
+#ifndef DISTRIBUTE_HPP
+#define DISTRIBUTE_HPP
+
+#include "global.hpp"
+#include "scene.hpp"
+#include "render.hpp"
+#include "arena.hpp"
+#include <vector>
+
+#define TILE_SIZE 128 //Width and height of the tiles the frame is split into
+#define TILE_RETRIES 3 //Times a tile is tried again after a worker fails it
+#define WORKER_FAILURES 2 //A worker that fails this many tiles in a row is not given any more tiles
+#define TILE_MAGIC 0x4c495452 //"RTIL"
+
+bool send_tile(const scene_c &scene, const render_params_c &params, cuint x1, cuint x2, cuint y1, cuint y2, arena_c &arena);
+bool render_distributed(const render_params_c &params, cchar *args, const std::vector<cchar*> &commands, float *image, float *depth_buffer);
+
+#endif
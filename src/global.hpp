@@ -3,6 +3,8 @@
 #ifndef GLOBAL_HPP
 #define GLOBAL_HPP
 
+#define OUTPUT //Defines wether program output is allowed
+
 typedef const unsigned int cuint;
 typedef unsigned int uint;
 typedef const int cint;
@@ -0,0 +1,69 @@
+/** half.hpp **/
+
+#ifndef HALF_HPP
+#define HALF_HPP
+
+#include "global.hpp"
+#include <cstring>
+
+#ifdef __F16C__
+	#include <immintrin.h>
+#endif
+
+#define HALF_MAX 65504.0f //Biggest finite half float
+
+//A 16 bit half float that is read and written as a float
+//The conversions round to the nearest half and use the F16C instructions when the compiler is allowed to (-mf16c)
+class half_c {
+	public:
+		ushort bits;
+		operator float() const {
+			#ifdef __F16C__
+				return _cvtsh_ss(bits);
+			#else
+				//The exponent is moved into place and rebiased; subnormals are fixed with a float subtraction
+				uint value = (bits & 0x7fff) << 13;
+				cuint exponent = value & 0x0f800000;
+				value+= (127 - 15) << 23;
+				float result;
+				if(exponent == 0x0f800000) value+= (128 - 16) << 23; //Infinity or NaN
+				else if(exponent == 0) {
+					value+= 1 << 23;
+					memcpy(&result, &value, 4);
+					result-= 6.10351562e-05f; //2^-14
+					memcpy(&value, &result, 4);
+				}
+				value|= (bits & 0x8000) << 16;
+				memcpy(&result, &value, 4);
+				return result;
+			#endif
+		}
+		half_c &operator=(cfloat value) {
+			#ifdef __F16C__
+				bits = _cvtss_sh(value, 0);
+			#else
+				uint input;
+				memcpy(&input, &value, 4);
+				cuint sign = input & 0x80000000;
+				input^= sign;
+				if(input >= 0x47800000) bits = input > 0x7f800000 ? 0x7e00 : 0x7c00; //Too big for a half, infinity or NaN
+				else if(input < 0x38800000) {
+					//Subnormal halves are rounded by adding a float that pushes the bits into place
+					float result;
+					memcpy(&result, &input, 4);
+					result+= 0.5f;
+					memcpy(&input, &result, 4);
+					bits = input - 0x3f000000;
+				}
+				else {
+					cuint odd = (input >> 13) & 1;
+					input+= ((15 - 127) << 23) + 0xfff + odd; //Rebias and round to the nearest even
+					bits = input >> 13;
+				}
+				bits|= sign >> 16;
+			#endif
+			return *this;
+		}
+};
+
+#endif
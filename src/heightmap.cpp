@@ -0,0 +1,423 @@
+/** heightmap.cpp **/
+
+#include "heightmap.hpp"
+#include "bmp.hpp"
+#include "parallel.hpp"
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+#define FORMAT_BMP 0
+#define FORMAT_PGM 1 //Binary pgm with 8 or 16 bit samples
+#define FORMAT_PFM 2 //Grayscale pfm; samples are expected to be in the range 0-1
+
+//Reads the next number from a pgm or pfm header skipping whitespace and comments
+static bool read_header_value(FILE *file, char *value, cuint size) {
+	int c = getc(file);
+	while(c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '#') {
+		if(c == '#') {
+			while(c != '\n' && c != EOF) c = getc(file);
+		}
+		c = getc(file);
+	}
+	uint length = 0;
+	while(c != EOF && c != ' ' && c != '\t' && c != '\n' && c != '\r' && length < size - 1) {
+		value[length++] = c;
+		c = getc(file);
+	}
+	value[length] = 0;
+	return length > 0;
+}
+
+//Opens the file and reads the header
+//scale is the maximum value of a pgm or the scale of a pfm
+static FILE *open_heightmap(cchar *path, uchar &format, uint &width, uint &height, float &scale) {
+	width = 0;
+	height = 0;
+	scale = 255;
+	FILE *file = fopen(path, "rb");
+	if(file == NULL) {
+		std::cout << "Couldn't open file " << path << "!" << std::endl;
+		return NULL;
+	}
+	cint magic1 = getc(file);
+	cint magic2 = getc(file);
+	if(magic1 == 'B' && magic2 == 'M') {
+		format = FORMAT_BMP;
+		for(uchar i=0;i<16;i++) getc(file);
+		for(uchar i=0;i<4;i++) width+= getc(file) << (i * 8);
+		for(uchar i=0;i<4;i++) height+= getc(file) << (i * 8);
+		return file;
+	}
+	if(magic1 == 'P' && (magic2 == '5' || magic2 == 'f')) {
+		format = magic2 == '5' ? FORMAT_PGM : FORMAT_PFM;
+		char value[32];
+		bool valid = read_header_value(file, value, sizeof(value));
+		width = atoi(value);
+		valid&= read_header_value(file, value, sizeof(value));
+		height = atoi(value);
+		valid&= read_header_value(file, value, sizeof(value));
+		scale = atof(value);
+		//The header ends with the single whitespace character read after the last value
+		if(valid && width > 0 && height > 0 && scale != 0 && (format == FORMAT_PFM || (scale > 0 && scale < 65536))) return file;
+	}
+	std::cout << path << " is not a supported heightmap; use 24 or 32 bit bmp, binary pgm or grayscale pfm!" << std::endl;
+	fclose(file);
+	return NULL;
+}
+
+bool heightmap_size(cchar *path, uint &width, uint &height) {
+	uchar format;
+	float scale;
+	FILE *file = open_heightmap(path, format, width, height, scale);
+	if(file == NULL) return false;
+	fclose(file);
+	return true;
+}
+
+//Loads the heightmap into memory from the arena
+//The rows are stored from the bottom of the image to the top
+bool load_heightmap(cchar *path, heightmap_c &heightmap, arena_c &arena) {
+	uchar format;
+	float scale;
+	uint width, height;
+	FILE *file = open_heightmap(path, format, width, height, scale);
+	if(file == NULL) return false;
+	heightmap.width = width;
+	heightmap.height = height;
+	heightmap.data = arena.alloc<float>(width * height);
+	heightmap.integer = false;
+	bool loaded = true;
+	if(format == FORMAT_BMP) {
+		fclose(file);
+		uchar *pixels = load_bmp(path, width, height);
+		if(pixels == NULL) return false;
+		//Only one channel of the image is used
+		for(uint i=0;i<height;i++) {
+			for(uint j=0;j<width;j++) heightmap.data[i * width + j] = pixels[((height - i - 1) * width + j) * 3 + 2];
+		}
+		delete [] pixels;
+		heightmap.integer = true;
+		return true;
+	}
+	const size_t arena_mark = arena.mark();
+	if(format == FORMAT_PGM) {
+		cuint bytes = scale < 256 ? 1 : 2;
+		uchar *row = arena.alloc<uchar>(width * bytes);
+		for(uint i=0;i<height && loaded;i++) {
+			loaded = fread(row, bytes, width, file) == width;
+			//pgm rows go from the top to the bottom
+			float *target = heightmap.data + (height - i - 1) * width;
+			if(bytes == 1) {
+				for(uint j=0;j<width;j++) target[j] = row[j] * 255.0f / scale;
+			}
+			else {
+				for(uint j=0;j<width;j++) target[j] = (row[j * 2] * 256 + row[j * 2 + 1]) * 255.0f / scale;
+			}
+		}
+		heightmap.integer = scale == 255;
+	}
+	else {
+		//pfm rows already go from the bottom to the top; a negative scale means little endian samples
+		uchar *row = arena.alloc<uchar>(width * 4);
+		for(uint i=0;i<height && loaded;i++) {
+			loaded = fread(row, 4, width, file) == width;
+			float *target = heightmap.data + i * width;
+			for(uint j=0;j<width;j++) {
+				uchar sample[4];
+				for(uchar k=0;k<4;k++) sample[k] = scale < 0 ? row[j * 4 + k] : row[j * 4 + 3 - k];
+				float value;
+				memcpy(&value, sample, 4);
+				target[j] = value * 255.0f;
+			}
+		}
+	}
+	arena.rewind(arena_mark);
+	fclose(file);
+	if(!loaded) std::cout << "Couldn't read " << path << "!" << std::endl;
+	return loaded;
+}
+
+//The weights are calculated exactly the same way as they were when they were calculated for every tap
+static void blur_weights(float *weights, float &div) {
+	div = 0;
+	for(int k=-BLUR_RADIUS;k<=BLUR_RADIUS;k++) {
+		cfloat mult1 = abs(k) + 4;
+		cfloat mult = 1.0 / mult1 / mult1;
+		weights[k + BLUR_RADIUS] = mult;
+		div+= mult;
+	}
+}
+
+static inline float round_sample(cfloat value, const bool integer) {
+	return integer ? (float)(int)value : value;
+}
+
+#ifdef __SSE2__
+static inline __m128 round_samples(const __m128 value, const bool integer) {
+	return integer ? _mm_cvtepi32_ps(_mm_cvttps_epi32(value)) : value;
+}
+#endif
+
+//Blurs the rows from first to last horizontally
+//Only the columns near the edges need clamping; the rest go through the SIMD loop without it
+static void blur_horizontal(cfloat *source, float *target, cuint width, cuint first, cuint last, cfloat *weights, cfloat div, const bool integer) {
+	cuint interior_start = BLUR_RADIUS < width ? BLUR_RADIUS : width;
+	cuint interior_end = width > BLUR_RADIUS * 2 ? width - BLUR_RADIUS : interior_start;
+	for(uint j=first;j<last;j++) {
+		cfloat *row = source + j * width;
+		float *out = target + j * width;
+		for(uint i=0;i<width;i++) {
+			if(i == interior_start) i = interior_end;
+			if(i >= width) break;
+			float sum = 0;
+			for(int k=-BLUR_RADIUS;k<=BLUR_RADIUS;k++) {
+				cint x = (int)i + k < 0 ? 0 : ((int)i + k >= (int)width ? width - 1 : i + k);
+				sum+= row[x] * weights[k + BLUR_RADIUS];
+			}
+			out[i] = round_sample(sum / div, integer);
+		}
+		uint i = interior_start;
+		#ifdef __SSE2__
+			const __m128 div4 = _mm_set1_ps(div);
+			for(;i+4<=interior_end;i+=4) {
+				__m128 sum = _mm_setzero_ps();
+				for(uint k=0;k<=BLUR_RADIUS*2;k++) sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(row + i + k - BLUR_RADIUS), _mm_set1_ps(weights[k])));
+				_mm_storeu_ps(out + i, round_samples(_mm_div_ps(sum, div4), integer));
+			}
+		#endif
+		for(;i<interior_end;i++) {
+			float sum = 0;
+			for(uint k=0;k<=BLUR_RADIUS*2;k++) sum+= row[i + k - BLUR_RADIUS] * weights[k];
+			out[i] = round_sample(sum / div, integer);
+		}
+	}
+}
+
+//Blurs one row vertically from the BLUR_RADIUS * 2 + 1 rows around it
+//The clamping is done by choosing the source rows so every column goes through the SIMD loop
+static void blur_rows(cfloat * const *rows, float *out, cuint width, cfloat *weights, cfloat div, const bool integer) {
+	uint i = 0;
+	#ifdef __SSE2__
+		const __m128 div4 = _mm_set1_ps(div);
+		for(;i+4<=width;i+=4) {
+			__m128 sum = _mm_setzero_ps();
+			for(uint k=0;k<=BLUR_RADIUS*2;k++) sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows[k] + i), _mm_set1_ps(weights[k])));
+			_mm_storeu_ps(out + i, round_samples(_mm_div_ps(sum, div4), integer));
+		}
+	#endif
+	for(;i<width;i++) {
+		float sum = 0;
+		for(uint k=0;k<=BLUR_RADIUS*2;k++) sum+= rows[k][i] * weights[k];
+		out[i] = round_sample(sum / div, integer);
+	}
+}
+
+//Blurs the rows from first to last vertically
+static void blur_vertical(cfloat *source, float *target, cuint width, cuint height, cuint first, cuint last, cfloat *weights, cfloat div, const bool integer) {
+	cfloat *rows[BLUR_RADIUS * 2 + 1];
+	for(uint j=first;j<last;j++) {
+		for(int k=-BLUR_RADIUS;k<=BLUR_RADIUS;k++) {
+			cint y = (int)j + k < 0 ? 0 : ((int)j + k >= (int)height ? height - 1 : j + k);
+			rows[k + BLUR_RADIUS] = source + y * width;
+		}
+		blur_rows(rows, target + j * width, width, weights, div, integer);
+	}
+}
+
+//Blurs the heightmap in place with two separable passes that are split by rows between threads
+void blur_heightmap(heightmap_c &heightmap, arena_c &arena) {
+	const size_t arena_mark = arena.mark();
+	float *temp = arena.alloc<float>(heightmap.width * heightmap.height);
+	float weights[BLUR_RADIUS * 2 + 1];
+	float div;
+	blur_weights(weights, div);
+	cfloat *data = heightmap.data;
+	cuint width = heightmap.width;
+	cuint height = heightmap.height;
+	const bool integer = heightmap.integer;
+	parallel_rows(height, [&](cuint first, cuint last) {
+		blur_horizontal(data, temp, width, first, last, weights, div, integer);
+	});
+	parallel_rows(height, [&](cuint first, cuint last) {
+		blur_vertical(temp, heightmap.data, width, height, first, last, weights, div, integer);
+	});
+	arena.rewind(arena_mark);
+}
+
+//Averages every factor samples of a row into one
+static void scale_row(cfloat *row, float *out, cuint width, cuint factor, const bool integer) {
+	for(uint i=0;i<width;i++) {
+		float sum = 0;
+		for(uint k=0;k<factor;k++) sum+= row[i * factor + k];
+		out[i] = round_sample(sum / (float)factor, integer);
+	}
+}
+
+//Averages factor rows that are width samples apart into one
+static void average_rows(cfloat *rows, float *out, cuint width, cuint factor, const bool integer) {
+	uint i = 0;
+	#ifdef __SSE2__
+		const __m128 factor4 = _mm_set1_ps((float)factor);
+		for(;i+4<=width;i+=4) {
+			__m128 sum = _mm_setzero_ps();
+			for(uint k=0;k<factor;k++) sum = _mm_add_ps(sum, _mm_loadu_ps(rows + k * width + i));
+			_mm_storeu_ps(out + i, round_samples(_mm_div_ps(sum, factor4), integer));
+		}
+	#endif
+	for(;i<width;i++) {
+		float sum = 0;
+		for(uint k=0;k<factor;k++) sum+= rows[k * width + i];
+		out[i] = round_sample(sum / (float)factor, integer);
+	}
+}
+
+//Scales the heightmap down by averaging blocks of factor x factor samples
+//This could have been done in a single pass instead of separate passes for x and y axes without speed loss
+//scaled is allocated from the arena; with factor 1 it is the same memory as source
+void scale_down_heightmap(const heightmap_c &source, heightmap_c &scaled, cuint factor, arena_c &arena) {
+	scaled.width = source.width / factor;
+	scaled.height = source.height / factor;
+	scaled.integer = source.integer;
+	if(factor == 1) {
+		scaled.data = source.data;
+		return;
+	}
+	scaled.data = arena.alloc<float>(scaled.width * scaled.height);
+	const size_t arena_mark = arena.mark();
+	float *temp = arena.alloc<float>(scaled.width * source.height);
+	cuint width = scaled.width;
+	const bool integer = source.integer;
+	parallel_rows(source.height, [&](cuint first, cuint last) {
+		for(uint j=first;j<last;j++) scale_row(source.data + j * source.width, temp + j * width, width, factor, integer);
+	});
+	parallel_rows(scaled.height, [&](cuint first, cuint last) {
+		for(uint j=first;j<last;j++) average_rows(temp + (size_t)j * factor * width, scaled.data + j * width, width, factor, integer);
+	});
+	arena.rewind(arena_mark);
+}
+
+//Moves to a row of the file; the rows of a big heightmap go past what a long can hold
+static bool seek_heightmap(FILE *file, const uint64_t offset) {
+	#ifdef _WIN32
+		return _fseeki64(file, offset, SEEK_SET) == 0;
+	#else
+		return fseeko(file, offset, SEEK_SET) == 0;
+	#endif
+}
+
+heightmap_reader_c::heightmap_reader_c(): file(NULL), factor(1), ring_rows(0), width(0), height(0), integer(false) {}
+
+heightmap_reader_c::~heightmap_reader_c() {
+	if(file != NULL) fclose(file);
+}
+
+//Reads the header and takes the memory for the rows from the arena
+bool heightmap_reader_c::open(cchar *path, cuint scale_factor, arena_c &arena) {
+	if(file != NULL) fclose(file);
+	file = open_heightmap(path, format, source_width, source_height, scale);
+	if(file == NULL) return false;
+	factor = scale_factor;
+	width = source_width / factor;
+	height = source_height / factor;
+	if(format == FORMAT_BMP) {
+		//The same bmp:s are supported as load_bmp supports
+		uchar bpp = 0;
+		if(seek_heightmap(file, 28)) bpp = getc(file);
+		if(bpp != 24 && bpp != 32) {
+			std::cout << "Bitmap format " << (int)bpp << " bits per pixel not supported!" << std::endl;
+			fclose(file);
+			file = NULL;
+			return false;
+		}
+		sample_bytes = bpp / 8;
+		row_bytes = (source_width * sample_bytes + 3) / 4 * 4;
+		data_offset = 54;
+		integer = true;
+	}
+	else {
+		sample_bytes = format == FORMAT_PFM ? 4 : (scale < 256 ? 1 : 2);
+		row_bytes = source_width * sample_bytes;
+		data_offset = ftell(file);
+		integer = format == FORMAT_PGM && scale == 255;
+	}
+	blur_weights(weights, div);
+	raw = arena.alloc<uchar>(row_bytes);
+	source = arena.alloc<float>(source_width);
+	ring_rows = BLUR_RADIUS * 2 + factor;
+	ring = arena.alloc<float>((size_t)ring_rows * source_width);
+	ring_row = arena.alloc<uint>(ring_rows);
+	for(uint i=0;i<ring_rows;i++) ring_row[i] = source_height;
+	blurred = arena.alloc<float>(source_width);
+	scaled = arena.alloc<float>((size_t)factor * width);
+	return true;
+}
+
+//Reads a row of the file the same way load_heightmap does, rows starting from the bottom of the image
+bool heightmap_reader_c::read_source(cuint row) {
+	//bmp and pfm rows go from the bottom to the top and pgm rows from the top to the bottom
+	cuint file_row = format == FORMAT_PGM ? source_height - row - 1 : row;
+	const bool loaded = seek_heightmap(file, data_offset + (uint64_t)file_row * row_bytes) && fread(raw, 1, row_bytes, file) == row_bytes;
+	if(format == FORMAT_BMP) {
+		//Only one channel of the image is used
+		if(!loaded) memset(raw, 255, row_bytes); //load_bmp does the same past the end of the file
+		for(uint j=0;j<source_width;j++) source[j] = raw[j * sample_bytes];
+		return true;
+	}
+	if(!loaded) return false;
+	if(format == FORMAT_PGM) {
+		if(sample_bytes == 1) {
+			for(uint j=0;j<source_width;j++) source[j] = raw[j] * 255.0f / scale;
+		}
+		else {
+			for(uint j=0;j<source_width;j++) source[j] = (raw[j * 2] * 256 + raw[j * 2 + 1]) * 255.0f / scale;
+		}
+		return true;
+	}
+	//A negative scale means little endian samples
+	for(uint j=0;j<source_width;j++) {
+		uchar sample[4];
+		for(uchar k=0;k<4;k++) sample[k] = scale < 0 ? raw[j * 4 + k] : raw[j * 4 + 3 - k];
+		float value;
+		memcpy(&value, sample, 4);
+		source[j] = value * 255.0f;
+	}
+	return true;
+}
+
+//The row blurred horizontally, read into the ring if it isn't there already
+cfloat *heightmap_reader_c::blurred_row(cuint row, bool &good) {
+	float *target = ring + (size_t)(row % ring_rows) * source_width;
+	if(ring_row[row % ring_rows] != row) {
+		good&= read_source(row);
+		blur_horizontal(source, target, source_width, 0, 1, weights, div, integer);
+		ring_row[row % ring_rows] = row;
+	}
+	return target;
+}
+
+//Blurs the source rows of the row and scales them down exactly like blur_heightmap and scale_down_heightmap do
+bool heightmap_reader_c::read_row(cuint row, float *samples) {
+	if(file == NULL || row >= height) return false;
+	bool good = true;
+	for(uint k=0;k<factor;k++) {
+		cuint y = row * factor + k;
+		cfloat *rows[BLUR_RADIUS * 2 + 1];
+		for(int l=-BLUR_RADIUS;l<=BLUR_RADIUS;l++) {
+			cuint source_row = (int)y + l < 0 ? 0 : ((int)y + l >= (int)source_height ? source_height - 1 : y + l);
+			rows[l + BLUR_RADIUS] = blurred_row(source_row, good);
+		}
+		if(factor == 1) blur_rows(rows, samples, source_width, weights, div, integer);
+		else {
+			blur_rows(rows, blurred, source_width, weights, div, integer);
+			scale_row(blurred, scaled + k * width, width, factor, integer);
+		}
+	}
+	if(factor > 1) average_rows(scaled, samples, width, factor, integer);
+	return good;
+}
@@ -0,0 +1,62 @@
+/** heightmap.hpp **/
+
+#ifndef HEIGHTMAP_HPP
+#define HEIGHTMAP_HPP
+
+#include "global.hpp"
+#include "arena.hpp"
+#include <cstdio>
+#include <stdint.h>
+
+#define BLUR_RADIUS 10 //The blur uses BLUR_RADIUS * 2 + 1 taps
+
+//This class holds the source image of the scene as floats in the range 0-255 starting from the bottom left corner
+//The samples can come from an 8 bit bmp or pgm, a 16 bit pgm or a float pfm
+//8 bit samples are rounded down after every step like they always have been so that the scene stays exactly the same
+class heightmap_c {
+	public:
+		float *data;
+		uint width, height;
+		bool integer; //Round down after every step
+};
+
+//Reads the heightmap a row at a time for terrains that are too big to have in memory
+//The rows are blurred and scaled down exactly like blur_heightmap and scale_down_heightmap do
+//	Only the source rows the blur needs around the row asked for are kept, blurred horizontally, in a ring of rows
+//	The rows can be read in any order but going up or down the rows reads every source row only once
+class heightmap_reader_c {
+	private:
+		FILE *file;
+		uchar format;
+		float scale;
+		uint source_width, source_height;
+		uint factor;
+		uint sample_bytes, row_bytes;
+		uint64_t data_offset; //Of the first row in the file
+		float weights[BLUR_RADIUS * 2 + 1];
+		float div;
+		uchar *raw; //A row of the file
+		float *source; //The same row as samples
+		float *ring; //The source rows blurred horizontally
+		uint *ring_row; //The source row in every row of the ring or source_height if none
+		uint ring_rows;
+		float *blurred; //A source row blurred both ways
+		float *scaled; //The source rows of a row scaled down horizontally
+		bool read_source(cuint row);
+		cfloat *blurred_row(cuint row, bool &good);
+
+	public:
+		uint width, height; //After scaling down
+		bool integer; //Round down after every step
+		heightmap_reader_c();
+		~heightmap_reader_c();
+		bool open(cchar *path, cuint scale_factor, arena_c &arena);
+		bool read_row(cuint row, float *samples); //Rows start from the bottom of the image like in heightmap_c
+};
+
+bool heightmap_size(cchar *path, uint &width, uint &height);
+bool load_heightmap(cchar *path, heightmap_c &heightmap, arena_c &arena);
+void blur_heightmap(heightmap_c &heightmap, arena_c &arena);
+void scale_down_heightmap(const heightmap_c &source, heightmap_c &scaled, cuint factor, arena_c &arena);
+
+#endif
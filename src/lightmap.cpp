@@ -0,0 +1,244 @@
+/** lightmap.cpp **/
+
+#include "lightmap.hpp"
+#include "scene_cache.hpp"
+#include "parallel.hpp"
+#include "math.hpp"
+#include <iostream>
+#include <cstring>
+#include <cmath>
+
+#define LIGHTMAP_SKY 1000 //Height of the rays that are shot down at the scene
+
+lightmap_c::lightmap_c(): data(NULL), size(0), mapped(false), header(NULL), texels(NULL) {}
+
+lightmap_c::~lightmap_c() {
+	release();
+}
+
+void lightmap_c::release() {
+	if(mapped) unmap_scene_cache(data, size);
+	else delete [] data;
+	data = NULL;
+	size = 0;
+	mapped = false;
+	header = NULL;
+	texels = NULL;
+}
+
+bool lightmap_c::matches(const uint64_t scene_hash, cfloat sunx, cfloat suny, cfloat sunz) const {
+	return header != NULL && header->scene_hash == scene_hash && header->sun_x == sunx && header->sun_y == suny && header->sun_z == sunz;
+}
+
+//Takes the block if it is a lightmap of the scene for the sun
+bool lightmap_c::attach(uchar *block, const size_t block_size, const bool block_mapped, const uint64_t scene_hash, cfloat sunx, cfloat suny, cfloat sunz) {
+	if(block_size < sizeof(lightmap_header_c)) return false;
+	const lightmap_header_c &block_header = *(const lightmap_header_c*)block;
+	if(block_header.magic != LIGHTMAP_MAGIC || block_header.version != LIGHTMAP_VERSION || block_header.scene_hash != scene_hash) return false;
+	if(block_header.sun_x != sunx || block_header.sun_y != suny || block_header.sun_z != sunz || block_header.scale != LIGHTMAP_SCALE) return false;
+	if(sizeof(lightmap_header_c) + (size_t)block_header.width * block_header.height * sizeof(lightmap_texel_c) != block_size) return false;
+	release();
+	data = block;
+	size = block_size;
+	mapped = block_mapped;
+	header = (const lightmap_header_c*)block;
+	texels = (const lightmap_texel_c*)(block + sizeof(lightmap_header_c));
+	return true;
+}
+
+//The diffuse brightness shade_hit gives at x, z of the polygon with the frame without the light and the parallax offset
+//tssun is the sun vector in the tangent space of the polygon
+static float normal_diffuse(const scene_c &scene, cfloat x, cfloat y, cfloat z, cfloat tssunx, cfloat tssuny, cfloat tssunz) {
+	short tex_idx = (short)mix(0, 191, 0, 255, x);
+	short tex_idy = (short)mix(0, 127, 0, 255, z);
+	while(tex_idx > 255) tex_idx-= 256;
+	while(tex_idx < 0) tex_idx+= 256;
+	while(tex_idy > 255) tex_idy-= 256;
+	while(tex_idy < 0) tex_idy+= 256;
+	cuint tex_id = tex_idy * 256 + tex_idx;
+	cuchar *normalmap = y < mix(0, 255, 4, 19, scene.texture3[tex_id]) ? scene.texture6 : scene.texture7;
+	float nmx = (float(normalmap[tex_id * 3]) / 255.0 - 0.5) * 2.0;
+	float nmy = (float(normalmap[tex_id * 3 + 1]) / 255.0 - 0.5) * 2.0;
+	float nmz = (float(normalmap[tex_id * 3 + 2]) / 255.0 - 0.5) * 2.0 * 0.3;
+	cfloat nml = sqrt(nmx * nmx + nmy * nmy + nmz * nmz);
+	nmx/= nml;
+	nmy/= nml;
+	nmz/= nml;
+	return max(nmx * tssunx + nmy * tssuny + nmz * tssunz, 0.0) * 1.5;
+}
+
+//Shoots a ray down at the middle of every texel and a shadow ray from where it hits
+//The diffuse light of the normalmap is averaged over LIGHTMAP_SAMPLES * LIGHTMAP_SAMPLES points of the texel
+//The texels are then blurred a bit so that the shadows have soft edges instead of steps
+static uchar *bake_lightmap(const scene_c &scene, const uint64_t scene_hash, cfloat sunx, cfloat suny, cfloat sunz, size_t &block_size) {
+	float min_x = 1000000, max_x = -1000000, min_z = 1000000, max_z = -1000000;
+	for(uint i=0;i<scene.polygon_count;i++) {
+		if(scene.polygons[i].minx < min_x) min_x = scene.polygons[i].minx;
+		if(scene.polygons[i].maxx > max_x) max_x = scene.polygons[i].maxx;
+		if(scene.polygons[i].minz < min_z) min_z = scene.polygons[i].minz;
+		if(scene.polygons[i].maxz > max_z) max_z = scene.polygons[i].maxz;
+	}
+	if(scene.polygon_count == 0) {
+		//The paged terrain has no polygons in memory; the bounds are the same as the polygons of the border would have
+		cfloat cell = SCENE_WIDTH / (float)scene.grid_width;
+		cfloat edge_x = (scene.grid_width - 1) * cell + BORDER_LENGTH;
+		cfloat edge_z = (scene.grid_height - 1) * cell + BORDER_LENGTH;
+		min_x = -BORDER_LENGTH - 0.001;
+		min_z = -BORDER_LENGTH - 0.001;
+		max_x = edge_x + 0.001;
+		max_z = edge_z + 0.001;
+	}
+	cuint width = (uint)ceil((max_x - min_x) * LIGHTMAP_SCALE);
+	cuint height = (uint)ceil((max_z - min_z) * LIGHTMAP_SCALE);
+	block_size = sizeof(lightmap_header_c) + (size_t)width * height * sizeof(lightmap_texel_c);
+	uchar *block = new uchar[block_size];
+	lightmap_header_c &header = *(lightmap_header_c*)block;
+	memset(&header, 0, sizeof(header));
+	header.magic = LIGHTMAP_MAGIC;
+	header.version = LIGHTMAP_VERSION;
+	header.scene_hash = scene_hash;
+	header.sun_x = sunx;
+	header.sun_y = suny;
+	header.sun_z = sunz;
+	header.width = width;
+	header.height = height;
+	header.min_x = min_x;
+	header.min_z = min_z;
+	header.scale = LIGHTMAP_SCALE;
+	lightmap_texel_c *texels = (lightmap_texel_c*)(block + sizeof(lightmap_header_c));
+	lightmap_texel_c *baked = new lightmap_texel_c[width * height];
+	parallel_rows(height, [&](cuint first, cuint last) {
+		for(uint j=first;j<last;j++) {
+			for(uint i=0;i<width;i++) {
+				cfloat x = min_x + (i + 0.5) / LIGHTMAP_SCALE;
+				cfloat z = min_z + (j + 0.5) / LIGHTMAP_SCALE;
+				float hitx, hity, hitz;
+				uint polygon;
+				tangent_frame_c frame;
+				lightmap_texel_c &texel = baked[j * width + i];
+				//The ray is tilted a tiny bit as the ray functions divide by every component of its direction
+				if(trace_primary(scene, x + 0.001, LIGHTMAP_SKY, z + 0.0007, x, 0, z, hitx, hity, hitz, polygon, &frame)) {
+					texel.height = hity;
+					texel.light = trace_shadow(scene, hitx, hity, hitz, polygon, sunx, suny, sunz) ? 0 : 1;
+						//sun vector in tangent space
+					cfloat tssunx = frame.tx * sunx + frame.bx * suny + frame.nx * sunz;
+					cfloat tssuny = frame.ty * sunx + frame.by * suny + frame.ny * sunz;
+					cfloat tssunz = frame.tz * sunx + frame.bz * suny + frame.nz * sunz;
+					texel.diffuse = 0;
+					for(uint l=0;l<LIGHTMAP_SAMPLES;l++) {
+						for(uint k=0;k<LIGHTMAP_SAMPLES;k++) {
+							cfloat sx = min_x + (i + (k + 0.5) / LIGHTMAP_SAMPLES) / LIGHTMAP_SCALE;
+							cfloat sz = min_z + (j + (l + 0.5) / LIGHTMAP_SAMPLES) / LIGHTMAP_SCALE;
+							texel.diffuse+= normal_diffuse(scene, sx, hity, sz, tssunx, tssuny, tssunz);
+						}
+					}
+					texel.diffuse/= LIGHTMAP_SAMPLES * LIGHTMAP_SAMPLES;
+				}
+				else {
+					texel.height = -LIGHTMAP_SKY; //Never matches any hit
+					texel.light = 1;
+					texel.diffuse = 0;
+				}
+			}
+		}
+	});
+	//Box filter over the texels of about the same height
+	//The diffuse light is filtered with the light in it so that it fades out with the shadows
+	parallel_rows(height, [&](cuint first, cuint last) {
+		for(uint j=first;j<last;j++) {
+			for(uint i=0;i<width;i++) {
+				const lightmap_texel_c &center = baked[j * width + i];
+				float light = 0, diffuse = 0, div = 0;
+				for(int l=-LIGHTMAP_FILTER;l<=LIGHTMAP_FILTER;l++) {
+					for(int k=-LIGHTMAP_FILTER;k<=LIGHTMAP_FILTER;k++) {
+						cint x = (int)i + k;
+						cint y = (int)j + l;
+						if(x < 0 || y < 0 || x >= (int)width || y >= (int)height) continue;
+						const lightmap_texel_c &texel = baked[y * width + x];
+						if(fabs(texel.height - center.height) > LIGHTMAP_TOLERANCE) continue;
+						light+= texel.light;
+						diffuse+= texel.light * texel.diffuse;
+						div++;
+					}
+				}
+				texels[j * width + i].height = center.height;
+				texels[j * width + i].light = light / div;
+				texels[j * width + i].diffuse = diffuse / div;
+			}
+		}
+	});
+	delete [] baked;
+	return block;
+}
+
+//Maps the lightmap from the cache if it was baked for this scene and sun and bakes it otherwise
+//The sun vector must be normalized
+bool lightmap_c::load(const scene_c &scene, cfloat sunx, cfloat suny, cfloat sunz) {
+	const uint64_t scene_hash = scene.get_hash();
+	if(matches(scene_hash, sunx, suny, sunz)) return true;
+	size_t block_size;
+	uchar *block = map_scene_cache(LIGHTMAP_CACHE, block_size);
+	if(block != NULL) {
+		if(attach(block, block_size, true, scene_hash, sunx, suny, sunz)) {
+			#ifdef OUTPUT
+				std::cout << "Mapped the lightmap from " << LIGHTMAP_CACHE << std::endl;
+			#endif
+			return true;
+		}
+		unmap_scene_cache(block, block_size);
+	}
+	#ifdef OUTPUT
+		std::cout << "Baking the lightmap" << std::endl;
+	#endif
+	block = bake_lightmap(scene, scene_hash, sunx, suny, sunz, block_size);
+	if(!attach(block, block_size, false, scene_hash, sunx, suny, sunz)) {
+		delete [] block;
+		return false;
+	}
+	if(write_scene_cache(LIGHTMAP_CACHE, block, block_size)) {
+		#ifdef OUTPUT
+			std::cout << "     Saved the lightmap into " << LIGHTMAP_CACHE << std::endl;
+		#endif
+	}
+	return true;
+}
+
+//Filters the light and the diffuse light of the texels around x, z that are about as high as y
+//Returns false if there are none and the light has to be traced
+bool lightmap_c::lookup(cfloat x, cfloat y, cfloat z, float &light, float &diffuse) const {
+	cfloat u = (x - header->min_x) * LIGHTMAP_SCALE - 0.5;
+	cfloat v = (z - header->min_z) * LIGHTMAP_SCALE - 0.5;
+	cint i = (int)floor(u);
+	cint j = (int)floor(v);
+	cfloat fu = u - i;
+	cfloat fv = v - j;
+	float div = 0;
+	light = 0;
+	diffuse = 0;
+	for(uchar k=0;k<4;k++) {
+		cint ti = i + (k & 1);
+		cint tj = j + (k >> 1);
+		if(ti < 0 || tj < 0 || ti >= (int)header->width || tj >= (int)header->height) continue;
+		const lightmap_texel_c &texel = texels[tj * header->width + ti];
+		if(fabs(texel.height - y) > LIGHTMAP_TOLERANCE) continue;
+		cfloat weight = (k & 1 ? fu : 1 - fu) * (k >> 1 ? fv : 1 - fv);
+		light+= texel.light * weight;
+		diffuse+= texel.diffuse * weight;
+		div+= weight;
+	}
+	if(div < 0.01) return false;
+	light/= div;
+	diffuse/= div;
+	return true;
+}
+
+//Points the parameters to the lightmap if they ask for baked light, loading or baking it first for their sun
+bool use_lightmap(const scene_c &scene, render_params_c &params, lightmap_c &lightmap) {
+	params.lightmap = NULL;
+	if(!params.baked) return true;
+	float sunx, suny, sunz;
+	params.sun_direction(sunx, suny, sunz);
+	if(!lightmap.load(scene, sunx, suny, sunz)) return false;
+	params.lightmap = &lightmap;
+	return true;
+}
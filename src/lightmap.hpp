@@ -0,0 +1,64 @@
+/** lightmap.hpp **/
+
+#ifndef LIGHTMAP_HPP
+#define LIGHTMAP_HPP
+
+#include "global.hpp"
+#include "scene.hpp"
+#include "render.hpp"
+#include <cstddef>
+#include <stdint.h>
+
+#define LIGHTMAP_CACHE "lightmap.cache" //The baked light is kept here next to the scene cache
+#define LIGHTMAP_MAGIC 0x4d4c5452 //"RTLM"
+#define LIGHTMAP_VERSION 2
+#define LIGHTMAP_SCALE 2 //Texels per unit of the scene
+#define LIGHTMAP_TOLERANCE 0.5 //A texel is only used for hits this close to its height
+#define LIGHTMAP_FILTER 1 //Radius of the box filter run over the baked texels
+#define LIGHTMAP_SAMPLES 4 //The normalmap is sampled this many times along both axes of a texel for its diffuse light
+
+//The beginning of the lightmap cache file
+//The texels follow the header right away, starting from min_x, min_z
+class lightmap_header_c {
+	public:
+		uint magic;
+		uint version;
+		uint64_t scene_hash;
+		float sun_x, sun_y, sun_z; //Normalized
+		uint width, height;
+		float min_x, min_z;
+		uint scale;
+};
+
+//Every texel has the height of the scene, the share of the texel the sun reaches and the diffuse sun light of the normalmap under it
+class lightmap_texel_c {
+	public:
+		float height;
+		float light;
+		float diffuse; //The diffuse brightness of shade_hit averaged over the texel, with the light already in it
+};
+
+//The sun light over the whole scene seen from straight above, for a single sun direction
+//With a lightmap no shadow rays need to be traced for the parts of the scene it covers
+//The diffuse light is baked too with the normalmap filtered over the texels
+//The ambient light, the phong lighting and the parallax offset of the textures are still calculated for every pixel
+class lightmap_c {
+	private:
+		uchar *data;
+		size_t size;
+		bool mapped;
+		const lightmap_header_c *header;
+		const lightmap_texel_c *texels;
+		bool attach(uchar *block, const size_t block_size, const bool block_mapped, const uint64_t scene_hash, cfloat sunx, cfloat suny, cfloat sunz);
+		void release();
+	public:
+		lightmap_c();
+		~lightmap_c();
+		bool load(const scene_c &scene, cfloat sunx, cfloat suny, cfloat sunz);
+		bool matches(const uint64_t scene_hash, cfloat sunx, cfloat suny, cfloat sunz) const;
+		bool lookup(cfloat x, cfloat y, cfloat z, float &light, float &diffuse) const;
+};
+
+bool use_lightmap(const scene_c &scene, render_params_c &params, lightmap_c &lightmap);
+
+#endif
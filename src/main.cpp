@@ -25,24 +25,25 @@
 
 #include "global.hpp"
 #include "bmp.hpp"
-#include "polygon.hpp"
-#include "cube.hpp"
-#include "cast_ray.hpp"
+#include "server.hpp"
+#include "raytracer.hpp"
+#include "stream.hpp"
+#include "distribute.hpp"
+#include "bench.hpp"
+#include "tune.hpp"
+#include "arena.hpp"
+#include "heightmap.hpp"
 #include "math.hpp"
 #include <iostream>
-#include <vector>
-#include <cmath>
 #include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <csignal>
 
-#define OUTPUT //Defines wether program output is allowed
 #define INPUT //Defines wether user input is allowed
 
-//Note that the bloom and depth of field blurriness are affected if the size of the rendered image is changed
-//FINAL_X and FINAL_Y are not the size of the image that is saved but the size of the rendered image before it is scaled down
-#define FINAL_X 600
-#define FINAL_Y 400
-#define FINAL_SCALE_DOWN 1 //This is the factor used to scale down the image after it has been fully rendered
-
 //This will tell the OS to open the image after it is saved
 #define OPEN_IMAGE
 
@@ -65,637 +66,242 @@ void open_image() {
 //The program will only process the source image and show that before it is used to create the actual work
 //#define SHOW_SOURCE
 
-int main() {
-	#ifdef OUTPUT
-		std::cout << "Loading the source image and bitmaps" << std::endl;
-	#endif
-	uchar *final = new uchar[FINAL_X * FINAL_Y * 3 / FINAL_SCALE_DOWN / FINAL_SCALE_DOWN];
-	float *depth_buffer = new float[FINAL_X * FINAL_Y];
-	uchar *source = load_source_image();
-	uint temp_width, temp_height;
-	uchar *texture1 = load_bmp("img/rock.bmp", temp_width, temp_height); //Rock texture
-	uchar *texture2 = load_bmp("img/snow.bmp", temp_width, temp_height); //Snow texture
-	uchar *texture3 = new uchar[256 * 256]; //Texture mixing mask
-	uchar *texture4 = new uchar[256 * 256]; //Rock parallax map
-	uchar *texture5 = new uchar[256 * 256]; //Snow parallax map
-	uchar *texture6 = load_bmp("img/rock_normal.bmp", temp_width, temp_height); //Rock normalmap
-	uchar *texture7 = load_bmp("img/snow_normal.bmp", temp_width, temp_height); //Snow normalmap
-	uchar *temp = load_bmp("img/mix_mask.bmp", temp_width, temp_height);
-	for(int i=0;i<256*256;i++) texture3[i] = temp[i * 3];
-	delete [] temp;
-	temp = load_bmp("img/rock_parallax.bmp", temp_width, temp_height);
-	for(int i=0;i<256*256;i++) texture4[i] = temp[i * 3];
-	delete [] temp;
-	temp = load_bmp("img/snow_parallax.bmp", temp_width, temp_height);
-	for(int i=0;i<256*256;i++) texture5[i] = temp[i * 3];
-	delete [] temp;
+//Ctrl-C stops a progressive frame and saves what has been traced
+static std::atomic<bool> cancelled(false);
 
-		/** Blur the source image **/
-	#ifdef OUTPUT
-		std::cout << "Blurring the source image" << std::endl;
-	#endif
-	uchar *temp_source = new uchar[192 * 128];
-	for(uchar i=0;i<192;i++) {
-		for(uchar j=0;j<128;j++) {
-			float sum = 0;
-			float div = 0;
-			for(char k=-10;k<=10;k++) {
-				cuchar x = clampi(i + k, 0, 191);
-				cfloat mult1 = abs(k) + 4;
-				cfloat mult = 1.0 / mult1 / mult1;
-				sum+= (float)source[j * 192 + x] * mult;
-				div+= mult;
-			}
-			temp_source[j * 192 + i] = uchar(sum / div);
+static void cancel_frame(int) {
+	cancelled = true;
+}
+
+//Renders a frame for every line of the camera path, or just one frame without a path, into the stream
+//Every line has render parameters like the command line that change the frame given on the command line
+//The size of the frames can't change
+static bool render_stream(raytracer_c &renderer, const render_params_c &params, cuint format, cchar *target, cchar *path, const bool reuse) {
+	FILE *path_file = NULL;
+	if(path != NULL) {
+		path_file = fopen(path, "r");
+		if(path_file == NULL) {
+			std::cout << "Couldn't open " << path << "!" << std::endl;
+			return false;
 		}
 	}
-	for(uchar i=0;i<192;i++) {
-		for(uchar j=0;j<128;j++) {
-			float sum = 0;
-			float div = 0;
-			for(char k=-10;k<=10;k++) {
-				cuchar y = clampi(j + k, 0, 127);
-				cfloat mult1 = abs(k) + 4;
-				cfloat mult = 1.0 / mult1 / mult1;
-				sum+= (float)temp_source[y * 192 + i] * mult;
-				div+= mult;
-			}
-			source[j * 192 + i] = uchar(sum / div);
-		}
+	cuint final_x = params.width / params.scale_down;
+	cuint final_y = params.height / params.scale_down;
+	renderer.reuse_hits(reuse);
+	frame_stream_c stream;
+	if(!stream.open(target, format, final_x, final_y)) {
+		if(path_file != NULL) fclose(path_file);
+		return false;
 	}
-	delete [] temp_source;
-
-	#ifndef SHOW_SOURCE
-	#define ACC 1 //This is the accuracy of the scene; bigger values are less accurate; valid values are 1, 2, 4, 8, 16, 32 and 64
-	#define CUBE_AMOUNT 5 //This can't be 0; comment out if 0 is wanted
-		/** Scale down the source image **/
-	//This could have been done in a single for loop instead of separate loops for x and y axes without speed loss
-	#ifdef OUTPUT
-		std::cout << "Scaling down the source image by " << ACC << std::endl;
-	#endif
-	temp_source = new uchar[192 * 128 / ACC];
-	for(uchar i=0;i<192;i+=ACC) {
-		for(uchar j=0;j<128;j++) {
-			float sum = 0;
-			for(uchar k=0;k<ACC;k++) sum+= source[j * 192 + i + k];
-			temp_source[j * 192 / ACC + i / ACC] = uchar(sum / (float)ACC);
+	bool good = true;
+	uint frames = 0;
+	char line[1024];
+	while(good) {
+		render_params_c frame_params = params;
+		frame_params.progress = false;
+		if(path_file != NULL) {
+			if(fgets(line, sizeof(line), path_file) == NULL) break;
+			for(char *arg=strtok(line, " \t\r\n");arg!=NULL;arg=strtok(NULL, " \t\r\n")) {
+				if(!parse_render_param(arg, frame_params)) {
+					std::cout << "Bad parameter " << arg << " in " << path << "!" << std::endl;
+					good = false;
+				}
+			}
+			if(frame_params.width != params.width || frame_params.height != params.height || frame_params.scale_down != params.scale_down) {
+				std::cout << "The size of the frames can't change!" << std::endl;
+				good = false;
+			}
+			if(!good) break;
 		}
+		good = renderer.render(frame_params, stream.frame(), final_x * 3) && stream.submit();
+		frames++;
+		#ifdef OUTPUT
+			std::cout << "Frame " << frames << " done";
+			if(reuse) std::cout << ", " << int(renderer.get_reuse_rate() * 100.0 + 0.5) << "% of the primary hits reused";
+			std::cout << std::endl;
+		#endif
+		if(path_file == NULL) break;
 	}
-	delete [] source;
-	source = new uchar[192 * 128 / ACC / ACC];
-	for(uchar i=0;i<192/ACC;i++) {
-		for(uchar j=0;j<128;j+=ACC) {
-			float sum = 0;
-			for(uchar k=0;k<ACC;k++) sum+= temp_source[(j + k) * 192 / ACC + i];
-			source[j * 192 / ACC / ACC + i] = uchar(sum / (float)ACC);
-		}
+	if(path_file != NULL) fclose(path_file);
+	if(!stream.close()) {
+		std::cout << "Couldn't write the frames!" << std::endl;
+		good = false;
 	}
-	delete [] temp_source;
+	return good;
+}
 
-		/** Create polygons **/
-	#ifdef OUTPUT
-		std::cout << "Creating polygons" << std::endl;
-	#endif
-	std::vector<polygon_c> polygons;
-	for(uchar i=0;i<192/ACC-1;i++) {
-		for(uchar j=0;j<128/ACC-1;j++) {
-			cuchar h1 = (255 - source[(128 / ACC - 1 - j) * 192 / ACC + i]) / 8;
-			cuchar h2 = (255 - source[(128 / ACC - 1 - j) * 192 / ACC + i + 1]) / 8;
-			cuchar h3 = (255 - source[(128 / ACC - 1 - j - 1) * 192 / ACC + i]) / 8;
-			cuchar h4 = (255 - source[(128 / ACC - 1 - j - 1) * 192 / ACC + i + 1]) / 8;
-			polygons.push_back(polygon_c(i * ACC, h1, j * ACC, (i + 1) * ACC, h2, j * ACC, i * ACC, h3, (j + 1) * ACC, 0, 0, 1, 0, 0, 1));
-			polygons.push_back(polygon_c((i + 1) * ACC, h2, j * ACC, (i + 1) * ACC, h4, (j + 1) * ACC, i * ACC, h3, (j + 1) * ACC, 1, 0, 1, 1, 0, 1));
+//Usage: raytracer_linux [--server [socket]] [--stream format [file]] [--path file] [--reuse] [--distribute N] [--worker command] [--budget ms] [--samples N] [--terrain [chunks]] [--bench] [--tune] [size=WxH] [scale=N] [camera=x,y,z] [look=x,y,z] [sun=x,y,z] [flags=...] [shadows=baked|live] [frame=float|half] [threads=N] [tile=N]
+//--stream rgb24|yuv420 [file] writes raw frames into the file or the standard output (-) and --path file renders a frame for every line of the file
+//--reuse reuses the primary hits of the last frame of the path where they still hit the same polygon
+//--distribute starts N local worker processes and --worker adds a worker started with the command, for example "ssh host ./raytracer_linux"
+//--budget and --samples render the frame progressively until the time in milliseconds or the amount of traced pixels runs out
+//--terrain traces the rays through the terrain split into chunks on disk with a cache of the given amount of chunks
+//--bench times tracing the frame with the cubes tested one by one and with the quads for every amount of cube levels
+//--tune times trial frames with different cube levels, threads and tiles and saves the fastest settings for the next frames
+int main(int argc, char **argv) {
+	render_params_c params;
+	params.progress = true;
+	cchar *server_path = NULL;
+	std::vector<cchar*> workers;
+	std::string args; //The render parameters given to the workers
+	bool tile = false;
+	uint stream_format = STREAM_RGB24;
+	cchar *stream_target = NULL; //"-" is the standard output
+	cchar *camera_path = NULL;
+	bool reuse = false;
+	bool bench = false;
+	bool tune = false;
+	uint terrain_cache = 0; //Chunks in the cache of the paged terrain or 0 for the terrain in memory
+	progressive_c progressive;
+	bool progressive_frame = false;
+	uint tile_x1 = 0, tile_x2 = 0, tile_y1 = 0, tile_y2 = 0;
+	for(int i=1;i<argc;i++) {
+		if(strcmp(argv[i], "--server") == 0) {
+			server_path = SERVER_SOCKET;
+			if(i + 1 < argc && strchr(argv[i + 1], '=') == NULL) server_path = argv[++i];
 		}
-	}
-	#define BORDER_LENGTH 50
-	#define BORDER_HEIGHT 8
-	//Creating edge polygons
-	for(uchar i=0;i<192/ACC-1;i++) {
-		cuchar h1 = (255 - source[(128 / ACC - 1) * 192 / ACC + i]) / 8;
-		cuchar h2 = (255 - source[(128 / ACC - 1) * 192 / ACC + i + 1]) / 8;
-		cuchar h3 = (255 - source[i]) / 8;
-		cuchar h4 = (255 - source[i + 1]) / 8;
-		polygons.push_back(polygon_c(i * ACC, h1, 0, i * ACC, BORDER_HEIGHT, -BORDER_LENGTH, (i + 1) * ACC, h2, 0, 0, 1, 0, 0, 1, 1));
-		polygons.push_back(polygon_c((i + 1) * ACC, h2, 0, i * ACC, BORDER_HEIGHT, -BORDER_LENGTH, (i + 1) * ACC, BORDER_HEIGHT, -BORDER_LENGTH, 1, 1, 0, 0, 1, 0));
-		polygons.push_back(polygon_c(i * ACC, BORDER_HEIGHT, 128 - ACC + BORDER_LENGTH, i * ACC, h3, 128 - ACC, (i + 1) * ACC, BORDER_HEIGHT, 128 - ACC + BORDER_LENGTH, 0, 1, 0, 0, 1, 1));
-		polygons.push_back(polygon_c((i + 1) * ACC, BORDER_HEIGHT, 128 - ACC + BORDER_LENGTH, i * ACC, h3, 128 - ACC, (i + 1) * ACC, h4, 128 - ACC, 1, 1, 0, 0, 1, 0));
-	}
-	for(uchar j=0;j<128/ACC-1;j++) {
-		cuchar h1 = (255 - source[(128 / ACC - 1 - j) * 192 / ACC]) / 8;
-		cuchar h2 = (255 - source[(128 / ACC - 1 - j) * 192 / ACC + 192 / ACC - 1]) / 8;
-		cuchar h3 = (255 - source[(128 / ACC - 1 - j - 1) * 192 / ACC]) / 8;
-		cuchar h4 = (255 - source[(128 / ACC - 1 - j - 1) * 192 / ACC + 192 / ACC - 1]) / 8;
-		polygons.push_back(polygon_c(0, h1, j * ACC, 0, h3, (j + 1) * ACC, -BORDER_LENGTH, BORDER_HEIGHT, j * ACC, 1, 0, 1, 1, 0, 0));
-		polygons.push_back(polygon_c(-BORDER_LENGTH, BORDER_HEIGHT, j * ACC, 0, h3, (j + 1) * ACC, -BORDER_LENGTH, BORDER_HEIGHT, (j + 1) * ACC, 0, 0, 1, 1, 0, 1));
-		polygons.push_back(polygon_c(192 - ACC + BORDER_LENGTH, BORDER_HEIGHT, j * ACC, 192 - ACC + BORDER_LENGTH, BORDER_HEIGHT, (j + 1) * ACC, 192 - ACC, h2, j * ACC, 1, 0, 1, 1, 0, 0));
-		polygons.push_back(polygon_c(192 - ACC, h2, j * ACC, 192 - ACC + BORDER_LENGTH, BORDER_HEIGHT, (j + 1) * ACC, 192 - ACC, h4, (j + 1) * ACC, 0, 0, 1, 1, 0, 1));
-	}
-	//Creating corner polygons
-	cuchar h1 = (255 - source[(128 / ACC - 1) * 192 / ACC]) / 8;
-	cuchar h2 = (255 - source[(128 / ACC - 1) * 192 / ACC + 192 / ACC - 1]) / 8;
-	cuchar h3 = (255 - source[0]) / 8;
-	cuchar h4 = (255 - source[192 / ACC - 1]) / 8;
-	polygons.push_back(polygon_c(0, h1, 0, -BORDER_LENGTH, BORDER_HEIGHT, 0, 0, BORDER_HEIGHT, -BORDER_LENGTH, 1, 1, 0, 1, 1, 0));
-	polygons.push_back(polygon_c(-BORDER_LENGTH, BORDER_HEIGHT, 0, -BORDER_LENGTH, BORDER_HEIGHT, -BORDER_LENGTH, 0, BORDER_HEIGHT, -BORDER_LENGTH, 0, 1, 0, 0, 1, 0));
-	polygons.push_back(polygon_c(192 - ACC + BORDER_LENGTH, BORDER_HEIGHT, 0, 192 - ACC, h2, 0, 192 - ACC + BORDER_LENGTH, BORDER_HEIGHT, -BORDER_LENGTH, 1, 1, 0, 1, 1, 0));
-	polygons.push_back(polygon_c(192 - ACC, h2, 0, 192 - ACC, BORDER_HEIGHT, -BORDER_LENGTH, 192 - ACC + BORDER_LENGTH, BORDER_HEIGHT, -BORDER_LENGTH, 0, 1, 0, 0, 1, 0));
-	polygons.push_back(polygon_c(0, BORDER_HEIGHT, 128 - ACC + BORDER_LENGTH, -BORDER_LENGTH, BORDER_HEIGHT, 128 - ACC + BORDER_LENGTH, 0, h3, 128 - ACC, 1, 1, 0, 1, 1, 0));
-	polygons.push_back(polygon_c(-BORDER_LENGTH, BORDER_HEIGHT, 128 - ACC + BORDER_LENGTH, -BORDER_LENGTH, BORDER_HEIGHT, 128 - ACC, 0, h3, 128 - ACC, 0, 1, 0, 0, 1, 0));
-	polygons.push_back(polygon_c(192 - ACC + BORDER_LENGTH, BORDER_HEIGHT, 128 - ACC + BORDER_LENGTH, 192 - ACC, BORDER_HEIGHT, 128 - ACC + BORDER_LENGTH, 192 - ACC + BORDER_LENGTH, BORDER_HEIGHT, 128 - ACC, 1, 1, 0, 1, 1, 0));
-	polygons.push_back(polygon_c(192 - ACC, BORDER_HEIGHT, 128 - ACC + BORDER_LENGTH, 192 - ACC, h4, 128 - ACC, 192 - ACC + BORDER_LENGTH, BORDER_HEIGHT, 128 - ACC, 0, 1, 0, 0, 1, 0));
-	#ifdef OUTPUT
-		std::cout << "     Created " << polygons.size() << " polygons" << std::endl;
-	#endif
-		//all polygons created; creating acceleration structure with cubes (actually cuboids)
-	#ifdef CUBE_AMOUNT
-		std::vector<std::vector<cube_c> > cubes;
-		for(uchar i=0;i<CUBE_AMOUNT;i++) cubes.push_back(std::vector<cube_c>());
-		if(polygons.size() >= 4) {
-			for(uint i=0;i<polygons.size()-3;i+=4) cubes.at(0).push_back(cube_c(polygons, i, i + 1, i + 2, i + 3));
+		else if(strcmp(argv[i], "--distribute") == 0 && i + 1 < argc) {
+			for(int j=atoi(argv[++i]);j>0;j--) workers.push_back(argv[0]);
 		}
-		cubes.at(0).push_back(cube_c());
-		#ifdef OUTPUT
-			std::cout << "     Created " << cubes.at(0).size() << " level 1 cubes" << std::endl;
-		#endif
-		for(uchar i=1;i<CUBE_AMOUNT;i++) {
-			if(cubes.at(i - 1).size() >= 5) {
-				//Using size()-4 here instead of size()-3 always to ignore the last cube which is empty
-				for(uint j=0;j<cubes.at(i-1).size()-4;j+=4) cubes.at(i).push_back(cube_c(cubes.at(i - 1), j, j + 1, j + 2, j + 3));
+		else if(strcmp(argv[i], "--stream") == 0 && i + 1 < argc) {
+			if(!parse_stream_format(argv[++i], stream_format)) {
+				std::cout << "Unknown stream format " << argv[i] << "!" << std::endl;
+				return 1;
 			}
-			cubes.at(i).push_back(cube_c());
-			#ifdef OUTPUT
-				std::cout << "     Created " << cubes.at(i).size() << " level " << int(i + 1) << " cubes" << std::endl;
-			#endif
+			stream_target = "-";
+			if(i + 1 < argc && strchr(argv[i + 1], '=') == NULL && (argv[i + 1][0] != '-' || argv[i + 1][1] == 0)) stream_target = argv[++i];
 		}
-	#endif
-
-	//Data for more accurate color calculations and high dynamic range colors
-	float *image = new float[FINAL_X * FINAL_Y * 3];
-
-	//Direction for sun lighting
-	float sunx = 15;
-	float suny = -7;
-	float sunz = -5;
-	cfloat sunl = sqrt(sunx * sunx + suny * suny + sunz * sunz);
-	sunx/= sunl;
-	suny/= sunl;
-	sunz/= sunl;
-
-	#define CAMERA_X 128.0
-	#define CAMERA_Y 128.0
-	#define CAMERA_Z 192.0
-
-		/** Trace rays and do all the rendering stuff **/
-	//This thing shoots a ray from the viewer for every pixel in the image
-	//After the position in which the ray hits a polygon has been determined:
-	//	A ray is shot towards the direction of the sun lighting to check if other polygon occludes the sun
-	//	Another ray is reflected by the surface normal, altered by normalmap, for phong shading
-	//The texture coordinate is determined by the hit position and parallax mapping
-	#ifdef OUTPUT
-		std::cout << "Tracing rays" << std::endl;
-	#endif
-	float a, b, c, x, y, z;
-	char progress = 0;
-	for(ushort i=0;i<FINAL_X;i++) {
-		cfloat target_x = 0.85 * (float)i / (float)FINAL_X * 192.0 + 16.0;
-		for(ushort j=0;j<FINAL_Y;j++) {
-			float best = 1000;
-			float hitx = 0, hity = 0, hitz = 0;
-			ushort hitpolygon = 0;
-			for(uint k=0;k<polygons.size();k++) { //polygons
-				bool cast = true;
-				//Check cube collisions to skip polygons
-				#ifdef CUBE_AMOUNT
-					for(char l=CUBE_AMOUNT-1;l>=0;l--) {
-						cuint div = uint(4) << (l * 2);
-						if(k % div == 0) {
-							if(!cubes.at(l).at(k / div).test_hit(CAMERA_X, CAMERA_Y, CAMERA_Z, target_x, (float)j / (float)FINAL_Y * 128.0 - 64.0, 80)) {
-								k+= div - 1;
-								cast = false;
-								l = -1;
-							}
-						}
-					}
-				#endif
-				//Now check the polygon collision
-				if(cast) {
-					if(cast_ray(polygons.at(k), a, b, c, x, y, z, CAMERA_X, CAMERA_Y, CAMERA_Z, target_x, (float)j / (float)FINAL_Y * 128.0 - 64.0, 80)) {
-						if(a >= 0 && b >= 0 && a + b <= 1 && c < best && c > 0) { //A polygon, that is closer to the camera than any other polygon so far, is hitting the ray
-							best = c;
-							hitx = x; hity = y; hitz = z; hitpolygon = k;
-						}
-					}
-				}
-			}
-			cuint id = (j * FINAL_X + i) * 3;
-			if(best < 999) { //The ray actually hits a polygon
-				//Calculate shadow
-				bool shadow = false;
-				for(uint k=0;k<polygons.size();k++) { //polygons
-					bool cast = true;
-					#ifdef CUBE_AMOUNT
-						for(char l=CUBE_AMOUNT-1;l>=0;l--) {
-							cuint div = uint(4) << (l * 2);
-							if(k % div == 0) {
-								if(!cubes.at(l).at(k / div).test_hit(hitx, hity + 0.01, hitz, hitx - sunx, hity - suny + 0.01, hitz - sunz)) {
-									k+= div - 1;
-									cast = false;
-									l = -1;
-								}
-							}
-						}
-					#endif
-					if(cast) {
-						if(cast_ray(polygons.at(k), a, b, c, x, y, z, hitx, hity + 0.01, hitz, hitx - sunx, hity - suny + 0.01, hitz - sunz)) {
-							if(a >= 0 && b >= 0 && a + b <= 1 && c > 0 && k != hitpolygon) {
-								shadow = true;
-								k = polygons.size();
-							}
-						}
-					}
-				}
-					//Lighting defines
-				#define AMBIENT
-				#define DIFFUSE
-				#define PHONG
-					//Map defines
-				#define PARALLAX
-				#define NORMAL
-					//normal vector
-				cfloat nx = polygons.at(hitpolygon).nx;
-				cfloat ny = polygons.at(hitpolygon).ny;
-				cfloat nz = polygons.at(hitpolygon).nz;
-					//tangent vector
-				cfloat tx = polygons.at(hitpolygon).tx;
-				cfloat ty = polygons.at(hitpolygon).ty;
-				cfloat tz = polygons.at(hitpolygon).tz;
-					//binormal vector
-				cfloat bx = polygons.at(hitpolygon).bx;
-				cfloat by = polygons.at(hitpolygon).by;
-				cfloat bz = polygons.at(hitpolygon).bz;
-					//camera vector
-				float cx = hitx - CAMERA_X;
-				float cy = hity - CAMERA_Y;
-				float cz = hitz - CAMERA_Z;
-				cfloat cl = sqrt(cx * cx + cy * cy + cz * cz);
-				cx/= cl;
-				cy/= cl;
-				cz/= cl;
-				depth_buffer[id / 3] = cl;
-					//camera vector in tangent space
-				cfloat tscx = tx * cx + bx * cy + nx * cz;
-				cfloat tscy = ty * cx + by * cy + ny * cz;
-				cfloat tscz = tz * cx + bz * cy + nz * cz;
-					//texture position
-				short tex_idx = (short)mix(0, 191, 0, 255, hitx);
-				short tex_idy = (short)mix(0, 127, 0, 255, hitz);
-				while(tex_idx > 255) tex_idx-= 256;
-				while(tex_idx < 0) tex_idx+= 256;
-				while(tex_idy > 255) tex_idy-= 256;
-				while(tex_idy < 0) tex_idy+= 256;
-				cuint tex_id = tex_idy * 256 + tex_idx;
-				const bool tex = hity < mix(0, 255, 4, 19, texture3[tex_id]);
-				cuchar *texture = tex ? texture1 : texture2;
-				#ifdef PARALLAX
-					//Parallax offset
-					cfloat mult = 0.2 * (float(tex ? texture4[tex_id] : texture5[tex_id]) - 128.0);
-					tex_idx+= mult * tscx;
-					tex_idy+= mult * tscy;
-					while(tex_idx > 255) tex_idx-= 256;
-					while(tex_idx < 0) tex_idx+= 256;
-					while(tex_idy > 255) tex_idy-= 256;
-					while(tex_idy < 0) tex_idy+= 256;
-				#endif
-				cuint tex_id2 = (tex_idy * 256 + tex_idx) * 3;
-				cfloat texr = texture[tex_id2];
-				cfloat texg = texture[tex_id2 + 1];
-				cfloat texb = texture[tex_id2 + 2];
-					//normalmap
-				#ifdef NORMAL
-					float nmx = (float(tex ? texture6[tex_id2] : texture7[tex_id2]) / 255.0 - 0.5) * 2.0;
-					float nmy = (float(tex ? texture6[tex_id2 + 1] : texture7[tex_id2 + 1]) / 255.0 - 0.5) * 2.0;
-					float nmz = (float(tex ? texture6[tex_id2 + 2] : texture7[tex_id2 + 2]) / 255.0 - 0.5) * 2.0 * 0.3;
-					cfloat nml = sqrt(nmx * nmx + nmy * nmy + nmz * nmz);
-					nmx/= nml;
-					nmy/= nml;
-					nmz/= nml;
-				#else
-					cfloat nmx = 0;
-					cfloat nmy = 0;
-					cfloat nmz = 1;
-				#endif
-				//Add ambient lighting
-				#ifdef AMBIENT
-					cfloat brightness = nmx * -bx + nmy * -by + nmz * -bz; //equals vector {0, -1, 0}
-					image[id] = texr * brightness * 0.3;
-					image[id + 1] = texg * brightness * 0.4;
-					image[id + 2] = texb * brightness * 0.5;
-				#else
-					image[id] = 0;
-					image[id + 1] = 0;
-					image[id + 2] = 0;
-				#endif
-				if(!shadow) {
-						//sun vector in tangent space
-					cfloat tssunx = tx * sunx + bx * suny + nx * sunz;
-					cfloat tssuny = ty * sunx + by * suny + ny * sunz;
-					cfloat tssunz = tz * sunx + bz * suny + nz * sunz;
-					//Calculate sun lighting
-					#ifdef DIFFUSE
-						cfloat dbrightness = max(nmx * tssunx + nmy * tssuny + nmz * tssunz, 0.0) * 1.5;
-						image[id]+= texr * dbrightness * 1.0;
-						image[id + 1]+= texg * dbrightness * 0.6;
-						image[id + 2]+= texb * dbrightness * 0.5;
-					#endif
-					//Calculate phong lighting
-					#ifdef PHONG
-						cfloat dot = nmx * tscx + nmy * tscy + nmz * tscz * 2.0;
-							//phong vector
-						cfloat px = tscx - dot * nmx;
-						cfloat py = tscy - dot * nmy;
-						cfloat pz = tscz - dot * nmz;
-						cfloat pbrightness = pow(max(px * -tssunx + py * -tssuny + pz * -tssunz, 0.0), 10.0) * 5.0;
-						image[id]+= texr * pbrightness * 1.0;
-						image[id + 1]+= texg * pbrightness * 0.6;
-						image[id + 2]+= texb * pbrightness * 0.5;
-					#endif
-				}
-			}
-			else {
-				image[id] = 255;
-				image[id + 1] = uchar(mix(0, FINAL_Y, 0, 255, j));
-				image[id + 2] = uchar(mix(0, FINAL_Y, 0, 128, j));
-				depth_buffer[id / 3] = 1000000;
-			}
+		else if(strcmp(argv[i], "--path") == 0 && i + 1 < argc) camera_path = argv[++i];
+		else if(strcmp(argv[i], "--reuse") == 0) reuse = true;
+		else if(strcmp(argv[i], "--bench") == 0) bench = true;
+		else if(strcmp(argv[i], "--tune") == 0) tune = true;
+		else if(strcmp(argv[i], "--terrain") == 0) {
+			terrain_cache = TERRAIN_CACHE;
+			if(i + 1 < argc && atoi(argv[i + 1]) > 0) terrain_cache = atoi(argv[++i]);
 		}
-		if(i * 10 / (FINAL_X - 1) > progress) {
-			progress++;
-			#ifdef OUTPUT
-				std::cout.width(2);
-				std::cout << std::right << (int)progress << " / 10" << std::endl;
-			#endif
+		else if(strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+			progressive.budget = atoi(argv[++i]);
+			progressive_frame = true;
 		}
-	}
-
-	//Fix depth buffer
-	//Sometimes there are seams in between the polygons where the ray doesn't hit any polygons which causes single deep spots in the depth buffer
-	//This removes those spots in the depth buffer for better result in depth of field calculation
-	for(ushort i=0;i<FINAL_X;i++) {
-		for(ushort j=0;j<FINAL_Y;j++) {
-			if(depth_buffer[j * FINAL_X + i] > 999999) {
-				uchar sum1 = 0;
-				float sum = 0;
-				float div = 0;
-				for(char k=-1;k<=1;k++) {
-					for(char l=-1;l<=1;l++) {
-						cushort x = clampi(i + k, 0, FINAL_X - 1);
-						cushort y = clampi(j + l, 0, FINAL_Y - 1);
-						if(depth_buffer[y * FINAL_X + x] < 999999) {
-							sum1++;
-							sum+= depth_buffer[y * FINAL_X + x];
-							div++;
-						}
-					}
-				}
-				if(sum1 >= 7) depth_buffer[j * FINAL_X + i] = sum / div;
+		else if(strcmp(argv[i], "--samples") == 0 && i + 1 < argc) {
+			progressive.samples = atoi(argv[++i]);
+			progressive_frame = true;
+		}
+		else if(strcmp(argv[i], "--worker") == 0 && i + 1 < argc) workers.push_back(argv[++i]);
+		else if(strcmp(argv[i], "--tile") == 0 && i + 1 < argc) {
+			tile = sscanf(argv[++i], "%u,%u,%u,%u", &tile_x1, &tile_x2, &tile_y1, &tile_y2) == 4;
+			if(!tile || tile_x1 >= tile_x2 || tile_y1 >= tile_y2 || tile_x2 - tile_x1 > TILE_SIZE || tile_y2 - tile_y1 > TILE_SIZE) {
+				std::cout << "Bad tile " << argv[i] << "!" << std::endl;
+				return 1;
 			}
 		}
+		else if(parse_render_param(argv[i], params)) {
+			args+= " ";
+			args+= argv[i];
+		}
+		else {
+			std::cout << "Unknown argument " << argv[i] << "!" << std::endl;
+			return 1;
+		}
+	}
+	if(camera_path != NULL && stream_target == NULL) {
+		std::cout << "A camera path needs --stream!" << std::endl;
+		return 1;
+	}
+	if(tile && (tile_x2 > params.width || tile_y2 > params.height)) {
+		std::cout << "The tile is outside the frame!" << std::endl;
+		return 1;
 	}
 
-		//Post processing defines
-	#define ANTIALIASING
-	#define DOF
-	#define BLOOM
-
-	float *temp_image = new float[FINAL_X * FINAL_Y * 3];
+	cuint final_x = params.width / params.scale_down;
+	cuint final_y = params.height / params.scale_down;
+	std::vector<uchar> final(final_x * final_y * 3); //Freed on every return, including the early ones below
 
-		/** Antialiasing **/
-	#ifdef ANTIALIASING
-	//This is a pretty cheap way of antialiasing that basically blurs the image a bit
-	#ifdef OUTPUT
-		std::cout << "Applying antialiasing" << std::endl;
-	#endif
-	cfloat mult1 = sqrt(32.0);
-	cfloat mult2 = sqrt(1.6);
-	cfloat mult3 = 2.0 / sqrt(18.0);
-	for(ushort i=0;i<FINAL_X;i++) {
-		for(ushort j=0;j<FINAL_Y;j++) {
-			float sum_r = 0, sum_g = 0, sum_b = 0;
-			float div = 0;
-			for(char k=-1;k<=1;k++) {
-				for(char l=-1;l<=1;l++) {
-					cushort x = clampi(i + k, 0, FINAL_X - 1);
-					cushort y = clampi(j + l, 0, FINAL_Y - 1);
-					cchar dist = abs(k) + abs(l);
-					cfloat mult = dist ? (dist == 1 ? mult2 : mult3) : mult1;
-					sum_r+= image[(y * FINAL_X + x) * 3] * mult;
-					sum_g+= image[(y * FINAL_X + x) * 3 + 1] * mult;
-					sum_b+= image[(y * FINAL_X + x) * 3 + 2] * mult;
-					div+= mult;
-				}
-			}
-			temp_image[(j * FINAL_X + i) * 3] = sum_r / div;
-			temp_image[(j * FINAL_X + i) * 3 + 1] = sum_g / div;
-			temp_image[(j * FINAL_X + i) * 3 + 2] = sum_b / div;
-		}
+	#ifndef SHOW_SOURCE
+	if(!workers.empty()) {
+		arena_c arena("Frame", frame_memory(params));
+		arena.stage("Tracing rays");
+		float *depth_buffer = arena.alloc<float>(params.width * params.height);
+		float *image = arena.alloc<float>(params.width * params.height * 3);
+		if(!render_distributed(params, args.c_str(), workers, image, depth_buffer)) return 1;
+		post_process(params, image, depth_buffer, arena);
+		arena.stage("Scaling down");
+		finish_frame(params, image, final.data(), final_x * 3);
+		arena.report();
 	}
-	for(uint i=0;i<FINAL_X*FINAL_Y*3;i++) image[i] = temp_image[i];
-	#endif
-
-		/** Depth of field **/
-	#ifdef DOF
-	#ifdef OUTPUT
-		std::cout << "Applying depth of field" << std::endl;
-	#endif
-	#define DOF_START 160.0
-	#define DOF_END 500.0
-	#define DOF_AMOUNT 2.5
-	#define DOF_MAX 4.0
-	#define DOF_ACC 15
-	float *sum_r1 = new float[FINAL_X * FINAL_Y];
-	float *sum_g1 = new float[FINAL_X * FINAL_Y];
-	float *sum_b1 = new float[FINAL_X * FINAL_Y];
-	float *div1 = new float[FINAL_X * FINAL_Y];
-	for(ushort i=0;i<FINAL_X;i++) {
-		for(ushort j=0;j<FINAL_Y;j++) {
-			cfloat depth = depth_buffer[j * FINAL_X + i];
-			cuint id1 = j * FINAL_X + i;
-			sum_r1[id1] = 0;
-			sum_g1[id1] = 0;
-			sum_b1[id1] = 0;
-			div1[id1] = 0;
-			if(depth > DOF_START) {
-				for(char k=-DOF_ACC;k<=DOF_ACC;k++) {
-					cushort x = clampi(i + k, 0, FINAL_X - 1);
-					cfloat depth2 = depth_buffer[j * FINAL_X + x];
-					if(depth2 > DOF_START) {
-						cfloat dof_amount = clampf(mix(DOF_START, DOF_END, 0, DOF_AMOUNT, depth2), 0, DOF_MAX);
-						cfloat mult = 1.0 / (fabs((float)k / dof_amount) + 1.0);
-						cuint id = (j * FINAL_X + x) * 3;
-						sum_r1[id1]+= image[id] * mult;
-						sum_g1[id1]+= image[id + 1] * mult;
-						sum_b1[id1]+= image[id + 2] * mult;
-						div1[id1]+= mult;
-					}
-				}
-			}
+	else {
+		//The standard output is for the tile or the frames only
+		if(tile || (stream_target != NULL && strcmp(stream_target, "-") == 0)) std::cout.rdbuf(std::cerr.rdbuf());
+		if(bench) {
+			scene_c scene;
+			if(!scene.load()) return 1;
+			return run_benchmark(scene, params) ? 0 : 1;
 		}
-	}
-	for(ushort i=0;i<FINAL_X;i++) {
-		for(ushort j=0;j<FINAL_Y;j++) {
-			cfloat depth = depth_buffer[j * FINAL_X + i];
-			if(depth > DOF_START) {
-				float sum_r = 0;
-				float sum_g = 0;
-				float sum_b = 0;
-				float div = 0;
-				for(char k=-DOF_ACC;k<=DOF_ACC;k++) {
-					cushort y = clampi(j + k, 0, FINAL_Y - 1);
-					cfloat depth2 = depth_buffer[y * FINAL_X + i];
-					if(depth2 > DOF_START) {
-						cfloat dof_amount = clampf(mix(DOF_START, DOF_END, 0, DOF_AMOUNT, depth2), 0, DOF_MAX);
-						cfloat mult = 1.0 / (fabs((float)k / dof_amount) + 1.0);
-						cuint id = y * FINAL_X + i;
-						sum_r+= sum_r1[id] * mult;
-						sum_g+= sum_g1[id] * mult;
-						sum_b+= sum_b1[id] * mult;
-						div+= div1[id] * mult;
-					}
-				}
-				cuint id = (j * FINAL_X + i) * 3;
-				temp_image[id] = sum_r / div;
-				temp_image[id + 1] = sum_g / div;
-				temp_image[id + 2] = sum_b / div;
-			}
-			else {
-				cuint id = (j * FINAL_X + i) * 3;
-				temp_image[id] = image[id];
-				temp_image[id + 1] = image[id + 1];
-				temp_image[id + 2] = image[id + 2];
-			}
+		if(tune) {
+			scene_c scene;
+			if(!scene.load()) return 1;
+			tune_profile_c profile;
+			if(!run_autotune(scene, params, profile)) return 1;
+			#ifdef TUNE_PROFILE
+				if(!profile.save(TUNE_PROFILE)) return 1;
+				#ifdef OUTPUT
+					std::cout << "The settings were saved in " << TUNE_PROFILE << std::endl;
+				#endif
+			#endif
+			return 0;
 		}
-	}
-	delete [] sum_r1;
-	delete [] sum_g1;
-	delete [] sum_b1;
-	delete [] div1;
-	//Apply dof
-	for(uint i=0;i<FINAL_X*FINAL_Y*3;i++) image[i] = temp_image[i];
-	#endif
-
-		/** Bloom **/
-	#ifdef BLOOM
-	//Bloom makes everything look better, always.
-	#ifdef OUTPUT
-		std::cout << "Applying bloom" << std::endl;
-	#endif
-	#define BLOOM_SIZE 12.0
-	#define CONTRAST_AMOUNT 1.4
-	#define BLOOM_AMOUNT 0.5
-	#define DARKNESS 70.0
-	//Copy the image into temp_image for bloom operations; also add contrast
-	for(uint i=0;i<FINAL_X*FINAL_Y*3;i++) temp_image[i] = (image[i] - 0.5) * CONTRAST_AMOUNT + 0.5;
-	float *temp_image2 = new float[FINAL_X * FINAL_Y * 3];
-	//Blur
-	for(ushort i=0;i<FINAL_X;i++) {
-		for(ushort j=0;j<FINAL_Y;j++) {
-			float sum_r = 0;
-			float sum_g = 0;
-			float sum_b = 0;
-			float div = 0;
-			for(char k=-(char)ceil(BLOOM_SIZE);k<(char)ceil(BLOOM_SIZE);k++) {
-				cushort x = clampi(i + k, 0, FINAL_X - 1);
-				cfloat mult = 1.0 / (fabs((float)k / BLOOM_SIZE) + 1.0);
-				cuint id = (j * FINAL_X + x) * 3;
-				sum_r+= temp_image[id] * mult;
-				sum_g+= temp_image[id + 1] * mult;
-				sum_b+= temp_image[id + 2] * mult;
-				div+= mult;
-			}
-			cuint id = (j * FINAL_X + i) * 3;
-			temp_image2[id] = sum_r / div;
-			temp_image2[id + 1] = sum_g / div;
-			temp_image2[id + 2] = sum_b / div;
+		raytracer_c renderer;
+		if(terrain_cache > 0 ? !renderer.load_paged(terrain_cache) : !renderer.load()) return 1;
+		if(stream_target != NULL) {
+			return render_stream(renderer, params, stream_format, stream_target, camera_path, reuse) ? 0 : 1;
 		}
-	}
-	for(ushort i=0;i<FINAL_X;i++) {
-		for(ushort j=0;j<FINAL_Y;j++) {
-			float sum_r = 0;
-			float sum_g = 0;
-			float sum_b = 0;
-			float div = 0;
-			for(char k=-(char)ceil(BLOOM_SIZE);k<(char)ceil(BLOOM_SIZE);k++) {
-				cushort y = clampi(j + k, 0, FINAL_Y - 1);
-				cfloat mult = 1.0 / (fabs((float)k / BLOOM_SIZE) + 1.0);
-				cuint id = (y * FINAL_X + i) * 3;
-				sum_r+= temp_image2[id] * mult;
-				sum_g+= temp_image2[id + 1] * mult;
-				sum_b+= temp_image2[id + 2] * mult;
-				div+= mult;
-			}
-			cuint id = (j * FINAL_X + i) * 3;
-			temp_image[id] = sum_r / div;
-			temp_image[id + 1] = sum_g / div;
-			temp_image[id + 2] = sum_b / div;
+		if(tile) {
+			arena_c arena("Tile", TILE_SIZE * TILE_SIZE * 4 * sizeof(float) + 2 * ARENA_ALIGN);
+			lightmap_c lightmap;
+			if(!use_lightmap(renderer.get_scene(), params, lightmap)) return 1;
+			params.progress = false;
+			return send_tile(renderer.get_scene(), params, tile_x1, tile_x2, tile_y1, tile_y2, arena) ? 0 : 1;
 		}
-	}
-	//Apply bloom
-	for(uint i=0;i<FINAL_X*FINAL_Y*3;i++) image[i] = image[i] + temp_image[i] * BLOOM_AMOUNT - DARKNESS;
-	#endif
-
-		/** Scale down the high precision image into low precision image **/
-	//This also works as a proper way of antialiasing
-	#ifdef OUTPUT
-		std::cout << "Saving the final image" << std::endl;
-	#endif
-	for(ushort i=0;i<FINAL_X/FINAL_SCALE_DOWN;i++) {
-		for(ushort j=0;j<FINAL_Y/FINAL_SCALE_DOWN;j++) {
-			float sum_r = 0;
-			float sum_g = 0;
-			float sum_b = 0;
-			for(uchar k=0;k<FINAL_SCALE_DOWN;k++) {
-				for(uchar l=0;l<FINAL_SCALE_DOWN;l++) {
-					cuint pos = ((j * FINAL_SCALE_DOWN + l) * FINAL_X + i * FINAL_SCALE_DOWN + k) * 3;
-					sum_r+= image[pos];
-					sum_g+= image[pos + 1];
-					sum_b+= image[pos + 2];
-				}
-			}
-			cuint pos = (j * FINAL_X / FINAL_SCALE_DOWN + i) * 3;
-			final[pos] = uchar(clampf(sum_r / float(FINAL_SCALE_DOWN * FINAL_SCALE_DOWN), 0, 255));
-			final[pos + 1] = uchar(clampf(sum_g / float(FINAL_SCALE_DOWN * FINAL_SCALE_DOWN), 0, 255));
-			final[pos + 2] = uchar(clampf(sum_b / float(FINAL_SCALE_DOWN * FINAL_SCALE_DOWN), 0, 255));
+		if(server_path) return run_server(renderer.get_scene(), server_path) ? 0 : 1;
+		if(progressive_frame) {
+			//Every pass is saved so that the image can be watched getting better
+			progressive.cancel = &cancelled;
+			progressive.callback = [&](cuint, cfloat) {
+				save_bmp(final.data(), final_x, final_y);
+			};
+			signal(SIGINT, cancel_frame);
+			cfloat coverage = renderer.render_progressive(params, final.data(), final_x * 3, progressive);
+			signal(SIGINT, SIG_DFL);
+			//Cancelled before the first pass was done, nothing was written into final so the last image is kept
+			if(coverage < 0) return 1;
+			#ifdef OUTPUT
+				std::cout << int(coverage * 100.0 + 0.5) << "% of the pixels were traced" << std::endl;
+			#endif
 		}
+		else if(!renderer.render(params, final.data(), final_x * 3)) return 1;
+		renderer.report();
 	}
-	delete [] temp_image;
-	#ifdef BLOOM
-	delete [] temp_image2;
-	#endif
-	delete [] image;
-	save_bmp(final, FINAL_X / FINAL_SCALE_DOWN, FINAL_Y / FINAL_SCALE_DOWN);
+	save_bmp(final.data(), final_x, final_y);
 
 	#else
-	for(int i=0;i<192*128;i++) {
-		final[i * 3] = source[i];
-		final[i * 3 + 1] = source[i];
-		final[i * 3 + 2] = source[i];
+	if(server_path != NULL || tile || stream_target != NULL || reuse || progressive_frame || bench || tune || terrain_cache > 0 || !workers.empty()) std::cout << "Only the source image is shown!" << std::endl;
+	arena_c arena("Source", 0);
+	heightmap_c source;
+	if(!load_heightmap(HEIGHTMAP, source, arena)) return 1;
+	blur_heightmap(source, arena);
+	uchar *source_image = arena.alloc<uchar>(source.width * source.height * 3);
+	for(uint i=0;i<source.width*source.height;i++) {
+		source_image[i * 3] = uchar(clampf(source.data[i], 0, 255));
+		source_image[i * 3 + 1] = uchar(clampf(source.data[i], 0, 255));
+		source_image[i * 3 + 2] = uchar(clampf(source.data[i], 0, 255));
 	}
 	#ifdef OUTPUT
 		std::cout << "Saving the source image" << std::endl;
 	#endif
-	save_bmp(final);
+	save_bmp(source_image, source.width, source.height);
+	arena.report();
 	#endif
 
-	delete [] final;
-	delete [] depth_buffer;
-	delete [] source;
-	delete [] texture1;
-	delete [] texture2;
-	delete [] texture3;
-	delete [] texture4;
-	delete [] texture5;
-	delete [] texture6;
-	delete [] texture7;
 	open_image();
 	#ifdef OUTPUT
 		std::cout << "It's done. Result saved in teos.bmp" << std::endl;
@@ -14,4 +14,15 @@ float calc_angle(const float x1, const float y1, const float x2, const float y2)
 float min(const float a, const float b);
 float max(const float a, const float b);
 
+//Spreads the lowest 10 bits of value to every third bit, for ordering things along a Morton curve
+//This is in the header as the ray streams call it for every ray
+inline unsigned int spread_bits(unsigned int value) {
+	value&= 0x3ff;
+	value = (value | value << 16) & 0x30000ff;
+	value = (value | value << 8) & 0x300f00f;
+	value = (value | value << 4) & 0x30c30c3;
+	value = (value | value << 2) & 0x9249249;
+	return value;
+}
+
 #endif
@@ -0,0 +1,339 @@
+/** mesh.cpp **/
+
+#include "mesh.hpp"
+#include "scene_cache.hpp"
+#include "parallel.hpp"
+#include "math.hpp"
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include <stdint.h>
+
+mesh_c::mesh_c(): bytes(0) {}
+
+//Reads the meshes placed in the scene, a line "file x y z scale" for every mesh
+//Empty lines and lines starting with # are skipped and a missing list has no meshes
+bool read_mesh_list(cchar *path, std::vector<mesh_place_c> &places) {
+	places.clear();
+	FILE *file = fopen(path, "r");
+	if(file == NULL) return true;
+	char line[1024], mesh_path[1024];
+	uint number = 0;
+	bool good = true;
+	while(good && fgets(line, sizeof(line), file) != NULL) {
+		number++;
+		cchar *start = line + strspn(line, " \t\r\n");
+		if(*start == 0 || *start == '#') continue;
+		mesh_place_c place;
+		if(sscanf(start, "%1023s %f %f %f %f", mesh_path, &place.x, &place.y, &place.z, &place.scale) != 5) {
+			std::cout << "Bad line " << number << " in " << path << "!" << std::endl;
+			good = false;
+			continue;
+		}
+		place.path = mesh_path;
+		places.push_back(place);
+	}
+	fclose(file);
+	return good;
+}
+
+static bool ends_with(const std::string &text, cchar *end) {
+	const size_t length = strlen(end);
+	if(text.size() < length) return false;
+	for(size_t i=0;i<length;i++) {
+		if(tolower(text[text.size() - length + i]) != end[i]) return false;
+	}
+	return true;
+}
+
+//Binary STL: an 80 byte header, the amount of triangles and 50 bytes for every triangle
+//	The 50 bytes are the normal, the 3 vertices and 2 bytes of attributes
+static bool parse_stl(const mesh_place_c &place, cuchar *data, const size_t size, mesh_c &mesh) {
+	uint count = 0;
+	if(size >= 84) memcpy(&count, data + 80, 4);
+	if(size < 84 || size != 84 + (size_t)count * 50) {
+		std::cout << place.path << " isn't a binary STL file!" << std::endl;
+		return false;
+	}
+	mesh.vertices.resize((size_t)count * 9);
+	mesh.triangles.resize((size_t)count * 3);
+	parallel_rows(count, [&](cuint first, cuint last) {
+		for(uint i=first;i<last;i++) {
+			memcpy(&mesh.vertices[(size_t)i * 9], data + 84 + (size_t)i * 50 + 12, 36);
+			for(uint k=0;k<3;k++) mesh.triangles[(size_t)i * 3 + k] = i * 3 + k;
+		}
+	});
+	return true;
+}
+
+static inline bool is_space(const char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool is_digit(const char c) {
+	return c >= '0' && c <= '9';
+}
+
+//The text of the mapped file doesn't end in a 0 so every read stops at end
+static inline cchar *next_line(cchar *p, cchar *end) {
+	while(p < end && *p != '\n') p++;
+	return p < end ? p + 1 : end;
+}
+
+static inline cchar *skip_spaces(cchar *p, cchar *end) {
+	while(p < end && is_space(*p)) p++;
+	return p;
+}
+
+//Reads a number like 12, -0.5 or 1.5e-3 and moves p past it
+static bool read_float(cchar *&p, cchar *end, float &value) {
+	const bool negative = p < end && *p == '-';
+	if(p < end && (*p == '-' || *p == '+')) p++;
+	double mantissa = 0;
+	int exponent = 0;
+	bool digits = false;
+	for(;p<end&&is_digit(*p);p++) {
+		mantissa = mantissa * 10 + (*p - '0');
+		digits = true;
+	}
+	if(p < end && *p == '.') {
+		for(p++;p<end&&is_digit(*p);p++) {
+			mantissa = mantissa * 10 + (*p - '0');
+			exponent--;
+			digits = true;
+		}
+	}
+	if(!digits) return false;
+	if(p < end && (*p == 'e' || *p == 'E')) {
+		p++;
+		const bool negative_exponent = p < end && *p == '-';
+		if(p < end && (*p == '-' || *p == '+')) p++;
+		int power = 0;
+		for(;p<end&&is_digit(*p);p++) power = min(power * 10 + (*p - '0'), 1000);
+		exponent+= negative_exponent ? -power : power;
+	}
+	value = float((negative ? -mantissa : mantissa) * pow(10.0, exponent));
+	return true;
+}
+
+//Reads the vertex of a face like 12, -3, 12/4 or 12/4/7 and moves p past it
+static bool read_index(cchar *&p, cchar *end, int &value) {
+	const bool negative = p < end && *p == '-';
+	if(negative) p++;
+	if(p >= end || !is_digit(*p)) return false;
+	long number = 0;
+	for(;p<end&&is_digit(*p);p++) number = std::min(number * 10 + (*p - '0'), 0x7fffffffL);
+	value = negative ? -(int)number : (int)number;
+	while(p < end && !is_space(*p) && *p != '\n') p++; //The texture coordinates and the normal aren't used
+	return true;
+}
+
+//Tells if the line is a vertex (v) or a face (f) and moves p past the keyword
+static inline char line_type(cchar *&p, cchar *end) {
+	p = skip_spaces(p, end);
+	if(p + 1 < end && (p[0] == 'v' || p[0] == 'f') && is_space(p[1])) {
+		p+= 2;
+		return p[-2];
+	}
+	return 0;
+}
+
+//Wavefront OBJ with v and f lines; faces with more than 3 vertices are split into a fan of triangles
+//The file is split at line ends into pieces that are counted first and then parsed in parallel into their own places
+static bool parse_obj(const mesh_place_c &place, cchar *text, const size_t size, mesh_c &mesh) {
+	cchar *end = text + size;
+	cuint pieces = (uint)std::min<size_t>(size / MESH_MIN_PIECE + 1, thread_amount() * PARALLEL_MIN_ROWS);
+	std::vector<cchar*> starts(pieces + 1);
+	for(uint i=0;i<pieces;i++) starts[i] = i == 0 ? text : next_line(text + size * i / pieces - 1, end);
+	starts[pieces] = end;
+	std::vector<size_t> vertex_offset(pieces + 1, 0), triangle_offset(pieces + 1, 0);
+	std::vector<size_t> bad_line(pieces, 0); //The first bad line in the piece counted from the start of the piece, or 0
+	parallel_rows(pieces, [&](cuint first, cuint last) {
+		for(uint i=first;i<last;i++) {
+			size_t vertices = 0, triangles = 0;
+			for(cchar *p=starts[i];p<starts[i+1];p=next_line(p, end)) {
+				const char type = line_type(p, end);
+				if(type == 'v') vertices++;
+				else if(type == 'f') {
+					uint corners = 0;
+					for(p=skip_spaces(p, end);p<end&&*p!='\n';p=skip_spaces(p, end)) {
+						while(p < end && !is_space(*p) && *p != '\n') p++;
+						corners++;
+					}
+					if(corners >= 3) triangles+= corners - 2;
+				}
+			}
+			vertex_offset[i + 1] = vertices;
+			triangle_offset[i + 1] = triangles;
+		}
+	});
+	for(uint i=0;i<pieces;i++) {
+		vertex_offset[i + 1]+= vertex_offset[i];
+		triangle_offset[i + 1]+= triangle_offset[i];
+	}
+	const size_t vertex_amount = vertex_offset[pieces];
+	if(vertex_amount >= 0xffffffff || triangle_offset[pieces] * 3 >= 0xffffffff) {
+		std::cout << place.path << " is too big!" << std::endl;
+		return false;
+	}
+	mesh.vertices.resize(vertex_amount * 3);
+	mesh.triangles.resize(triangle_offset[pieces] * 3);
+	parallel_rows(pieces, [&](cuint first, cuint last) {
+		for(uint i=first;i<last&&bad_line[i]==0;i++) {
+			float *vertex = mesh.vertices.data() + vertex_offset[i] * 3;
+			uint *triangle = mesh.triangles.data() + triangle_offset[i] * 3;
+			size_t vertices = vertex_offset[i]; //Before the line
+			size_t line = 1;
+			for(cchar *p=starts[i];p<starts[i+1]&&bad_line[i]==0;p=next_line(p, end),line++) {
+				const char type = line_type(p, end);
+				if(type == 'v') {
+					bool good = true;
+					for(uint k=0;k<3;k++) {
+						p = skip_spaces(p, end);
+						good = good && read_float(p, end, vertex[k]);
+					}
+					if(!good) bad_line[i] = line;
+					vertex+= 3;
+					vertices++;
+				}
+				else if(type == 'f') {
+					uint corners = 0, first_corner = 0, last_corner = 0;
+					for(p=skip_spaces(p, end);p<end&&*p!='\n';p=skip_spaces(p, end)) {
+						int index;
+						if(!read_index(p, end, index) || index == 0) {
+							bad_line[i] = line;
+							break;
+						}
+						//Negative indices count back from the last vertex before the line
+						const long long corner = index > 0 ? (long long)index - 1 : (long long)vertices + index;
+						if(corner < 0 || corner >= (long long)vertex_amount) {
+							bad_line[i] = line;
+							break;
+						}
+						if(corners == 0) first_corner = (uint)corner;
+						else if(corners >= 2) {
+							triangle[0] = first_corner;
+							triangle[1] = last_corner;
+							triangle[2] = (uint)corner;
+							triangle+= 3;
+						}
+						last_corner = (uint)corner;
+						corners++;
+					}
+					//A face with less than 3 vertices was counted as no triangles
+				}
+			}
+		}
+	});
+	for(uint i=0;i<pieces;i++) {
+		if(bad_line[i] == 0) continue;
+		size_t line = bad_line[i];
+		for(cchar *p=text;p<starts[i];p=next_line(p, end)) line++;
+		std::cout << "Bad line " << line << " in " << place.path << "!" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+//Orders the triangles along a Morton curve through their centers and leaves out the triangles without an area
+static void sort_triangles(mesh_c &mesh) {
+	cuint amount = mesh.triangles.size() / 3;
+	if(amount == 0) return;
+	float low[3], high[3];
+	for(uint k=0;k<3;k++) {
+		low[k] = mesh.vertices[k];
+		high[k] = mesh.vertices[k];
+	}
+	for(size_t i=0;i<mesh.vertices.size();i+=3) {
+		for(uint k=0;k<3;k++) {
+			low[k] = min(low[k], mesh.vertices[i + k]);
+			high[k] = max(high[k], mesh.vertices[i + k]);
+		}
+	}
+	std::vector<uint64_t> keys(amount);
+	parallel_rows(amount, [&](cuint first, cuint last) {
+		for(uint i=first;i<last;i++) {
+			cfloat *v1 = &mesh.vertices[mesh.triangles[i * 3] * 3];
+			cfloat *v2 = &mesh.vertices[mesh.triangles[i * 3 + 1] * 3];
+			cfloat *v3 = &mesh.vertices[mesh.triangles[i * 3 + 2] * 3];
+			cfloat nx = (v2[1] - v1[1]) * (v3[2] - v1[2]) - (v2[2] - v1[2]) * (v3[1] - v1[1]);
+			cfloat ny = (v2[2] - v1[2]) * (v3[0] - v1[0]) - (v2[0] - v1[0]) * (v3[2] - v1[2]);
+			cfloat nz = (v2[0] - v1[0]) * (v3[1] - v1[1]) - (v2[1] - v1[1]) * (v3[0] - v1[0]);
+			cfloat area = nx * nx + ny * ny + nz * nz;
+			uint code = 0;
+			for(uint k=0;k<3;k++) {
+				cfloat center = (v1[k] + v2[k] + v3[k]) / 3;
+				cfloat place = high[k] > low[k] ? (center - low[k]) / (high[k] - low[k]) : 0;
+				code|= spread_bits((uint)clampf(place * 1023, 0, 1023)) << k;
+			}
+			//The triangles without an area go to the end
+			keys[i] = ((uint64_t)(area > 0 && std::isfinite(area) ? code : 0xffffffff) << 32) | i;
+		}
+	});
+	std::sort(keys.begin(), keys.end());
+	std::vector<uint> triangles;
+	triangles.reserve(mesh.triangles.size());
+	for(uint i=0;i<amount&&(keys[i]>>32)!=0xffffffff;i++) {
+		cuint triangle = keys[i] & 0xffffffff;
+		for(uint k=0;k<3;k++) triangles.push_back(mesh.triangles[triangle * 3 + k]);
+	}
+	mesh.triangles.swap(triangles);
+}
+
+//Loads the mesh from the mapped file and places it in the scene
+bool load_mesh(const mesh_place_c &place, mesh_c &mesh) {
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	mesh.vertices.clear();
+	mesh.triangles.clear();
+	size_t size;
+	uchar *data = map_scene_cache(place.path.c_str(), size);
+	if(data == NULL) {
+		std::cout << "Couldn't open " << place.path << "!" << std::endl;
+		return false;
+	}
+	bool loaded = false;
+	if(ends_with(place.path, ".stl")) loaded = parse_stl(place, data, size, mesh);
+	else if(ends_with(place.path, ".obj")) loaded = parse_obj(place, (cchar*)data, size, mesh);
+	else std::cout << place.path << " isn't an OBJ or an STL file!" << std::endl;
+	unmap_scene_cache(data, size);
+	if(!loaded) return false;
+	parallel_rows(mesh.vertices.size() / 3, [&](cuint first, cuint last) {
+		for(size_t i=first*(size_t)3;i<last*(size_t)3;i+=3) {
+			mesh.vertices[i] = mesh.vertices[i] * place.scale + place.x;
+			mesh.vertices[i + 1] = mesh.vertices[i + 1] * place.scale + place.y;
+			mesh.vertices[i + 2] = mesh.vertices[i + 2] * place.scale + place.z;
+		}
+	});
+	sort_triangles(mesh);
+	mesh.bytes = size;
+	#ifdef OUTPUT
+		cdouble seconds = std::max(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), 1e-6);
+		cuint triangles = mesh.triangles.size() / 3;
+		std::cout << "     Loaded " << place.path << ": " << triangles << " triangles, " << (size + 1023) / 1024 << " KB in " << int(seconds * 1000 + 0.5) << " ms";
+		std::cout << " (" << int(size / 1048576.0 / seconds + 0.5) << " MB/s, " << int(triangles / seconds + 0.5) << " triangles/s)" << std::endl;
+	#endif
+	return true;
+}
+
+//Creates a polygon for every triangle of the mesh into the given memory
+//The texture coordinates are the two axes the triangle faces least like the x and z of the heights so that the tangent frames match
+//The vertices are turned around as the normals of the polygons point into the solid like those of the heights
+void create_mesh_polygons(const mesh_c &mesh, polygon_c *polygons) {
+	parallel_rows(mesh.triangles.size() / 3, [&](cuint first, cuint last) {
+		for(uint i=first;i<last;i++) {
+			cfloat *v1 = &mesh.vertices[mesh.triangles[i * 3] * 3];
+			cfloat *v2 = &mesh.vertices[mesh.triangles[i * 3 + 2] * 3];
+			cfloat *v3 = &mesh.vertices[mesh.triangles[i * 3 + 1] * 3];
+			cfloat nx = fabs((v2[1] - v1[1]) * (v3[2] - v1[2]) - (v2[2] - v1[2]) * (v3[1] - v1[1]));
+			cfloat ny = fabs((v2[2] - v1[2]) * (v3[0] - v1[0]) - (v2[0] - v1[0]) * (v3[2] - v1[2]));
+			cfloat nz = fabs((v2[0] - v1[0]) * (v3[1] - v1[1]) - (v2[1] - v1[1]) * (v3[0] - v1[0]));
+			cuint u = ny >= nx && ny >= nz ? 0 : (nx >= nz ? 2 : 0);
+			cuint v = ny >= nx && ny >= nz ? 2 : 1;
+			polygons[i] = polygon_c(v1[0], v1[1], v1[2], v2[0], v2[1], v2[2], v3[0], v3[1], v3[2], v1[u], v1[v], v2[u], v2[v], v3[u], v3[v]);
+		}
+	});
+}
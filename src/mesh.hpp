@@ -0,0 +1,36 @@
+/** mesh.hpp **/
+
+#ifndef MESH_HPP
+#define MESH_HPP
+
+#include "global.hpp"
+#include "polygon.hpp"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#define MESH_MIN_PIECE 65536 //OBJ files are split into pieces of at least this many bytes that are parsed in parallel
+
+//A mesh file and where it is placed in the scene, a line of the mesh list
+class mesh_place_c {
+	public:
+		std::string path;
+		float x, y, z, scale; //The vertices are scaled and then moved by x, y, z
+};
+
+//The triangles of an OBJ or a binary STL file placed in the scene
+//The vertices are already moved into their place and the triangles are ordered along a Morton curve
+//	so that the triangles next to each other in the list are close to each other for the cubes
+class mesh_c {
+	public:
+		std::vector<float> vertices; //x, y, z of every vertex
+		std::vector<uint> triangles; //3 vertices of every triangle
+		size_t bytes; //Size of the file
+		mesh_c();
+};
+
+bool read_mesh_list(cchar *path, std::vector<mesh_place_c> &places);
+bool load_mesh(const mesh_place_c &place, mesh_c &mesh);
+void create_mesh_polygons(const mesh_c &mesh, polygon_c *polygons);
+
+#endif
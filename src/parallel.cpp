@@ -0,0 +1,207 @@
+/** parallel.cpp **/
+
+#include "parallel.hpp"
+#include <atomic>
+#include <iostream>
+
+uint thread_amount() {
+	#if THREADS > 0
+		return THREADS;
+	#else
+		cuint amount = std::thread::hardware_concurrency();
+		return amount > 0 ? amount : 1;
+	#endif
+}
+
+//Splits the rows into contiguous ranges and calls func for every range in its own thread
+//The calling thread handles the first range itself
+//At most max_threads threads are used unless it is 0
+void parallel_rows(cuint rows, const std::function<void(cuint first, cuint last)> &func, cuint max_threads) {
+	uint threads = max_threads > 0 ? max_threads : thread_amount();
+	if(threads > rows / PARALLEL_MIN_ROWS) threads = rows / PARALLEL_MIN_ROWS;
+	if(threads <= 1) {
+		func(0, rows);
+		return;
+	}
+	std::vector<std::thread> workers;
+	for(uint i=1;i<threads;i++) workers.push_back(std::thread(func, rows * i / threads, rows * (i + 1) / threads));
+	func(0, rows / threads);
+	for(uint i=0;i<workers.size();i++) workers[i].join();
+}
+
+//Splits the rows into blocks of block rows and calls func for every block
+//The threads take the next block whenever they finish one so rows that take longer than others are spread between the threads
+//Uses as many threads as parallel_rows would
+void parallel_blocks(cuint rows, cuint block, const std::function<void(cuint first, cuint last)> &func, cuint max_threads) {
+	uint threads = max_threads > 0 ? max_threads : thread_amount();
+	if(threads > rows / PARALLEL_MIN_ROWS) threads = rows / PARALLEL_MIN_ROWS;
+	cuint blocks = (rows + block - 1) / block;
+	std::atomic<uint> next(0);
+	const std::function<void()> work = [&]() {
+		for(uint i=next++;i<blocks;i=next++) func(i * block, (i + 1) * block < rows ? (i + 1) * block : rows);
+	};
+	std::vector<std::thread> workers;
+	for(uint i=1;i<threads;i++) workers.push_back(std::thread(work));
+	work();
+	for(uint i=0;i<workers.size();i++) workers[i].join();
+}
+
+thread_pool_c::thread_pool_c(cuint threads): active(0), stopping(false) {
+	cuint amount = threads > 0 ? threads : thread_amount();
+	for(uint i=0;i<amount;i++) workers.push_back(std::thread(&thread_pool_c::work, this, i));
+}
+
+thread_pool_c::~thread_pool_c() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for(uint i=0;i<workers.size();i++) workers[i].join();
+}
+
+void thread_pool_c::work(cuint worker) {
+	while(true) {
+		std::function<void(cuint worker)> job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while(jobs.empty() && !stopping) wake.wait(lock);
+			if(jobs.empty()) return;
+			job = jobs.front();
+			jobs.pop_front();
+			active++;
+		}
+		job(worker);
+		std::lock_guard<std::mutex> lock(mutex);
+		active--;
+	}
+}
+
+void thread_pool_c::submit(const std::function<void(cuint worker)> &job) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(job);
+	}
+	wake.notify_one();
+}
+
+//Amount of jobs waiting for a free thread
+uint thread_pool_c::queued() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return jobs.size();
+}
+
+//Amount of jobs being run right now
+uint thread_pool_c::running() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return active;
+}
+
+uint thread_pool_c::size() const {
+	return workers.size();
+}
+
+task_graph_c::task_graph_c(): finished(0) {}
+
+//Adds a task that runs once every task in after is done; returns the id to give to the tasks after this one
+uint task_graph_c::add(const std::string &name, const std::function<bool()> &func, const std::vector<uint> &after) {
+	task_c task;
+	task.name = name;
+	task.func = func;
+	task.after = after;
+	task.waiting = after.size();
+	task.failed = false;
+	task.start = -1;
+	task.time = 0;
+	tasks.push_back(task);
+	cuint id = tasks.size() - 1;
+	for(uint i=0;i<after.size();i++) tasks[after[i]].before.push_back(id);
+	return id;
+}
+
+//Runs the task and submits the tasks that were only waiting for it
+void task_graph_c::run_task(thread_pool_c &pool, cuint id) {
+	task_c &task = tasks[id];
+	if(!task.failed) {
+		task.start = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+		task.failed = !task.func();
+		task.time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count() - task.start;
+	}
+	std::vector<uint> ready;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for(uint i=0;i<task.before.size();i++) {
+			task_c &next = tasks[task.before[i]];
+			if(task.failed) next.failed = true;
+			if(--next.waiting == 0) ready.push_back(task.before[i]);
+		}
+		finished++;
+	}
+	for(uint i=0;i<ready.size();i++) {
+		cuint next = ready[i];
+		pool.submit([this, &pool, next](cuint) {
+			run_task(pool, next);
+		});
+	}
+	done.notify_all();
+}
+
+//Every task must have been added before this; the tasks can't add more tasks
+bool task_graph_c::run(cuint threads) {
+	finished = 0;
+	begin = std::chrono::steady_clock::now();
+	thread_pool_c pool(threads);
+	for(uint i=0;i<tasks.size();i++) {
+		if(tasks[i].after.empty()) pool.submit([this, &pool, i](cuint) {
+			run_task(pool, i);
+		});
+	}
+	bool failed = false;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while(finished < tasks.size()) done.wait(lock);
+		for(uint i=0;i<tasks.size();i++) failed|= tasks[i].failed;
+	}
+	return !failed;
+}
+
+//The critical path is followed back from the task that ended last through the task it waited for that ended last
+//Those tasks are marked with * in the list
+void task_graph_c::report() const {
+	std::vector<bool> critical(tasks.size(), false);
+	double total = 0, path = 0;
+	int last = -1;
+	for(uint i=0;i<tasks.size();i++) {
+		if(tasks[i].start >= 0 && (last < 0 || tasks[i].start + tasks[i].time > total)) {
+			last = i;
+			total = tasks[i].start + tasks[i].time;
+		}
+	}
+	std::string chain;
+	while(last >= 0) {
+		const task_c &task = tasks[last];
+		critical[last] = true;
+		path+= task.time;
+		chain = task.name + (chain.empty() ? "" : " > ") + chain;
+		last = -1;
+		for(uint i=0;i<task.after.size();i++) {
+			const task_c &previous = tasks[task.after[i]];
+			if(last < 0 || previous.start + previous.time > tasks[last].start + tasks[last].time) last = task.after[i];
+		}
+	}
+	std::cout << "     Task                      Start      Time" << std::endl;
+	for(uint i=0;i<tasks.size();i++) {
+		std::cout << "     " << tasks[i].name;
+		std::cout.width(tasks[i].name.size() < 24 ? 24 - tasks[i].name.size() : 0);
+		std::cout << "";
+		if(tasks[i].start < 0) {
+			std::cout << "     skipped" << std::endl;
+			continue;
+		}
+		std::cout.width(6);
+		std::cout << int(tasks[i].start + 0.5) << " ms";
+		std::cout.width(7);
+		std::cout << int(tasks[i].time + 0.5) << " ms" << (critical[i] ? " *" : "") << (tasks[i].failed ? " failed" : "") << std::endl;
+	}
+	std::cout << "     Critical path: " << chain << ", " << int(path + 0.5) << " ms of " << int(total + 0.5) << " ms" << std::endl;
+}
@@ -0,0 +1,70 @@
+/** parallel.hpp **/
+
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include "global.hpp"
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <deque>
+#include <string>
+#include <chrono>
+
+#define THREADS 0 //Amount of threads used for parallel work; 0 uses every core of the machine
+#define PARALLEL_MIN_ROWS 16 //Less rows than this per thread is not worth starting a thread for
+
+uint thread_amount();
+void parallel_rows(cuint rows, const std::function<void(cuint first, cuint last)> &func, cuint max_threads = 0);
+void parallel_blocks(cuint rows, cuint block, const std::function<void(cuint first, cuint last)> &func, cuint max_threads = 0);
+
+//A fixed amount of threads that run submitted jobs in the order they were submitted
+//Every job is given the index of the thread running it so that the jobs can reuse memory owned by that thread
+class thread_pool_c {
+	private:
+		std::vector<std::thread> workers;
+		std::deque<std::function<void(cuint worker)> > jobs;
+		std::mutex mutex;
+		std::condition_variable wake;
+		uint active;
+		bool stopping;
+		void work(cuint worker);
+	public:
+		thread_pool_c(cuint threads);
+		~thread_pool_c(); //Runs the jobs that are still queued before returning
+		void submit(const std::function<void(cuint worker)> &job);
+		uint queued();
+		uint running();
+		uint size() const;
+};
+
+//Tasks that are run by a pool of threads as soon as every task they come after is done
+//The start and the length of every task are kept so that the longest chain of tasks, the critical path, can be reported
+class task_graph_c {
+	private:
+		class task_c {
+			public:
+				std::string name;
+				std::function<bool()> func; //Returns false if the task failed
+				std::vector<uint> after; //The tasks this one waits for
+				std::vector<uint> before; //The tasks waiting for this one
+				uint waiting; //Tasks in after that haven't finished yet
+				bool failed; //This task or a task it waits for failed; a task after a failed one isn't run
+				double start, time; //Milliseconds from the start of the graph
+		};
+		std::vector<task_c> tasks;
+		std::mutex mutex;
+		std::condition_variable done;
+		uint finished;
+		std::chrono::steady_clock::time_point begin;
+		void run_task(thread_pool_c &pool, cuint id);
+	public:
+		task_graph_c();
+		uint add(const std::string &name, const std::function<bool()> &func, const std::vector<uint> &after = std::vector<uint>());
+		bool run(cuint threads = 0); //Returns false if any task failed
+		void report() const; //Prints when every task started and how long it took and the critical path
+};
+
+#endif
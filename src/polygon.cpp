@@ -55,11 +55,10 @@ polygon_c::polygon_c(cfloat X1, cfloat Y1, cfloat Z1,
 	maxz = max(z1, max(z2, z3)) + 0.001;
 }
 
-//Change the order of the vertexes
-//Doesn't affect the way the polygon is drawn in any way
-void polygon_c::swap() {
-	cfloat xtemp = x1, ytemp = y1, ztemp = z1, txtemp = tx1, tytemp = ty1;
-	x1 = x2; y1 = y2; z1 = z2; tx1 = tx2; ty1 = ty2;
-	x2 = x3; y2 = y3; z2 = z3; tx2 = tx3; ty2 = ty3;
-	x3 = xtemp; y3 = ytemp; z3 = ztemp; tx3 = txtemp; ty3 = tytemp;
+tangent_frame_c::tangent_frame_c() {}
+
+tangent_frame_c::tangent_frame_c(const polygon_c &polygon) {
+	nx = polygon.nx; ny = polygon.ny; nz = polygon.nz;
+	tx = polygon.tx; ty = polygon.ty; tz = polygon.tz;
+	bx = polygon.bx; by = polygon.by; bz = polygon.bz;
 }
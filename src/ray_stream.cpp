@@ -0,0 +1,195 @@
+/** ray_stream.cpp **/
+
+#include "ray_stream.hpp"
+#include "cast_ray.hpp"
+#include "math.hpp"
+#include <algorithm>
+#include <cmath>
+
+ray_stream_c::ray_stream_c(): count(0) {}
+
+//Keeps the memory for the next stream
+void ray_stream_c::clear() {
+	origin_x.clear(); origin_y.clear(); origin_z.clear();
+	end_x.clear(); end_y.clear(); end_z.clear();
+	inverse_x.clear(); inverse_y.clear(); inverse_z.clear();
+	skip.clear();
+	count = 0;
+}
+
+//The ray goes from J, K, L towards x, y, z and ix, iy, iz is the inverse of its direction like in quad_c::test_ray
+//A shadow ray doesn't hit skip_polygon
+uint ray_stream_c::add(cfloat J, cfloat K, cfloat L, cfloat x, cfloat y, cfloat z, cfloat ix, cfloat iy, cfloat iz, cuint skip_polygon) {
+	origin_x.push_back(J); origin_y.push_back(K); origin_z.push_back(L);
+	end_x.push_back(x); end_y.push_back(y); end_z.push_back(z);
+	inverse_x.push_back(ix); inverse_y.push_back(iy); inverse_z.push_back(iz);
+	skip.push_back(skip_polygon);
+	return count++;
+}
+
+bool can_stream_rays(const scene_c &scene) {
+	#ifdef CUBE_AMOUNT
+		return scene.terrain == NULL && scene.quad_test && scene.cube_levels > 0;
+	#else
+		return false;
+	#endif
+}
+
+#ifdef CUBE_AMOUNT
+//The cell of the origin on one axis; the cells go from -512 to 511 cells around the origin of the scene
+static inline uint origin_cell(cfloat value) {
+	cfloat cell = floor(value / RAY_STREAM_CELL) + 512;
+	return cell < 0 ? 0 : cell > 1023 ? 1023 : (uint)cell;
+}
+
+//Fills the list of the top level with the rays sorted by the octant of their direction and then by the cell of their origin
+//The keys have the 3 bits of the octant on top, the 30 bits of the cell below them and the ray in the lowest 31 bits
+void ray_stream_c::sort(const scene_c &scene) {
+	keys.resize(count);
+	for(uint r=0;r<count;r++) {
+		cuint octant = (end_x[r] < origin_x[r]) | (end_y[r] < origin_y[r]) << 1 | (end_z[r] < origin_z[r]) << 2;
+		cuint cell = spread_bits(origin_cell(origin_x[r])) | spread_bits(origin_cell(origin_y[r])) << 1 | spread_bits(origin_cell(origin_z[r])) << 2;
+		keys[r] = (unsigned long long)octant << 61 | (unsigned long long)cell << 31 | r;
+	}
+	std::sort(keys.begin(), keys.end());
+	std::vector<uint> &list = lists[scene.cube_levels];
+	list.resize(count);
+	for(uint r=0;r<count;r++) list[r] = (uint)(keys[r] & 0x7fffffff);
+}
+
+//Orders the cubes of the quad by the nearest entry of any of the rays into them
+static uint order_cubes(cuint amount, const uchar *masks, cfloat *entries, uchar *order) {
+	float nearest[QUAD_SIZE];
+	uint entered = 0;
+	for(uint i=0;i<amount;i++) {
+		for(uint o=0;o<QUAD_SIZE;o++) {
+			if(!(masks[i] & (1 << o))) continue;
+			if(!(entered & (1 << o)) || entries[i * QUAD_SIZE + o] < nearest[o]) nearest[o] = entries[i * QUAD_SIZE + o];
+			entered|= 1 << o;
+		}
+	}
+	uint cubes = 0;
+	for(uchar o=0;o<QUAD_SIZE;o++) {
+		if(!(entered & (1 << o))) continue;
+		uint j = cubes++;
+		while(j > 0 && nearest[order[j - 1]] > nearest[o]) {
+			order[j] = order[j - 1];
+			j--;
+		}
+		order[j] = o;
+	}
+	return cubes;
+}
+
+//Takes the rays of the level above into the cubes of the quad m on the level they enter before something closer was hit
+//Like quad_primary in render.cpp the polygons under the cubes of the lowest level are tested; of two equally close polygons the first one is kept
+void ray_stream_c::primary_quad(const scene_c &scene, cuint level, cuint m) {
+	const std::vector<uint> &rays = lists[level + 1];
+	cuint amount = rays.size();
+	masks[level].resize(amount);
+	entries[level].resize(amount * QUAD_SIZE);
+	uchar *mask = masks[level].data();
+	float *entry = entries[level].data();
+	scene.quads[level][m].test_rays(amount, rays.data(), origin_x.data(), origin_y.data(), origin_z.data(), inverse_x.data(), inverse_y.data(), inverse_z.data(), best.data(), mask, entry);
+	uchar order[QUAD_SIZE];
+	cuint cubes = order_cubes(amount, mask, entry, order);
+	std::vector<uint> &under = lists[level];
+	for(uint o=0;o<cubes;o++) {
+		under.clear();
+		for(uint i=0;i<amount;i++) {
+			if((mask[i] & (1 << order[o])) && entry[i * QUAD_SIZE + order[o]] <= best[rays[i]]) under.push_back(rays[i]);
+		}
+		if(under.empty()) continue;
+		cuint cube = m * QUAD_SIZE + order[o];
+		if(level > 0) {
+			primary_quad(scene, level - 1, cube);
+			continue;
+		}
+		float a, b, c, rx, ry, rz;
+		for(uint k=cube*4;k<cube*4+4&&k<scene.polygon_count;k++) {
+			const polygon_c &polygon = scene.polygons[k];
+			for(uint i=0;i<under.size();i++) {
+				cuint r = under[i];
+				if(cast_ray(polygon, a, b, c, rx, ry, rz, origin_x[r], origin_y[r], origin_z[r], end_x[r], end_y[r], end_z[r])) {
+					if(a >= 0 && b >= 0 && a + b <= 1 && c > 0 && (c < best[r] || (c == best[r] && k < hit_polygon[r]))) {
+						best[r] = c;
+						hit_x[r] = rx; hit_y[r] = ry; hit_z[r] = rz; hit_polygon[r] = k;
+					}
+				}
+			}
+		}
+	}
+}
+
+//Takes the rays of the level above that haven't been blocked yet into the cubes of the quad m on the level they enter
+//A ray is blocked by any polygon other than its skip polygon
+void ray_stream_c::shadow_quad(const scene_c &scene, cuint level, cuint m) {
+	const std::vector<uint> &rays = lists[level + 1];
+	cuint amount = rays.size();
+	masks[level].resize(amount);
+	entries[level].resize(amount * QUAD_SIZE);
+	uchar *mask = masks[level].data();
+	float *entry = entries[level].data();
+	scene.quads[level][m].test_rays(amount, rays.data(), origin_x.data(), origin_y.data(), origin_z.data(), inverse_x.data(), inverse_y.data(), inverse_z.data(), NULL, mask, entry);
+	uchar order[QUAD_SIZE];
+	cuint cubes = order_cubes(amount, mask, entry, order);
+	std::vector<uint> &under = lists[level];
+	for(uint o=0;o<cubes;o++) {
+		under.clear();
+		for(uint i=0;i<amount;i++) {
+			if((mask[i] & (1 << order[o])) && !hit[rays[i]]) under.push_back(rays[i]);
+		}
+		if(under.empty()) continue;
+		cuint cube = m * QUAD_SIZE + order[o];
+		if(level > 0) {
+			shadow_quad(scene, level - 1, cube);
+			continue;
+		}
+		float a, b, c, rx, ry, rz;
+		for(uint k=cube*4;k<cube*4+4&&k<scene.polygon_count;k++) {
+			const polygon_c &polygon = scene.polygons[k];
+			for(uint i=0;i<under.size();i++) {
+				cuint r = under[i];
+				if(hit[r]) continue;
+				if(cast_ray(polygon, a, b, c, rx, ry, rz, origin_x[r], origin_y[r], origin_z[r], end_x[r], end_y[r], end_z[r])) {
+					if(a >= 0 && b >= 0 && a + b <= 1 && c > 0 && k != skip[r]) hit[r] = 1;
+				}
+			}
+		}
+	}
+}
+#endif
+
+//Finds the closest polygon every ray hits like trace_primary
+void ray_stream_c::trace_primary(const scene_c &scene) {
+	best.assign(count, 1000);
+	hit_x.assign(count, 0); hit_y.assign(count, 0); hit_z.assign(count, 0);
+	hit_polygon.assign(count, NO_HIT);
+	hit.assign(count, 0);
+	#ifdef CUBE_AMOUNT
+		cuint top = scene.cube_levels - 1;
+		sort(scene);
+		for(uint m=0;m<scene.quad_count[top];m++) primary_quad(scene, top, m);
+		for(uint r=0;r<count;r++) hit[r] = best[r] < 999;
+	#endif
+}
+
+//Finds out which rays are blocked like trace_shadow
+void ray_stream_c::trace_shadow(const scene_c &scene) {
+	hit.assign(count, 0);
+	#ifdef CUBE_AMOUNT
+		cuint top = scene.cube_levels - 1;
+		sort(scene);
+		std::vector<uint> &rays = lists[top + 1];
+		for(uint m=0;m<scene.quad_count[top];m++) {
+			//The rays blocked under the quads before this one are left out
+			uint amount = 0;
+			for(uint i=0;i<rays.size();i++) {
+				if(!hit[rays[i]]) rays[amount++] = rays[i];
+			}
+			rays.resize(amount);
+			if(amount == 0) break;
+			shadow_quad(scene, top, m);
+		}
+	#endif
+}
@@ -0,0 +1,50 @@
+/** ray_stream.hpp **/
+
+#ifndef RAY_STREAM_HPP
+#define RAY_STREAM_HPP
+
+#include "global.hpp"
+#include "scene.hpp"
+#include "render.hpp"
+#include <vector>
+
+#define RAY_STREAM_SIZE 4096 //Rays traced together at most; the rays of at least one column of pixels go into a stream
+#define RAY_STREAM_CELL 4.0 //Size of the cells the origins of the rays are sorted by
+
+//Rays traced breadth first: every ray of the stream is tested against a quad of the cubes before any of them goes under it
+//	The bounds of the quad and the polygons under the lowest cubes are loaded once for all the rays that reach them
+//	instead of once for every ray like trace_primary and trace_shadow do
+//The rays are sorted by the octant of their direction and the cell their origin is in, along a Morton curve,
+//so that the rays that go through the same cubes are next to each other
+//The hits are the same as what trace_primary and trace_shadow find for the rays one by one
+class ray_stream_c {
+	private:
+		std::vector<float> origin_x, origin_y, origin_z; //J, K, L of the ray
+		std::vector<float> end_x, end_y, end_z; //x, y, z of the ray
+		std::vector<float> inverse_x, inverse_y, inverse_z;
+		std::vector<float> best;
+		std::vector<uint> skip; //The polygon a shadow ray starts from
+		std::vector<unsigned long long> keys; //The sort key in the high bits and the ray in the low bits
+		#ifdef CUBE_AMOUNT
+			std::vector<uint> lists[CUBE_AMOUNT + 1]; //The rays going into a quad of every level; the top level takes the last one
+			std::vector<uchar> masks[CUBE_AMOUNT]; //A bit for every cube of the quad of the level that the rays of its list enter
+			std::vector<float> entries[CUBE_AMOUNT]; //And where they enter them
+		#endif
+		void sort(const scene_c &scene);
+		void primary_quad(const scene_c &scene, cuint level, cuint m);
+		void shadow_quad(const scene_c &scene, cuint level, cuint m);
+	public:
+		std::vector<float> hit_x, hit_y, hit_z;
+		std::vector<uint> hit_polygon;
+		std::vector<uchar> hit; //The primary ray hit a polygon or the shadow ray is blocked
+		uint count;
+		ray_stream_c();
+		void clear();
+		uint add(cfloat J, cfloat K, cfloat L, cfloat x, cfloat y, cfloat z, cfloat ix, cfloat iy, cfloat iz, cuint skip_polygon = NO_HIT); //Returns the index of the ray
+		void trace_primary(const scene_c &scene);
+		void trace_shadow(const scene_c &scene);
+};
+
+bool can_stream_rays(const scene_c &scene); //The scene is traced through the quads of the cubes
+
+#endif
@@ -0,0 +1,142 @@
+/** raytracer.cpp **/
+
+#include "raytracer.hpp"
+#include <iostream>
+#include <cstring>
+
+raytracer_c::raytracer_c(): arena("Frame", frame_memory(render_params_c())), history(new history_c), tuned(false), tracking(false) {}
+
+raytracer_c::~raytracer_c() {
+	delete history;
+}
+
+bool raytracer_c::load() {
+	if(!scene.load()) return false;
+	loaded();
+	return true;
+}
+
+bool raytracer_c::load_paged(cuint cache_chunks) {
+	if(!scene.load_paged(terrain, cache_chunks)) return false;
+	loaded();
+	return true;
+}
+
+//Starts over with the scene that was just loaded and uses the settings tuned for it
+void raytracer_c::loaded() {
+	history->valid = false;
+	tuned = false;
+	#ifdef TUNE_PROFILE
+		tuned = profile.load(TUNE_PROFILE, scene.get_hash());
+		if(tuned) profile.apply(scene);
+	#endif
+}
+
+//The history the next frame is recorded into or NULL if nothing is going to use it
+//A frame that isn't recorded leaves the history out of date
+history_c *raytracer_c::frame_history() {
+	if(history->reuse || history->edited || tracking) return history;
+	history->valid = false;
+	return NULL;
+}
+
+//The parameters must be sane and the rows of the output must not overlap
+bool raytracer_c::check(const render_params_c &params, cuint stride, cuint pixel_size) const {
+	if(scene.polygons == NULL && scene.terrain == NULL) {
+		std::cout << "The scene hasn't been loaded!" << std::endl;
+		return false;
+	}
+	if(params.width == 0 || params.height == 0 || params.scale_down == 0 || params.width < params.scale_down || params.height < params.scale_down) {
+		std::cout << "Bad frame size " << params.width << "x" << params.height << "!" << std::endl;
+		return false;
+	}
+	if(stride < params.width / params.scale_down * 3 * pixel_size || stride % pixel_size != 0) {
+		std::cout << "Bad stride " << stride << "!" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool raytracer_c::render(const render_params_c &params, uchar *pixels, cuint stride) {
+	if(!check(params, stride, sizeof(uchar))) return false;
+	render_params_c frame_params = params;
+	if(tuned) profile.apply(frame_params);
+	if(!use_lightmap(scene, frame_params, lightmap)) return false;
+	arena.reset();
+	render_frame(scene, frame_params, pixels, stride, arena, frame_history());
+	return true;
+}
+
+bool raytracer_c::render(const render_params_c &params, float *pixels, cuint stride) {
+	if(!check(params, stride, sizeof(float))) return false;
+	render_params_c frame_params = params;
+	if(tuned) profile.apply(frame_params);
+	if(!use_lightmap(scene, frame_params, lightmap)) return false;
+	arena.reset();
+	render_frame(scene, frame_params, pixels, stride, arena, frame_history());
+	return true;
+}
+
+float raytracer_c::render_progressive(const render_params_c &params, uchar *pixels, cuint stride, const progressive_c &progressive) {
+	if(!check(params, stride, sizeof(uchar))) return -1;
+	render_params_c frame_params = params;
+	if(tuned) profile.apply(frame_params);
+	if(!use_lightmap(scene, frame_params, lightmap)) return -1;
+	arena.reset();
+	return ::render_progressive(scene, frame_params, pixels, stride, arena, progressive);
+}
+
+float raytracer_c::render_progressive(const render_params_c &params, float *pixels, cuint stride, const progressive_c &progressive) {
+	if(!check(params, stride, sizeof(float))) return -1;
+	render_params_c frame_params = params;
+	if(tuned) profile.apply(frame_params);
+	if(!use_lightmap(scene, frame_params, lightmap)) return -1;
+	arena.reset();
+	return ::render_progressive(scene, frame_params, pixels, stride, arena, progressive);
+}
+
+void raytracer_c::reuse_hits(const bool reuse) {
+	history->reuse = reuse;
+}
+
+void raytracer_c::track_edits(const bool track) {
+	tracking = track;
+}
+
+bool raytracer_c::edit_heights(cuint x1, cuint x2, cuint z1, cuint z2, cfloat *heights) {
+	if(scene.terrain != NULL) {
+		std::cout << "The paged terrain can't be edited!" << std::endl;
+		return false;
+	}
+	cube_c changed;
+	if(!scene.edit(x1, x2, z1, z2, heights, changed)) return false;
+	history->edit(changed);
+	return true;
+}
+
+terrain_stats_c raytracer_c::get_terrain_stats() const {
+	return terrain.stats();
+}
+
+float raytracer_c::get_reuse_rate() const {
+	if(history->reused + history->traced == 0) return 0;
+	return float(history->reused) / float(history->reused + history->traced);
+}
+
+const scene_c &raytracer_c::get_scene() const {
+	return scene;
+}
+
+void raytracer_c::report() const {
+	arena.report();
+	#ifdef OUTPUT
+		if(scene.terrain != NULL) {
+			const terrain_stats_c stats = terrain.stats();
+			const uint64_t asked = stats.hits + stats.misses;
+			std::cout << "Terrain cache: " << (asked == 0 ? 0 : int(stats.hits * 100.0 / asked + 0.5)) << "% of " << asked << " chunks hit, ";
+			std::cout << stats.bytes / 1024 << " KB paged, " << int(stats.stall + 0.5) << " ms stalled, " << terrain.cache_memory() / 1024 << " KB of cache" << std::endl;
+			size_t resident, peak;
+			if(process_memory(resident, peak)) std::cout << "Process memory: " << resident / 1024 << " KB resident, " << peak / 1024 << " KB at peak" << std::endl;
+		}
+	#endif
+}
@@ -0,0 +1,67 @@
+/** raytracer.hpp **/
+
+#ifndef RAYTRACER_HPP
+#define RAYTRACER_HPP
+
+//This is the interface of libraytracer.a for programs that render frames themselves
+//	raytracer_c renderer;
+//	if(!renderer.load()) ...
+//	render_params_c params; //The defaults render the same frame as the program does
+//	params.camera_x = ...;
+//	renderer.render(params, pixels, stride);
+//The pixels are written straight into the buffer given by the caller and nothing is copied or kept after render returns
+//The memory used while rendering comes from an arena that is kept for the next frame
+//The traced frame is only kept when it is asked for with reuse_hits or track_edits, or after an edit, as copying it isn't free
+
+#include "global.hpp"
+#include "scene.hpp"
+#include "render.hpp"
+#include "arena.hpp"
+#include "lightmap.hpp"
+#include "terrain.hpp"
+#include "tune.hpp"
+
+class raytracer_c {
+	private:
+		scene_c scene;
+		arena_c arena;
+		history_c *history;
+		lightmap_c lightmap; //For the frames with baked light
+		terrain_c terrain;
+		tune_profile_c profile; //The settings saved by --tune
+		bool tuned;
+		bool tracking; //Keep every frame for the edits
+		bool check(const render_params_c &params, cuint stride, cuint pixel_size) const;
+		history_c *frame_history();
+		void loaded();
+	public:
+		raytracer_c();
+		~raytracer_c();
+		bool load(); //Maps the scene from the cache or builds it and uses the settings in TUNE_PROFILE if they were tuned for it
+		//8 bit RGB, (width / scale_down) x (height / scale_down) pixels with rows stride bytes apart starting from the bottom row
+		bool render(const render_params_c &params, uchar *pixels, cuint stride);
+		//The same with high dynamic range float RGB that hasn't been clamped
+		bool render(const render_params_c &params, float *pixels, cuint stride);
+		//Renders in passes that trace more and more pixels, see progressive_c, and writes every pass into pixels
+		//Returns the share of the pixels traced or a negative value if the frame failed or was cancelled before the first pass was done
+		float render_progressive(const render_params_c &params, uchar *pixels, cuint stride, const progressive_c &progressive);
+		float render_progressive(const render_params_c &params, float *pixels, cuint stride, const progressive_c &progressive);
+		//Reuse the primary hits of the last frame for the next one which saves most rays when the camera moves slowly
+		void reuse_hits(const bool reuse);
+		//Keep every frame so that the first frame after an edit already only traces the pixels the edit can change
+		//Without it the frames are kept only from the first frame after an edit until a frame without an edit
+		void track_edits(const bool track);
+		//Changes the heights of the scene from x1, z1 to x2, z2 (not included), see scene_c::edit
+		//The next frame with the same view as the last one only traces the pixels the edit can change
+		bool edit_heights(cuint x1, cuint x2, cuint z1, cuint z2, cfloat *heights);
+		//Traces the rays through the terrain split into chunks in TERRAIN_FILE that are loaded as rays enter them instead of loading the scene, see scene_c::load_paged
+		//The file is written from the heightmap a row at a time first if it is missing or was split from other inputs
+		//The paged terrain has no border and can't be edited
+		bool load_paged(cuint cache_chunks);
+		terrain_stats_c get_terrain_stats() const;
+		float get_reuse_rate() const; //The share of primary rays of the last frame that were reused
+		const scene_c &get_scene() const;
+		void report() const; //Prints the memory used while rendering and what the terrain cache did
+};
+
+#endif
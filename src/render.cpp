@@ -0,0 +1,1146 @@
+/** render.cpp **/
+
+#include "render.hpp"
+#include "cast_ray.hpp"
+#include "parallel.hpp"
+#include "math.hpp"
+#include "lightmap.hpp"
+#include "shade.hpp"
+#include "half.hpp"
+#include "terrain.hpp"
+#include "ray_stream.hpp"
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <mutex>
+#include <chrono>
+
+#define SKY_DEPTH 1000000 //Depth of the pixels where the ray doesn't hit anything
+#define REUSE_DEPTH_RANGE 1.1 //Squared distance a reused hit may be farther than the hit projected on the pixel
+#define REUSE_EDGE 2 //Pixels around a pixel whose projected hits must all be at about the same depth for the pixel to reuse a hit
+#define REUSE_EDGE_RANGE 1.05 //Squared distance the farthest projected hit around the pixel may be from the closest
+
+render_params_c::render_params_c():
+		camera_x(128), camera_y(128), camera_z(192),
+		target_x(16), target_y(-64), target_z(80),
+		right_x(0.85 * 192.0), right_y(0), right_z(0),
+		up_x(0), up_y(128), up_z(0),
+		sun_x(15), sun_y(-7), sun_z(-5),
+		width(FINAL_X), height(FINAL_Y), scale_down(FINAL_SCALE_DOWN),
+		flags(FLAG_ALL), threads(0), tile(0), progress(false), baked(false), lightmap(NULL), half_frame(false), ray_streams(false) {}
+
+//The target plane is placed as far from the camera and made as big as the default one is
+void render_params_c::look_at(cfloat x, cfloat y, cfloat z) {
+	cfloat distance = sqrt(30.4 * 30.4 + 128.0 * 128.0 + 112.0 * 112.0);
+	float fx = x - camera_x;
+	float fy = y - camera_y;
+	float fz = z - camera_z;
+	cfloat fl = sqrt(fx * fx + fy * fy + fz * fz);
+	if(fl == 0) return;
+	fx/= fl;
+	fy/= fl;
+	fz/= fl;
+	//right = forward x {0, 1, 0}
+	float rx = -fz;
+	float rz = fx;
+	cfloat rl = sqrt(rx * rx + rz * rz);
+	if(rl == 0) return; //Looking straight up or down
+	rx/= rl;
+	rz/= rl;
+	//up = right x forward
+	cfloat ux = -rz * fy;
+	cfloat uy = rz * fx - rx * fz;
+	cfloat uz = rx * fy;
+	right_x = rx * 0.85 * 192.0;
+	right_y = 0;
+	right_z = rz * 0.85 * 192.0;
+	up_x = ux * 128.0;
+	up_y = uy * 128.0;
+	up_z = uz * 128.0;
+	target_x = camera_x + fx * distance - right_x / 2.0 - up_x / 2.0;
+	target_y = camera_y + fy * distance - right_y / 2.0 - up_y / 2.0;
+	target_z = camera_z + fz * distance - right_z / 2.0 - up_z / 2.0;
+}
+
+void render_params_c::sun_direction(float &x, float &y, float &z) const {
+	cfloat l = sqrt(sun_x * sun_x + sun_y * sun_y + sun_z * sun_z);
+	x = sun_x / l;
+	y = sun_y / l;
+	z = sun_z / l;
+}
+
+//All the buffers of a frame come from the frame arena
+//At most the depth buffer and three float images (or two and the four depth of field planes) are needed at once
+size_t frame_memory(const render_params_c &params) {
+	return (size_t)params.width * params.height * sizeof(float) * 11 + 8 * ARENA_ALIGN;
+}
+
+#ifdef CUBE_AMOUNT
+//Orders the cubes of a quad the ray enters by where it enters them
+static uint sort_quad(cuint hits, cfloat *entry, uchar *order) {
+	uint amount = 0;
+	for(uchar i=0;i<QUAD_SIZE;i++) {
+		if(!(hits & (1 << i))) continue;
+		uint j = amount++;
+		while(j > 0 && entry[order[j - 1]] > entry[i]) {
+			order[j] = order[j - 1];
+			j--;
+		}
+		order[j] = i;
+	}
+	return amount;
+}
+
+//Visits the cubes of the quad m on the level that the ray enters before best, nearest first
+//The polygons under the cubes of the lowest level are tested like in trace_primary; of two equally close polygons the first one is kept
+static void quad_primary(const scene_c &scene, cuint level, cuint m, cfloat J, cfloat K, cfloat L, cfloat x, cfloat y, cfloat z, cfloat ix, cfloat iy, cfloat iz,
+		float &best, float &hitx, float &hity, float &hitz, uint &hitpolygon) {
+	float entry[QUAD_SIZE];
+	uchar order[QUAD_SIZE];
+	cuint amount = sort_quad(scene.quads[level][m].test_ray(J, K, L, ix, iy, iz, best, entry), entry, order);
+	for(uint o=0;o<amount;o++) {
+		if(entry[order[o]] > best) break; //Something closer was hit in the cubes before
+		cuint cube = m * QUAD_SIZE + order[o];
+		if(level > 0) {
+			quad_primary(scene, level - 1, cube, J, K, L, x, y, z, ix, iy, iz, best, hitx, hity, hitz, hitpolygon);
+			continue;
+		}
+		float a, b, c, rx, ry, rz;
+		for(uint k=cube*4;k<cube*4+4&&k<scene.polygon_count;k++) {
+			if(cast_ray(scene.polygons[k], a, b, c, rx, ry, rz, J, K, L, x, y, z)) {
+				if(a >= 0 && b >= 0 && a + b <= 1 && c > 0 && (c < best || (c == best && k < hitpolygon))) {
+					best = c;
+					hitx = rx; hity = ry; hitz = rz; hitpolygon = k;
+				}
+			}
+		}
+	}
+}
+
+//Returns true if the ray hits any polygon other than skip under the cubes of the quad m on the level
+static bool quad_shadow(const scene_c &scene, cuint level, cuint m, cfloat J, cfloat K, cfloat L, cfloat x, cfloat y, cfloat z, cfloat ix, cfloat iy, cfloat iz, cuint skip) {
+	float entry[QUAD_SIZE];
+	uchar order[QUAD_SIZE];
+	cuint amount = sort_quad(scene.quads[level][m].test_ray(J, K, L, ix, iy, iz, QUAD_FAR, entry), entry, order);
+	for(uint o=0;o<amount;o++) {
+		cuint cube = m * QUAD_SIZE + order[o];
+		if(level > 0) {
+			if(quad_shadow(scene, level - 1, cube, J, K, L, x, y, z, ix, iy, iz, skip)) return true;
+			continue;
+		}
+		float a, b, c, rx, ry, rz;
+		for(uint k=cube*4;k<cube*4+4&&k<scene.polygon_count;k++) {
+			if(cast_ray(scene.polygons[k], a, b, c, rx, ry, rz, J, K, L, x, y, z)) {
+				if(a >= 0 && b >= 0 && a + b <= 1 && c > 0 && k != skip) return true;
+			}
+		}
+	}
+	return false;
+}
+#endif
+
+//Finds the closest polygon of the scene in memory the ray hits
+static bool trace_polygons(const scene_c &scene, cfloat J, cfloat K, cfloat L, cfloat x, cfloat y, cfloat z, float &hitx, float &hity, float &hitz, uint &hitpolygon) {
+	float a, b, c, rx, ry, rz;
+	float best = 1000;
+	#ifdef CUBE_AMOUNT
+		if(scene.quad_test && scene.cube_levels > 0) {
+			cuint top = scene.cube_levels - 1;
+			hitpolygon = NO_HIT;
+			for(uint m=0;m<scene.quad_count[top];m++) quad_primary(scene, top, m, J, K, L, x, y, z, 1.0 / (x - J), 1.0 / (y - K), 1.0 / (z - L), best, hitx, hity, hitz, hitpolygon);
+			return best < 999;
+		}
+	#endif
+	for(uint k=0;k<scene.polygon_count;k++) { //polygons
+		bool cast = true;
+		//Check cube collisions to skip polygons
+		#ifdef CUBE_AMOUNT
+			for(int l=(int)scene.cube_levels-1;l>=0;l--) {
+				cuint div = uint(4) << (l * 2);
+				if(k % div == 0) {
+					if(!scene.cubes[l][k / div].test_hit(J, K, L, x, y, z)) {
+						k+= div - 1;
+						cast = false;
+						l = -1;
+					}
+				}
+			}
+		#endif
+		//Now check the polygon collision
+		if(cast) {
+			if(cast_ray(scene.polygons[k], a, b, c, rx, ry, rz, J, K, L, x, y, z)) {
+				if(a >= 0 && b >= 0 && a + b <= 1 && c < best && c > 0) { //A polygon, that is closer to the camera than any other polygon so far, is hitting the ray
+					best = c;
+					hitx = rx; hity = ry; hitz = rz; hitpolygon = k;
+				}
+			}
+		}
+	}
+	return best < 999;
+}
+
+//Finds the closest polygon the ray from J, K, L towards x, y, z hits
+//Returns false if the ray doesn't hit anything
+//The tangent frame of the polygon hit is written into frame if it isn't NULL
+bool trace_primary(const scene_c &scene, cfloat J, cfloat K, cfloat L, cfloat x, cfloat y, cfloat z, float &hitx, float &hity, float &hitz, uint &hitpolygon, tangent_frame_c *frame) {
+	if(scene.terrain != NULL) return scene.terrain->trace_primary(J, K, L, x, y, z, hitx, hity, hitz, hitpolygon, frame);
+	const bool hit = trace_polygons(scene, J, K, L, x, y, z, hitx, hity, hitz, hitpolygon);
+	if(hit && frame != NULL) *frame = scene.polygons[hitpolygon];
+	return hit;
+}
+
+//Tests only the polygon the pixel hit in the last frame; the polygons must be in memory
+//A hit on an edge of the polygon isn't reused as tracing the ray could give it to the polygon on the other side of the edge
+static bool reuse_primary(const scene_c &scene, cuint polygon, cfloat J, cfloat K, cfloat L, cfloat x, cfloat y, cfloat z, float &hitx, float &hity, float &hitz) {
+	float a, b, c;
+	return cast_ray(scene.polygons[polygon], a, b, c, hitx, hity, hitz, J, K, L, x, y, z) && a > 0 && b > 0 && a + b < 1 && c > 0;
+}
+
+//Tells if the projected hits around the pixel i, j are at different depths or missing, which is where a hill edge can hide a projected hit
+//	A polygon that wasn't seen in the last frame can be in front of the projected hit so the pixels at the edges are traced
+static bool reuse_edge(const history_c &history, cuint i, cuint j) {
+	float nearest = float(SKY_DEPTH) * SKY_DEPTH, farthest = 0;
+	for(uint m=j>REUSE_EDGE?j-REUSE_EDGE:0;m<=j+REUSE_EDGE&&m<history.height;m++) {
+		for(uint l=i>REUSE_EDGE?i-REUSE_EDGE:0;l<=i+REUSE_EDGE&&l<history.width;l++) {
+			if(history.candidates[m * history.width + l] == NO_HIT) return true;
+			cfloat depth = history.candidate_depths[m * history.width + l];
+			nearest = min(nearest, depth);
+			farthest = max(farthest, depth);
+		}
+	}
+	return farthest > nearest * REUSE_EDGE_RANGE;
+}
+
+//Returns true if any polygon other than hitpolygon is in the way of the sun
+bool trace_shadow(const scene_c &scene, cfloat hitx, cfloat hity, cfloat hitz, cuint hitpolygon, cfloat sunx, cfloat suny, cfloat sunz) {
+	if(scene.terrain != NULL) return scene.terrain->trace_shadow(hitx, hity, hitz, hitpolygon, sunx, suny, sunz);
+	float a, b, c, x, y, z;
+	#ifdef CUBE_AMOUNT
+		if(scene.quad_test && scene.cube_levels > 0) {
+			cuint top = scene.cube_levels - 1;
+			for(uint m=0;m<scene.quad_count[top];m++) {
+				if(quad_shadow(scene, top, m, hitx, hity + 0.01, hitz, hitx - sunx, hity - suny + 0.01, hitz - sunz, -1.0 / sunx, -1.0 / suny, -1.0 / sunz, hitpolygon)) return true;
+			}
+			return false;
+		}
+	#endif
+	for(uint k=0;k<scene.polygon_count;k++) { //polygons
+		bool cast = true;
+		#ifdef CUBE_AMOUNT
+			for(int l=(int)scene.cube_levels-1;l>=0;l--) {
+				cuint div = uint(4) << (l * 2);
+				if(k % div == 0) {
+					if(!scene.cubes[l][k / div].test_hit(hitx, hity + 0.01, hitz, hitx - sunx, hity - suny + 0.01, hitz - sunz)) {
+						k+= div - 1;
+						cast = false;
+						l = -1;
+					}
+				}
+			}
+		#endif
+		if(cast) {
+			if(cast_ray(scene.polygons[k], a, b, c, x, y, z, hitx, hity + 0.01, hitz, hitx - sunx, hity - suny + 0.01, hitz - sunz)) {
+				if(a >= 0 && b >= 0 && a + b <= 1 && c > 0 && k != hitpolygon) return true;
+			}
+		}
+	}
+	return false;
+}
+
+history_c::history_c(): width(0), height(0), polygons(NULL), hits(NULL), image(NULL), depth_buffer(NULL), candidates(NULL), candidate_depths(NULL),
+		valid(false), reuse(false), edited(false), reused(0), traced(0) {}
+
+history_c::~history_c() {
+	delete [] polygons;
+	delete [] hits;
+	delete [] image;
+	delete [] depth_buffer;
+	delete [] candidates;
+	delete [] candidate_depths;
+}
+
+//A history of different size is thrown away
+void history_c::resize(cuint frame_width, cuint frame_height) {
+	if(frame_width == width && frame_height == height) return;
+	delete [] polygons;
+	delete [] hits;
+	delete [] image;
+	delete [] depth_buffer;
+	delete [] candidates;
+	delete [] candidate_depths;
+	width = frame_width;
+	height = frame_height;
+	polygons = new uint[width * height];
+	hits = new float[width * height * 3];
+	image = new float[width * height * 3];
+	depth_buffer = new float[width * height];
+	candidates = new uint[width * height];
+	candidate_depths = new float[width * height];
+	valid = false;
+}
+
+//Projects every hit of the last frame onto the target plane of the new one
+//The pixel it lands on gets the polygon as a candidate unless a closer hit lands there too
+void history_c::reproject(const render_params_c &params) {
+	for(uint i=0;i<width*height;i++) candidates[i] = NO_HIT;
+	if(!valid) return;
+	for(uint i=0;i<width*height;i++) candidate_depths[i] = float(SKY_DEPTH) * SKY_DEPTH;
+	//camera + (hit - camera) * l = target + right * s + up * t is solved with Cramer's rule
+	cfloat ox = params.target_x - params.camera_x;
+	cfloat oy = params.target_y - params.camera_y;
+	cfloat oz = params.target_z - params.camera_z;
+	cfloat rx = params.right_x, ry = params.right_y, rz = params.right_z;
+	cfloat ux = params.up_x, uy = params.up_y, uz = params.up_z;
+	//(right x up) is used for every determinant
+	cfloat nx = ry * uz - rz * uy;
+	cfloat ny = rz * ux - rx * uz;
+	cfloat nz = rx * uy - ry * ux;
+	for(uint k=0;k<width*height;k++) {
+		if(polygons[k] == NO_HIT) continue;
+		cfloat dx = hits[k * 3] - params.camera_x;
+		cfloat dy = hits[k * 3 + 1] - params.camera_y;
+		cfloat dz = hits[k * 3 + 2] - params.camera_z;
+		cfloat det = dx * nx + dy * ny + dz * nz;
+		if(fabs(det) < 0.000001) continue;
+		cfloat l = (ox * nx + oy * ny + oz * nz) / det;
+		if(l <= 0) continue; //Behind the camera
+		//The point on the target plane relative to target
+		cfloat px = dx * l - ox;
+		cfloat py = dy * l - oy;
+		cfloat pz = dz * l - oz;
+		//s = (p . (up x n)) / (right . (up x n)) and t likewise
+		cfloat ax = uy * nz - uz * ny, ay = uz * nx - ux * nz, az = ux * ny - uy * nx;
+		cfloat bx = ny * rz - nz * ry, by = nz * rx - nx * rz, bz = nx * ry - ny * rx;
+		cfloat s = (px * ax + py * ay + pz * az) / (rx * ax + ry * ay + rz * az);
+		cfloat t = (px * bx + py * by + pz * bz) / (ux * bx + uy * by + uz * bz);
+		cint i = (int)floor(s * width + 0.5);
+		cint j = (int)floor(t * height + 0.5);
+		if(i < 0 || j < 0 || i >= (int)width || j >= (int)height) continue;
+		cfloat depth = dx * dx + dy * dy + dz * dz;
+		if(depth < candidate_depths[j * width + i]) {
+			candidate_depths[j * width + i] = depth;
+			candidates[j * width + i] = polygons[k];
+		}
+	}
+}
+
+//Everything the traced colors depend on is the same as in the last frame
+bool history_c::same_view(const render_params_c &frame_params) const {
+	const render_params_c &p = frame_params;
+	return p.camera_x == params.camera_x && p.camera_y == params.camera_y && p.camera_z == params.camera_z &&
+		p.target_x == params.target_x && p.target_y == params.target_y && p.target_z == params.target_z &&
+		p.right_x == params.right_x && p.right_y == params.right_y && p.right_z == params.right_z &&
+		p.up_x == params.up_x && p.up_y == params.up_y && p.up_z == params.up_z &&
+		p.sun_x == params.sun_x && p.sun_y == params.sun_y && p.sun_z == params.sun_z &&
+		p.width == params.width && p.height == params.height && p.flags == params.flags && p.baked == params.baked;
+}
+
+//Called for every edit of the scene so that the next frame traces the rays crossing it again
+void history_c::edit(const cube_c &box) {
+	if(edited) changed.add(box);
+	else changed = box;
+	edited = true;
+}
+
+//Colors a pixel of the row j whose ray doesn't hit anything
+static void sky_pixel(const render_params_c &params, cuint j, float *pixel, float &depth) {
+	pixel[0] = 255;
+	pixel[1] = uchar(mix(0, params.height, 0, 255, j));
+	pixel[2] = uchar(mix(0, params.height, 0, 128, j));
+	depth = SKY_DEPTH;
+}
+
+//Colors a pixel of the row j whose ray doesn't hit anything with the sky or adds the hit of the ray to the batch
+//A full batch is shaded right away and the rest of the hits must be shaded with shade_hits once the tile is done
+static void color_pixel(const scene_c &scene, const render_params_c &params, const bool hit, cfloat hitx, cfloat hity, cfloat hitz, cuint hitpolygon, const tangent_frame_c &frame, cuint j, cfloat sunx, cfloat suny, cfloat sunz, hit_batch_c &batch, float *pixel, float &depth) {
+	if(hit) { //The ray actually hits a polygon
+		float light, diffuse;
+		if(params.lightmap == NULL || !params.lightmap->lookup(hitx, hity, hitz, light, diffuse)) {
+			light = trace_shadow(scene, hitx, hity, hitz, hitpolygon, sunx, suny, sunz) ? 0 : 1;
+			diffuse = -1;
+		}
+		if(batch.add(hitx, hity, hitz, frame, light, diffuse, pixel, &depth)) shade_hits(scene, params, sunx, suny, sunz, batch);
+	}
+	else sky_pixel(params, j, pixel, depth);
+}
+
+	/** Trace rays and do all the rendering stuff **/
+//This thing shoots a ray from the viewer for every pixel from x1 to x2 and y1 to y2 in the image
+//After the position in which the ray hits a polygon has been determined:
+//	A ray is shot towards the direction of the sun lighting to check if other polygon occludes the sun
+//	Another ray is reflected by the surface normal, altered by normalmap, for phong shading
+//The texture coordinate is determined by the hit position and parallax mapping
+//The hits of a column are collected after tracing them and shaded in batches of SHADE_BATCH
+//The pixel x1, y1 is written at the beginning of image and depth_buffer and their rows are stride pixels long
+//The columns are split evenly between threads or taken tile columns at a time
+//With a history of the last frame the hits projected from it are tested first and the history is updated with the new hits
+//	If the view hasn't changed only the pixels whose primary or shadow rays can cross an edit of the scene are traced and the rest are copied
+void trace_frame(const scene_c &scene, const render_params_c &params, float *image, float *depth_buffer, cuint stride, cuint x1, cuint x2, cuint y1, cuint y2, history_c *history) {
+	//Direction for sun lighting
+	float sunx, suny, sunz;
+	params.sun_direction(sunx, suny, sunz);
+
+	cuint width = params.width;
+	cuint height = params.height;
+	bool keep = false, edited = false, reuse = false;
+	cube_c changed;
+	if(history != NULL) {
+		history->resize(width, height);
+		keep = history->valid && history->same_view(params);
+		edited = keep && history->edited;
+		if(edited) {
+			changed = history->changed;
+			//The light of a pixel comes from texels around it with baked light
+			if(params.lightmap != NULL) changed.grow((LIGHTMAP_FILTER + 1.0) / LIGHTMAP_SCALE + LIGHTMAP_TOLERANCE);
+		}
+		//The hits of the paged terrain aren't reused as their polygons aren't in memory
+		reuse = history->reuse && !keep && scene.terrain == NULL;
+		if(reuse) history->reproject(params);
+		history->reused = 0;
+		history->traced = 0;
+	}
+	uint done = 0;
+	char progress = 0;
+	std::mutex progress_mutex;
+	//Shades the hits left in the batch once the column i has been traced and keeps its colors in the history
+	const std::function<void(cuint i, hit_batch_c &batch)> finish_column = [&](cuint i, hit_batch_c &batch) {
+		shade_hits(scene, params, sunx, suny, sunz, batch);
+		if(history != NULL) {
+			for(uint j=y1;j<y2;j++) {
+				cuint id = ((j - y1) * stride + i - x1) * 3;
+				cuint k = j * width + i;
+				history->image[k * 3] = image[id];
+				history->image[k * 3 + 1] = image[id + 1];
+				history->image[k * 3 + 2] = image[id + 2];
+				history->depth_buffer[k] = depth_buffer[id / 3];
+			}
+		}
+		if(params.progress) {
+			std::lock_guard<std::mutex> lock(progress_mutex);
+			done++;
+			if(done * 10 / (x2 - x1) > (uint)progress) {
+				progress++;
+				#ifdef OUTPUT
+					std::cout.width(2);
+					std::cout << std::right << (int)progress << " / 10" << std::endl;
+				#endif
+			}
+		}
+	};
+	//The primary rays of a few columns at a time go into a stream and then the shadow rays of their hits into another one
+	//This is only done when every pixel is traced as the hits of the last frame are tried pixel by pixel
+	const bool streams = params.ray_streams && can_stream_rays(scene) && !keep && !reuse;
+	const std::function<void(cuint first, cuint last)> stream_columns = [&](cuint first, cuint last) {
+		cuint rows = y2 - y1;
+		cuint columns = rows < RAY_STREAM_SIZE ? RAY_STREAM_SIZE / rows : 1;
+		ray_stream_c primary, shadow;
+		std::vector<uint> shadows(columns * rows); //The shadow ray of every hit or NO_HIT if the lightmap gave the light
+		std::vector<float> lights(columns * rows), diffuses(columns * rows); //diffuses is negative where there is no baked diffuse light
+		hit_batch_c batch;
+		for(uint c1=x1+first;c1<x1+last;c1+=columns) {
+			cuint c2 = std::min(c1 + columns, x1 + last);
+			primary.clear();
+			for(uint i=c1;i<c2;i++) {
+				cfloat column = (float)i / (float)width;
+				for(uint j=y1;j<y2;j++) {
+					cfloat row = (float)j / (float)height;
+					cfloat x = params.target_x + params.right_x * column + params.up_x * row;
+					cfloat y = params.target_y + params.right_y * column + params.up_y * row;
+					cfloat z = params.target_z + params.right_z * column + params.up_z * row;
+					primary.add(params.camera_x, params.camera_y, params.camera_z, x, y, z, 1.0 / (x - params.camera_x), 1.0 / (y - params.camera_y), 1.0 / (z - params.camera_z));
+				}
+			}
+			primary.trace_primary(scene);
+			shadow.clear();
+			for(uint r=0;r<primary.count;r++) {
+				shadows[r] = NO_HIT;
+				if(!primary.hit[r]) continue;
+				cfloat hitx = primary.hit_x[r], hity = primary.hit_y[r], hitz = primary.hit_z[r];
+				if(params.lightmap != NULL && params.lightmap->lookup(hitx, hity, hitz, lights[r], diffuses[r])) continue;
+				diffuses[r] = -1;
+				shadows[r] = shadow.add(hitx, hity + 0.01, hitz, hitx - sunx, hity - suny + 0.01, hitz - sunz, -1.0 / sunx, -1.0 / suny, -1.0 / sunz, primary.hit_polygon[r]);
+			}
+			shadow.trace_shadow(scene);
+			for(uint i=c1;i<c2;i++) {
+				for(uint j=y1;j<y2;j++) {
+					cuint r = (i - c1) * rows + j - y1;
+					cuint id = ((j - y1) * stride + i - x1) * 3;
+					if(history != NULL) {
+						cuint k = j * width + i;
+						history->polygons[k] = primary.hit[r] ? primary.hit_polygon[r] : NO_HIT;
+						history->hits[k * 3] = primary.hit_x[r];
+						history->hits[k * 3 + 1] = primary.hit_y[r];
+						history->hits[k * 3 + 2] = primary.hit_z[r];
+					}
+					if(!primary.hit[r]) {
+						sky_pixel(params, j, image + id, depth_buffer[id / 3]);
+						continue;
+					}
+					if(shadows[r] != NO_HIT) lights[r] = shadow.hit[shadows[r]] ? 0 : 1;
+					if(batch.add(primary.hit_x[r], primary.hit_y[r], primary.hit_z[r], scene.polygons[primary.hit_polygon[r]], lights[r], diffuses[r], image + id, depth_buffer + id / 3)) shade_hits(scene, params, sunx, suny, sunz, batch);
+				}
+				finish_column(i, batch);
+			}
+		}
+		if(history != NULL) {
+			std::lock_guard<std::mutex> lock(progress_mutex);
+			history->traced+= (last - first) * (y2 - y1);
+		}
+	};
+	const std::function<void(cuint first, cuint last)> trace_columns = [&](cuint first, cuint last) {
+		if(streams) {
+			stream_columns(first, last);
+			return;
+		}
+		uint reused = 0;
+		hit_batch_c batch; //The hits of a column are shaded together after tracing them
+		for(uint i=x1+first;i<x1+last;i++) {
+			cfloat column = (float)i / (float)width;
+			for(uint j=y1;j<y2;j++) {
+				cfloat row = (float)j / (float)height;
+				cfloat x = params.target_x + params.right_x * column + params.up_x * row;
+				cfloat y = params.target_y + params.right_y * column + params.up_y * row;
+				cfloat z = params.target_z + params.right_z * column + params.up_z * row;
+				float hitx = 0, hity = 0, hitz = 0;
+				uint hitpolygon = 0;
+				cuint id = ((j - y1) * stride + i - x1) * 3;
+				cuint k = j * width + i;
+				if(keep) {
+					bool kept = !edited;
+					if(edited && !changed.test_ray(params.camera_x, params.camera_y, params.camera_z, x, y, z)) {
+						cfloat *last = history->hits + k * 3;
+						kept = history->polygons[k] == NO_HIT || !changed.test_ray(last[0], last[1] + 0.01, last[2], last[0] - sunx, last[1] - suny + 0.01, last[2] - sunz);
+					}
+					if(kept) {
+						image[id] = history->image[k * 3];
+						image[id + 1] = history->image[k * 3 + 1];
+						image[id + 2] = history->image[k * 3 + 2];
+						depth_buffer[id / 3] = history->depth_buffer[k];
+						reused++;
+						continue;
+					}
+				}
+				bool hit = false;
+				if(reuse && !reuse_edge(*history, i, j)) {
+					//The hits projected next to the pixel are tried too as the projection leaves small gaps
+					uint tried[5];
+					tried[0] = history->candidates[j * width + i];
+					tried[1] = history->candidates[j * width + (i > 0 ? i - 1 : i)];
+					tried[2] = history->candidates[j * width + (i + 1 < width ? i + 1 : i)];
+					tried[3] = history->candidates[(j > 0 ? j - 1 : j) * width + i];
+					tried[4] = history->candidates[(j + 1 < height ? j + 1 : j) * width + i];
+					for(uchar k=0;k<5&&!hit;k++) {
+						if(tried[k] == NO_HIT || (k > 0 && tried[k] == tried[k - 1])) continue;
+						if(reuse_primary(scene, tried[k], params.camera_x, params.camera_y, params.camera_z, x, y, z, hitx, hity, hitz)) {
+							//A hit much farther than what was projected on the pixel is likely hidden behind it
+							cfloat dx = hitx - params.camera_x, dy = hity - params.camera_y, dz = hitz - params.camera_z;
+							if(dx * dx + dy * dy + dz * dz > history->candidate_depths[j * width + i] * REUSE_DEPTH_RANGE) continue;
+							hitpolygon = tried[k];
+							hit = true;
+							reused++;
+						}
+					}
+				}
+				tangent_frame_c frame;
+				if(hit) frame = scene.polygons[hitpolygon];
+				else hit = trace_primary(scene, params.camera_x, params.camera_y, params.camera_z, x, y, z, hitx, hity, hitz, hitpolygon, &frame);
+				if(history != NULL) {
+					history->polygons[k] = hit ? hitpolygon : NO_HIT;
+					history->hits[k * 3] = hitx;
+					history->hits[k * 3 + 1] = hity;
+					history->hits[k * 3 + 2] = hitz;
+				}
+				color_pixel(scene, params, hit, hitx, hity, hitz, hitpolygon, frame, j, sunx, suny, sunz, batch, image + id, depth_buffer[id / 3]);
+			}
+			finish_column(i, batch);
+		}
+		if(history != NULL) {
+			std::lock_guard<std::mutex> lock(progress_mutex);
+			history->reused+= reused;
+			history->traced+= (last - first) * (y2 - y1) - reused;
+		}
+	};
+	if(params.tile > 0) parallel_blocks(x2 - x1, params.tile, trace_columns, params.threads);
+	else parallel_rows(x2 - x1, trace_columns, params.threads);
+	if(history != NULL) {
+		history->valid = true;
+		history->params = params;
+		history->edited = false;
+	}
+}
+
+//Fix depth buffer
+//Sometimes there are seams in between the polygons where the ray doesn't hit any polygons which causes single deep spots in the depth buffer
+//This removes those spots in the depth buffer for better result in depth of field calculation
+static void fix_depth_buffer(const render_params_c &params, float *depth_buffer) {
+	cuint width = params.width;
+	cuint height = params.height;
+	for(uint i=0;i<width;i++) {
+		for(uint j=0;j<height;j++) {
+			if(depth_buffer[j * width + i] > SKY_DEPTH - 1) {
+				uchar sum1 = 0;
+				float sum = 0;
+				float div = 0;
+				for(char k=-1;k<=1;k++) {
+					for(char l=-1;l<=1;l++) {
+						cuint x = clampi(i + k, 0, width - 1);
+						cuint y = clampi(j + l, 0, height - 1);
+						if(depth_buffer[y * width + x] < SKY_DEPTH - 1) {
+							sum1++;
+							sum+= depth_buffer[y * width + x];
+							div++;
+						}
+					}
+				}
+				if(sum1 >= 7) depth_buffer[j * width + i] = sum / div;
+			}
+		}
+	}
+}
+
+	/** Antialiasing **/
+//This is a pretty cheap way of antialiasing that basically blurs the image a bit
+template <class T> void antialias(const render_params_c &params, T *image, T *temp_image) {
+	cuint width = params.width;
+	cuint height = params.height;
+	cfloat mult1 = sqrt(32.0);
+	cfloat mult2 = sqrt(1.6);
+	cfloat mult3 = 2.0 / sqrt(18.0);
+	for(uint i=0;i<width;i++) {
+		for(uint j=0;j<height;j++) {
+			float sum_r = 0, sum_g = 0, sum_b = 0;
+			float div = 0;
+			for(char k=-1;k<=1;k++) {
+				for(char l=-1;l<=1;l++) {
+					cuint x = clampi(i + k, 0, width - 1);
+					cuint y = clampi(j + l, 0, height - 1);
+					cchar dist = abs(k) + abs(l);
+					cfloat mult = dist ? (dist == 1 ? mult2 : mult3) : mult1;
+					sum_r+= image[(y * width + x) * 3] * mult;
+					sum_g+= image[(y * width + x) * 3 + 1] * mult;
+					sum_b+= image[(y * width + x) * 3 + 2] * mult;
+					div+= mult;
+				}
+			}
+			temp_image[(j * width + i) * 3] = sum_r / div;
+			temp_image[(j * width + i) * 3 + 1] = sum_g / div;
+			temp_image[(j * width + i) * 3 + 2] = sum_b / div;
+		}
+	}
+	memcpy(image, temp_image, width * height * 3 * sizeof(T));
+}
+
+	/** Depth of field **/
+#define DOF_START 160.0
+#define DOF_END 500.0
+#define DOF_AMOUNT 2.5
+#define DOF_MAX 4.0
+#define DOF_ACC 15
+//depth_start is subtracted from depth_buffer to get how far past DOF_START the pixels are
+template <class T> void depth_of_field(const render_params_c &params, T *image, const T *depth_buffer, cfloat depth_start, T *temp_image, arena_c &arena) {
+	cuint width = params.width;
+	cuint height = params.height;
+	const size_t dof_mark = arena.mark();
+	T *sum_r1 = arena.alloc<T>(width * height);
+	T *sum_g1 = arena.alloc<T>(width * height);
+	T *sum_b1 = arena.alloc<T>(width * height);
+	T *div1 = arena.alloc<T>(width * height);
+	for(uint i=0;i<width;i++) {
+		for(uint j=0;j<height;j++) {
+			cfloat depth = depth_buffer[j * width + i] - depth_start;
+			cuint id1 = j * width + i;
+			float sum_r = 0;
+			float sum_g = 0;
+			float sum_b = 0;
+			float div = 0;
+			if(depth > 0) {
+				for(char k=-DOF_ACC;k<=DOF_ACC;k++) {
+					cuint x = clampi(i + k, 0, width - 1);
+					cfloat depth2 = depth_buffer[j * width + x] - depth_start;
+					if(depth2 > 0) {
+						cfloat dof_amount = clampf(mix(0, DOF_END - DOF_START, 0, DOF_AMOUNT, depth2), 0, DOF_MAX);
+						cfloat mult = 1.0 / (fabs((float)k / dof_amount) + 1.0);
+						cuint id = (j * width + x) * 3;
+						sum_r+= image[id] * mult;
+						sum_g+= image[id + 1] * mult;
+						sum_b+= image[id + 2] * mult;
+						div+= mult;
+					}
+				}
+			}
+			sum_r1[id1] = sum_r;
+			sum_g1[id1] = sum_g;
+			sum_b1[id1] = sum_b;
+			div1[id1] = div;
+		}
+	}
+	for(uint i=0;i<width;i++) {
+		for(uint j=0;j<height;j++) {
+			cfloat depth = depth_buffer[j * width + i] - depth_start;
+			if(depth > 0) {
+				float sum_r = 0;
+				float sum_g = 0;
+				float sum_b = 0;
+				float div = 0;
+				for(char k=-DOF_ACC;k<=DOF_ACC;k++) {
+					cuint y = clampi(j + k, 0, height - 1);
+					cfloat depth2 = depth_buffer[y * width + i] - depth_start;
+					if(depth2 > 0) {
+						cfloat dof_amount = clampf(mix(0, DOF_END - DOF_START, 0, DOF_AMOUNT, depth2), 0, DOF_MAX);
+						cfloat mult = 1.0 / (fabs((float)k / dof_amount) + 1.0);
+						cuint id = y * width + i;
+						sum_r+= sum_r1[id] * mult;
+						sum_g+= sum_g1[id] * mult;
+						sum_b+= sum_b1[id] * mult;
+						div+= div1[id] * mult;
+					}
+				}
+				cuint id = (j * width + i) * 3;
+				temp_image[id] = sum_r / div;
+				temp_image[id + 1] = sum_g / div;
+				temp_image[id + 2] = sum_b / div;
+			}
+			else {
+				cuint id = (j * width + i) * 3;
+				temp_image[id] = image[id];
+				temp_image[id + 1] = image[id + 1];
+				temp_image[id + 2] = image[id + 2];
+			}
+		}
+	}
+	arena.rewind(dof_mark);
+	//Apply dof
+	memcpy(image, temp_image, width * height * 3 * sizeof(T));
+}
+
+	/** Bloom **/
+//Bloom makes everything look better, always.
+#define BLOOM_SIZE 12.0
+#define CONTRAST_AMOUNT 1.4
+#define BLOOM_AMOUNT 0.5
+#define DARKNESS 70.0
+template <class T> void bloom(const render_params_c &params, T *image, T *temp_image, arena_c &arena) {
+	cuint width = params.width;
+	cuint height = params.height;
+	cuint size = width * height * 3;
+	//Copy the image into temp_image for bloom operations; also add contrast
+	for(uint i=0;i<size;i++) temp_image[i] = (image[i] - 0.5) * CONTRAST_AMOUNT + 0.5;
+	const size_t bloom_mark = arena.mark();
+	T *temp_image2 = arena.alloc<T>(size);
+	//Blur
+	for(uint i=0;i<width;i++) {
+		for(uint j=0;j<height;j++) {
+			float sum_r = 0;
+			float sum_g = 0;
+			float sum_b = 0;
+			float div = 0;
+			for(char k=-(char)ceil(BLOOM_SIZE);k<(char)ceil(BLOOM_SIZE);k++) {
+				cuint x = clampi(i + k, 0, width - 1);
+				cfloat mult = 1.0 / (fabs((float)k / BLOOM_SIZE) + 1.0);
+				cuint id = (j * width + x) * 3;
+				sum_r+= temp_image[id] * mult;
+				sum_g+= temp_image[id + 1] * mult;
+				sum_b+= temp_image[id + 2] * mult;
+				div+= mult;
+			}
+			cuint id = (j * width + i) * 3;
+			temp_image2[id] = sum_r / div;
+			temp_image2[id + 1] = sum_g / div;
+			temp_image2[id + 2] = sum_b / div;
+		}
+	}
+	for(uint i=0;i<width;i++) {
+		for(uint j=0;j<height;j++) {
+			float sum_r = 0;
+			float sum_g = 0;
+			float sum_b = 0;
+			float div = 0;
+			for(char k=-(char)ceil(BLOOM_SIZE);k<(char)ceil(BLOOM_SIZE);k++) {
+				cuint y = clampi(j + k, 0, height - 1);
+				cfloat mult = 1.0 / (fabs((float)k / BLOOM_SIZE) + 1.0);
+				cuint id = (y * width + i) * 3;
+				sum_r+= temp_image2[id] * mult;
+				sum_g+= temp_image2[id + 1] * mult;
+				sum_b+= temp_image2[id + 2] * mult;
+				div+= mult;
+			}
+			cuint id = (j * width + i) * 3;
+			temp_image[id] = sum_r / div;
+			temp_image[id + 1] = sum_g / div;
+			temp_image[id + 2] = sum_b / div;
+		}
+	}
+	arena.rewind(bloom_mark);
+	//Apply bloom
+	for(uint i=0;i<size;i++) image[i] = image[i] + temp_image[i] * BLOOM_AMOUNT - DARKNESS;
+}
+
+//Runs the post processing passes that are enabled with the frame stored as T
+template <class T> void post_passes(const render_params_c &params, T *image, const T *depth_buffer, cfloat depth_start, arena_c &arena) {
+	T *temp_image = arena.alloc<T>(params.width * params.height * 3);
+	if(params.flags & FLAG_ANTIALIASING) {
+		#ifdef OUTPUT
+			if(params.progress) std::cout << "Applying antialiasing" << std::endl;
+		#endif
+		arena.stage("Antialiasing");
+		antialias(params, image, temp_image);
+	}
+	if(params.flags & FLAG_DOF) {
+		#ifdef OUTPUT
+			if(params.progress) std::cout << "Applying depth of field" << std::endl;
+		#endif
+		arena.stage("Depth of field");
+		depth_of_field(params, image, depth_buffer, depth_start, temp_image, arena);
+	}
+	if(params.flags & FLAG_BLOOM) {
+		#ifdef OUTPUT
+			if(params.progress) std::cout << "Applying bloom" << std::endl;
+		#endif
+		arena.stage("Bloom");
+		bloom(params, image, temp_image, arena);
+	}
+}
+
+//Runs all the post processing passes that are enabled on a fully traced frame
+//With half_frame the passes read and write half floats, which halves the memory they go through, and the result is turned back into floats
+void post_process(const render_params_c &params, float *image, float *depth_buffer, arena_c &arena) {
+	fix_depth_buffer(params, depth_buffer);
+	if(!(params.flags & (FLAG_ANTIALIASING | FLAG_DOF | FLAG_BLOOM))) return;
+	const size_t arena_mark = arena.mark();
+	if(params.half_frame) {
+		cuint pixels = params.width * params.height;
+		half_c *half_image = arena.alloc<half_c>(pixels * 3);
+		half_c *half_depth = arena.alloc<half_c>(pixels);
+		for(uint i=0;i<pixels*3;i++) half_image[i] = image[i];
+		//Only the depth past DOF_START matters so that is stored to keep the most precision where the blurring starts
+		//The sky is farther than a half float reaches but everything past DOF_END is blurred the same
+		for(uint i=0;i<pixels;i++) half_depth[i] = min(depth_buffer[i] - float(DOF_START), HALF_MAX);
+		post_passes(params, half_image, half_depth, 0, arena);
+		for(uint i=0;i<pixels*3;i++) image[i] = half_image[i];
+	}
+	else post_passes(params, image, depth_buffer, DOF_START, arena);
+	arena.rewind(arena_mark);
+}
+
+inline void store_pixel(uchar &out, cfloat value) {
+	out = uchar(clampf(value, 0, 255));
+}
+
+inline void store_pixel(float &out, cfloat value) {
+	out = value;
+}
+
+	/** Scale down the high precision image into low precision image **/
+//This also works as a proper way of antialiasing
+//The rows of final are stride bytes apart
+template <class T> void scale_down_frame(const render_params_c &params, cfloat *image, T *final, cuint stride) {
+	cuint width = params.width;
+	cuint scale = params.scale_down;
+	for(uint i=0;i<params.width/scale;i++) {
+		for(uint j=0;j<params.height/scale;j++) {
+			float sum_r = 0;
+			float sum_g = 0;
+			float sum_b = 0;
+			for(uint k=0;k<scale;k++) {
+				for(uint l=0;l<scale;l++) {
+					cuint pos = ((j * scale + l) * width + i * scale + k) * 3;
+					sum_r+= image[pos];
+					sum_g+= image[pos + 1];
+					sum_b+= image[pos + 2];
+				}
+			}
+			T *pixel = (T*)((uchar*)final + (size_t)j * stride) + i * 3;
+			store_pixel(pixel[0], sum_r / float(scale * scale));
+			store_pixel(pixel[1], sum_g / float(scale * scale));
+			store_pixel(pixel[2], sum_b / float(scale * scale));
+		}
+	}
+}
+
+void finish_frame(const render_params_c &params, cfloat *image, uchar *final, cuint stride) {
+	scale_down_frame(params, image, final, stride);
+}
+
+//Same as above but keeps the high dynamic range colors
+void finish_frame(const render_params_c &params, cfloat *image, float *final, cuint stride) {
+	scale_down_frame(params, image, final, stride);
+}
+
+//Traces and post processes a frame into image which must have room for width x height RGB floats
+static void render_image(const scene_c &scene, const render_params_c &params, float *image, arena_c &arena, history_c *history) {
+	const size_t arena_mark = arena.mark();
+	float *depth_buffer = arena.alloc<float>(params.width * params.height);
+	#ifdef OUTPUT
+		if(params.progress) std::cout << "Tracing rays" << std::endl;
+	#endif
+	trace_frame(scene, params, image, depth_buffer, params.width, 0, params.width, 0, params.height, history);
+	post_process(params, image, depth_buffer, arena);
+	#ifdef OUTPUT
+		if(params.progress) std::cout << "Saving the final image" << std::endl;
+	#endif
+	arena.rewind(arena_mark);
+}
+
+//Renders a whole frame into final which must have room for (width / scale_down) x (height / scale_down) RGB pixels with rows stride bytes apart
+//All the memory needed comes from the arena and is freed back into it before returning
+void render_frame(const scene_c &scene, const render_params_c &params, uchar *final, cuint stride, arena_c &arena, history_c *history) {
+	const size_t arena_mark = arena.mark();
+	arena.stage("Tracing rays");
+	//Data for more accurate color calculations and high dynamic range colors
+	float *image = arena.alloc<float>(params.width * params.height * 3);
+	render_image(scene, params, image, arena, history);
+	arena.stage("Scaling down");
+	finish_frame(params, image, final, stride);
+	arena.rewind(arena_mark);
+}
+
+//Same as above but the high dynamic range colors are kept
+//A frame that is not scaled down and has tightly packed rows is rendered straight into final
+void render_frame(const scene_c &scene, const render_params_c &params, float *final, cuint stride, arena_c &arena, history_c *history) {
+	arena.stage("Tracing rays");
+	if(params.scale_down == 1 && stride == params.width * 3 * sizeof(float)) {
+		render_image(scene, params, final, arena, history);
+		return;
+	}
+	const size_t arena_mark = arena.mark();
+	float *image = arena.alloc<float>(params.width * params.height * 3);
+	render_image(scene, params, image, arena, history);
+	arena.stage("Scaling down");
+	finish_frame(params, image, final, stride);
+	arena.rewind(arena_mark);
+}
+
+progressive_c::progressive_c(): budget(0), samples(0), cancel(NULL) {}
+
+//Traces the pixels of a pass of a progressive frame: every step:th pixel in both directions that no earlier pass has traced
+//The columns are split between threads and the pass stops between columns once out gives false
+//Returns false if the pass wasn't finished
+static bool trace_pass(const scene_c &scene, const render_params_c &params, float *image, float *depth_buffer, uchar *traced, cuint step, std::atomic<uint> &samples, const std::function<bool()> &out) {
+	float sunx, suny, sunz;
+	params.sun_direction(sunx, suny, sunz);
+	cuint width = params.width;
+	cuint height = params.height;
+	std::atomic<bool> stopped(false);
+	parallel_rows((width + step - 1) / step, [&](cuint first, cuint last) {
+		hit_batch_c batch;
+		for(uint c=first;c<last;c++) {
+			if(stopped || out()) {
+				stopped = true;
+				return;
+			}
+			cuint i = c * step;
+			//The first pass already traced every other pixel of the even columns
+			const bool even = step < PROGRESSIVE_STEP && i % (step * 2) == 0;
+			cfloat column = (float)i / (float)width;
+			uint amount = 0;
+			for(uint j=even?step:0;j<height;j+=even?step*2:step) {
+				cfloat row = (float)j / (float)height;
+				cfloat x = params.target_x + params.right_x * column + params.up_x * row;
+				cfloat y = params.target_y + params.right_y * column + params.up_y * row;
+				cfloat z = params.target_z + params.right_z * column + params.up_z * row;
+				float hitx = 0, hity = 0, hitz = 0;
+				uint hitpolygon = 0;
+				tangent_frame_c frame;
+				const bool hit = trace_primary(scene, params.camera_x, params.camera_y, params.camera_z, x, y, z, hitx, hity, hitz, hitpolygon, &frame);
+				color_pixel(scene, params, hit, hitx, hity, hitz, hitpolygon, frame, j, sunx, suny, sunz, batch, image + (j * width + i) * 3, depth_buffer[j * width + i]);
+				traced[j * width + i] = 1;
+				amount++;
+			}
+			shade_hits(scene, params, sunx, suny, sunz, batch);
+			samples+= amount;
+		}
+	}, params.threads);
+	return !stopped;
+}
+
+//Fills the pixels that haven't been traced by interpolating between the pixels traced on every step:th row and column
+//The depth is taken from the closest of them as depths across an edge can't be mixed
+static void fill_frame(const render_params_c &params, float *image, float *depth_buffer, cuchar *traced, cuint step) {
+	cuint width = params.width;
+	cuint height = params.height;
+	for(uint j=0;j<height;j++) {
+		cuint y1 = j / step * step;
+		cuint y2 = y1 + step < height ? y1 + step : y1;
+		cfloat fy = y2 == y1 ? 0 : float(j - y1) / float(step);
+		for(uint i=0;i<width;i++) {
+			if(traced[j * width + i]) continue;
+			cuint x1 = i / step * step;
+			cuint x2 = x1 + step < width ? x1 + step : x1;
+			cfloat fx = x2 == x1 ? 0 : float(i - x1) / float(step);
+			for(uchar k=0;k<3;k++) {
+				cfloat top = image[(y1 * width + x1) * 3 + k] * (1 - fx) + image[(y1 * width + x2) * 3 + k] * fx;
+				cfloat bottom = image[(y2 * width + x1) * 3 + k] * (1 - fx) + image[(y2 * width + x2) * 3 + k] * fx;
+				image[(j * width + i) * 3 + k] = top * (1 - fy) + bottom * fy;
+			}
+			depth_buffer[j * width + i] = depth_buffer[(fy < 0.5 ? y1 : y2) * width + (fx < 0.5 ? x1 : x2)];
+		}
+	}
+}
+
+	/** Progressive rendering **/
+//The first pass traces one pixel in every PROGRESSIVE_STEP x PROGRESSIVE_STEP block and every pass after it halves the step until every pixel is traced
+//After a pass the rest of the pixels are filled in from the traced ones and the frame is post processed and scaled down into final
+//The passes stop early when the budget or the samples run out or the frame is cancelled, the pixels traced by then are kept
+//	The time post processing took is left for the last post processing and the first pass is always finished unless the frame is cancelled
+//Returns the share of the pixels that were traced or a negative value if the frame was cancelled before anything was written into final
+template <class T> float progressive_frame(const scene_c &scene, const render_params_c &params, T *final, cuint stride, arena_c &arena, const progressive_c &progressive) {
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	const size_t arena_mark = arena.mark();
+	cuint pixels = params.width * params.height;
+	arena.stage("Tracing rays");
+	float *image = arena.alloc<float>(pixels * 3);
+	float *depth_buffer = arena.alloc<float>(pixels);
+	uchar *traced = arena.alloc<uchar>(pixels);
+	memset(traced, 0, pixels);
+	std::atomic<uint> samples(0);
+	double post_time = 0; //Milliseconds the last post processing took
+	bool first = true;
+	//Nothing but cancelling stops the first pass
+	const std::function<bool()> out = [&]() {
+		if(progressive.cancel != NULL && *progressive.cancel) return true;
+		if(first) return false;
+		if(progressive.samples != 0 && samples >= progressive.samples) return true;
+		cdouble elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		return progressive.budget != 0 && elapsed + post_time >= progressive.budget;
+	};
+	uint pass = 0;
+	uint finished = 0; //The step of the last finished pass
+	bool done = false;
+	while(!done) {
+		cuint step = PROGRESSIVE_STEP >> pass;
+		pass++;
+		if(trace_pass(scene, params, image, depth_buffer, traced, step, samples, out)) finished = step;
+		else if(first) {
+			arena.rewind(arena_mark);
+			return -1;
+		}
+		first = false;
+		done = finished != step || step == 1 || out();
+		//The frames between the passes are only needed for the callback
+		if(!done && !progressive.callback) continue;
+		const std::chrono::steady_clock::time_point post_start = std::chrono::steady_clock::now();
+		const size_t pass_mark = arena.mark();
+		fill_frame(params, image, depth_buffer, traced, finished);
+		float *post_image = arena.alloc<float>(pixels * 3);
+		float *post_depth = arena.alloc<float>(pixels);
+		memcpy(post_image, image, pixels * 3 * sizeof(float));
+		memcpy(post_depth, depth_buffer, pixels * sizeof(float));
+		post_process(params, post_image, post_depth, arena);
+		arena.stage("Scaling down");
+		finish_frame(params, post_image, final, stride);
+		arena.rewind(pass_mark);
+		arena.stage("Tracing rays");
+		post_time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - post_start).count();
+		cfloat coverage = float(samples) / float(pixels);
+		#ifdef OUTPUT
+			if(params.progress) std::cout << "Pass " << pass << ": " << int(coverage * 100.0 + 0.5) << "% of the pixels traced" << std::endl;
+		#endif
+		if(progressive.callback) progressive.callback(pass, coverage);
+	}
+	arena.rewind(arena_mark);
+	return float(samples) / float(pixels);
+}
+
+float render_progressive(const scene_c &scene, const render_params_c &params, uchar *final, cuint stride, arena_c &arena, const progressive_c &progressive) {
+	return progressive_frame(scene, params, final, stride, arena, progressive);
+}
+
+float render_progressive(const scene_c &scene, const render_params_c &params, float *final, cuint stride, arena_c &arena, const progressive_c &progressive) {
+	return progressive_frame(scene, params, final, stride, arena, progressive);
+}
+
+//Reads flags from a comma separated list of names like "ambient,diffuse,dof"
+//"all" and "none" can be used too and a name starting with '-' removes the flag from the flags given so far
+bool parse_flags(cchar *text, uint &flags) {
+	static cchar * const names[8] = {"ambient", "diffuse", "phong", "parallax", "normal", "antialiasing", "dof", "bloom"};
+	uint result = 0;
+	while(*text) {
+		const bool remove = *text == '-';
+		if(remove) text++;
+		uint length = 0;
+		while(text[length] && text[length] != ',') length++;
+		uint flag = 0;
+		if(length == 3 && strncmp(text, "all", 3) == 0) flag = FLAG_ALL;
+		else if(length == 4 && strncmp(text, "none", 4) == 0) flag = 0;
+		else {
+			for(uchar i=0;i<8;i++) {
+				if(strlen(names[i]) == length && strncmp(text, names[i], length) == 0) flag = 1 << i;
+			}
+			if(flag == 0) return false;
+		}
+		if(remove) result&= ~flag;
+		else result|= flag;
+		text+= length;
+		if(*text == ',') text++;
+	}
+	flags = result;
+	return true;
+}
+
+//Reads three comma separated numbers
+static bool parse_vector(cchar *text, float &x, float &y, float &z) {
+	char end;
+	return sscanf(text, "%f,%f,%f%c", &x, &y, &z, &end) == 3;
+}
+
+//Reads a single name=value parameter into params
+//look moves the target plane in front of the camera given so far so it must come after camera
+bool parse_render_param(cchar *text, render_params_c &params) {
+	cchar *value = strchr(text, '=');
+	if(value == NULL) return false;
+	const size_t length = value - text;
+	value++;
+	char end;
+	if(length == 4 && strncmp(text, "size", 4) == 0) {
+		uint width, height;
+		if(sscanf(value, "%ux%u%c", &width, &height, &end) != 2) return false;
+		if(width == 0 || height == 0 || width > MAX_RENDER_SIZE || height > MAX_RENDER_SIZE) return false;
+		params.width = width;
+		params.height = height;
+	}
+	else if(length == 5 && strncmp(text, "scale", 5) == 0) {
+		uint scale;
+		if(sscanf(value, "%u%c", &scale, &end) != 1 || scale == 0) return false;
+		params.scale_down = scale;
+	}
+	else if(length == 6 && strncmp(text, "camera", 6) == 0) {
+		if(!parse_vector(value, params.camera_x, params.camera_y, params.camera_z)) return false;
+	}
+	else if(length == 4 && strncmp(text, "look", 4) == 0) {
+		float x, y, z;
+		if(!parse_vector(value, x, y, z)) return false;
+		params.look_at(x, y, z);
+	}
+	else if(length == 3 && strncmp(text, "sun", 3) == 0) {
+		if(!parse_vector(value, params.sun_x, params.sun_y, params.sun_z)) return false;
+		if(params.sun_x == 0 && params.sun_y == 0 && params.sun_z == 0) return false;
+	}
+	else if(length == 5 && strncmp(text, "flags", 5) == 0) {
+		if(!parse_flags(value, params.flags)) return false;
+	}
+	else if(length == 7 && strncmp(text, "shadows", 7) == 0) {
+		if(strcmp(value, "baked") == 0) params.baked = true;
+		else if(strcmp(value, "live") == 0) params.baked = false;
+		else return false;
+	}
+	else if(length == 5 && strncmp(text, "frame", 5) == 0) {
+		if(strcmp(value, "half") == 0) params.half_frame = true;
+		else if(strcmp(value, "float") == 0) params.half_frame = false;
+		else return false;
+	}
+	else if(length == 7 && strncmp(text, "threads", 7) == 0) {
+		if(sscanf(value, "%u%c", &params.threads, &end) != 1) return false;
+	}
+	else if(length == 4 && strncmp(text, "rays", 4) == 0) {
+		if(strcmp(value, "stream") == 0) params.ray_streams = true;
+		else if(strcmp(value, "pixel") == 0) params.ray_streams = false;
+		else return false;
+	}
+	else if(length == 4 && strncmp(text, "tile", 4) == 0) {
+		if(sscanf(value, "%u%c", &params.tile, &end) != 1) return false;
+	}
+	else return false;
+	return params.scale_down <= params.width && params.scale_down <= params.height;
+}
@@ -0,0 +1,115 @@
+/** render.hpp **/
+
+#ifndef RENDER_HPP
+#define RENDER_HPP
+
+#include "global.hpp"
+#include "scene.hpp"
+#include "arena.hpp"
+#include <cstddef>
+#include <functional>
+#include <atomic>
+
+//Note that the bloom and depth of field blurriness are affected if the size of the rendered image is changed
+//FINAL_X and FINAL_Y are not the size of the image that is saved but the size of the rendered image before it is scaled down
+#define FINAL_X 600
+#define FINAL_Y 400
+#define FINAL_SCALE_DOWN 1 //This is the factor used to scale down the image after it has been fully rendered
+
+	//Lighting flags
+#define FLAG_AMBIENT 1
+#define FLAG_DIFFUSE 2
+#define FLAG_PHONG 4
+	//Map flags
+#define FLAG_PARALLAX 8
+#define FLAG_NORMAL 16
+	//Post processing flags
+#define FLAG_ANTIALIASING 32
+#define FLAG_DOF 64
+#define FLAG_BLOOM 128
+#define FLAG_ALL 255
+
+#define MAX_RENDER_SIZE 8192 //Biggest width or height a frame can be asked to be rendered in
+
+class lightmap_c;
+
+//This class holds everything about a frame that can change without building the scene again
+//Rays are shot from the camera towards points on the target plane:
+//	the bottom left corner of the image is at target and the plane is spanned by the right and up vectors
+class render_params_c {
+	public:
+		float camera_x, camera_y, camera_z;
+		float target_x, target_y, target_z;
+		float right_x, right_y, right_z;
+		float up_x, up_y, up_z;
+		float sun_x, sun_y, sun_z; //Direction for sun lighting; doesn't need to be normalized
+		uint width, height; //Size of the rendered image
+		uint scale_down;
+		uint flags;
+		uint threads; //Amount of threads tracing the frame; 0 uses every core
+		uint tile; //Columns a thread takes at a time while tracing the frame; 0 splits the columns evenly between the threads
+		bool progress; //Print the progress while tracing
+		bool baked; //Take the sun light from a lightmap instead of tracing a shadow ray for every pixel
+		const lightmap_c *lightmap; //Set by use_lightmap when baked is true
+		bool half_frame; //Post process the frame stored as 16 bit half floats instead of 32 bit floats
+		bool ray_streams; //Trace the primary rays and then the shadow rays of a few columns at a time breadth first in sorted streams, see ray_stream_c
+		render_params_c();
+		void look_at(cfloat x, cfloat y, cfloat z); //Moves the target plane in front of the camera
+		void sun_direction(float &x, float &y, float &z) const; //Normalized
+};
+
+#define NO_HIT 0xFFFFFFFF
+
+//The primary hits and the traced colors of the last frame for reusing them in the next one
+//With reuse a hit is projected into the new view and if the ray of the pixel it lands on still hits the same polygon it is used without tracing the ray
+//A frame with the same view as the last one only traces the pixels whose rays can cross the parts of the scene edited in between
+class history_c {
+	public:
+		uint width, height;
+		uint *polygons; //The polygon hit by every pixel or NO_HIT
+		float *hits; //The hit positions
+		float *image, *depth_buffer; //The traced frame before post processing
+		uint *candidates; //The polygons projected into the new frame
+		float *candidate_depths;
+		bool valid;
+		bool reuse; //Project the hits into the next frame
+		render_params_c params; //The last frame was traced with these
+		cube_c changed; //Covers every edit made to the scene since the last frame
+		bool edited;
+		uint reused, traced; //Primary rays of the last frame
+		history_c();
+		~history_c();
+		void resize(cuint frame_width, cuint frame_height);
+		void reproject(const render_params_c &params);
+		bool same_view(const render_params_c &frame_params) const;
+		void edit(const cube_c &box);
+};
+
+#define PROGRESSIVE_STEP 8 //The first pass of a progressive frame traces one pixel in every 8x8 block; must be a power of two
+
+//Limits for a frame rendered in passes from a coarse subset of the pixels towards every pixel
+class progressive_c {
+	public:
+		uint budget; //Milliseconds the frame may take; 0 doesn't limit the time
+		uint samples; //The frame stops once this many pixels have been traced, checked between columns; 0 traces every pixel
+		const std::atomic<bool> *cancel; //The frame stops as soon as this is set; may be NULL
+		//Called after every pass once the frame has been written with the share of the pixels traced so far
+		std::function<void(cuint pass, cfloat coverage)> callback;
+		progressive_c();
+};
+
+size_t frame_memory(const render_params_c &params);
+bool trace_primary(const scene_c &scene, cfloat J, cfloat K, cfloat L, cfloat x, cfloat y, cfloat z, float &hitx, float &hity, float &hitz, uint &hitpolygon, tangent_frame_c *frame = NULL);
+bool trace_shadow(const scene_c &scene, cfloat hitx, cfloat hity, cfloat hitz, cuint hitpolygon, cfloat sunx, cfloat suny, cfloat sunz);
+void trace_frame(const scene_c &scene, const render_params_c &params, float *image, float *depth_buffer, cuint stride, cuint x1, cuint x2, cuint y1, cuint y2, history_c *history = NULL);
+void post_process(const render_params_c &params, float *image, float *depth_buffer, arena_c &arena);
+void finish_frame(const render_params_c &params, cfloat *image, uchar *final, cuint stride);
+void finish_frame(const render_params_c &params, cfloat *image, float *final, cuint stride);
+void render_frame(const scene_c &scene, const render_params_c &params, uchar *final, cuint stride, arena_c &arena, history_c *history = NULL);
+void render_frame(const scene_c &scene, const render_params_c &params, float *final, cuint stride, arena_c &arena, history_c *history = NULL);
+float render_progressive(const scene_c &scene, const render_params_c &params, uchar *final, cuint stride, arena_c &arena, const progressive_c &progressive);
+float render_progressive(const scene_c &scene, const render_params_c &params, float *final, cuint stride, arena_c &arena, const progressive_c &progressive);
+bool parse_flags(cchar *text, uint &flags);
+bool parse_render_param(cchar *text, render_params_c &params);
+
+#endif
@@ -0,0 +1,718 @@
+/** scene.cpp **/
+
+#include "scene.hpp"
+#include "scene_cache.hpp"
+#include "bmp.hpp"
+#include "math.hpp"
+#include "arena.hpp"
+#include "heightmap.hpp"
+#include "terrain.hpp"
+#include "mesh.hpp"
+#include "parallel.hpp"
+#include <iostream>
+#include <new>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+//Every file the scene is built from; changing any of them invalidates the scene cache
+#define INPUT_AMOUNT 8
+static cchar * const input_paths[INPUT_AMOUNT] = {
+	HEIGHTMAP,
+	"img/rock.bmp",
+	"img/snow.bmp",
+	"img/mix_mask.bmp",
+	"img/rock_parallax.bmp",
+	"img/snow_parallax.bmp",
+	"img/rock_normal.bmp",
+	"img/snow_normal.bmp"
+};
+
+#define TEXTURE_SIZE 256
+#define TEXTURE_RGB (TEXTURE_SIZE * TEXTURE_SIZE * 3)
+#define TEXTURE_MONO (TEXTURE_SIZE * TEXTURE_SIZE)
+#define TEXTURE_MONO_AMOUNT 3 //The textures that only keep one channel
+
+#define CUBE_PARTS 8 //The cubes are created in this many parts at the same time, each under a share of the top level cubes
+
+//The amount of polygons is known before anything is built
+static uint polygon_amount(cuint width, cuint height) {
+	return 2 * (width - 1) * (height - 1) + 4 * (width - 1) + 4 * (height - 1) + 8;
+}
+
+//Returns the height of the scene for a sample of the source image
+static inline float height_of(cfloat sample, const bool integer) {
+	cfloat height = (255 - sample) / 8;
+	return integer ? (float)(int)height : height;
+}
+
+static inline float height_at(const heightmap_c &source, cuint id) {
+	return height_of(source.data[id], source.integer);
+}
+
+//The samples edited in the scene and everything the edit has changed
+//The polygons are only created again where they use the edited samples
+class scene_edit_c {
+	public:
+		uint x1, x2, z1, z2; //x2 and z2 are not included
+		cube_c changed; //Covers both the old and the new polygons
+		std::vector<uint> placed; //The polygons created again in order
+		bool touches(cuint i1, cuint i2, cuint j1, cuint j2) const { //The samples from i1, j1 to i2, j2 included
+			return i2 >= x1 && i1 < x2 && j2 >= z1 && j1 < z2;
+		}
+};
+
+//Creates the polygon n unless only the polygons touching an edit are created
+static inline void place_polygon(polygon_c *polygons, cuint n, const polygon_c &polygon, scene_edit_c *edit) {
+	if(edit != NULL) {
+		if(edit->placed.empty()) edit->changed = cube_c(polygons[n]);
+		else edit->changed.add(polygons[n]);
+		edit->changed.add(polygon);
+		edit->placed.push_back(n);
+	}
+	polygons[n] = polygon;
+}
+
+//Creates polygon_amount(width, height) polygons into the given memory from the height samples
+//The scene is always SCENE_WIDTH wide no matter how many samples there are
+//With an edit only the polygons using the edited samples are created
+static void create_polygons(cfloat *heights, cuint W, cuint H, polygon_c *polygons, scene_edit_c *edit) {
+	cfloat cell = SCENE_WIDTH / (float)W;
+	cfloat max_x = (W - 1) * cell;
+	cfloat max_z = (H - 1) * cell;
+	uint n = 0;
+	for(uint i=0;i<W-1;i++) {
+		for(uint j=0;j<H-1;j++) {
+			if(edit == NULL || edit->touches(i, i + 1, j, j + 1)) {
+				cfloat h1 = heights[j * W + i];
+				cfloat h2 = heights[j * W + i + 1];
+				cfloat h3 = heights[(j + 1) * W + i];
+				cfloat h4 = heights[(j + 1) * W + i + 1];
+				place_polygon(polygons, n, polygon_c(i * cell, h1, j * cell, (i + 1) * cell, h2, j * cell, i * cell, h3, (j + 1) * cell, 0, 0, 1, 0, 0, 1), edit);
+				place_polygon(polygons, n + 1, polygon_c((i + 1) * cell, h2, j * cell, (i + 1) * cell, h4, (j + 1) * cell, i * cell, h3, (j + 1) * cell, 1, 0, 1, 1, 0, 1), edit);
+			}
+			n+= 2;
+		}
+	}
+	//Creating edge polygons
+	for(uint i=0;i<W-1;i++) {
+		cfloat h1 = heights[i];
+		cfloat h2 = heights[i + 1];
+		cfloat h3 = heights[(H - 1) * W + i];
+		cfloat h4 = heights[(H - 1) * W + i + 1];
+		if(edit == NULL || edit->touches(i, i + 1, 0, 0)) {
+			place_polygon(polygons, n, polygon_c(i * cell, h1, 0, i * cell, BORDER_HEIGHT, -BORDER_LENGTH, (i + 1) * cell, h2, 0, 0, 1, 0, 0, 1, 1), edit);
+			place_polygon(polygons, n + 1, polygon_c((i + 1) * cell, h2, 0, i * cell, BORDER_HEIGHT, -BORDER_LENGTH, (i + 1) * cell, BORDER_HEIGHT, -BORDER_LENGTH, 1, 1, 0, 0, 1, 0), edit);
+		}
+		if(edit == NULL || edit->touches(i, i + 1, H - 1, H - 1)) {
+			place_polygon(polygons, n + 2, polygon_c(i * cell, BORDER_HEIGHT, max_z + BORDER_LENGTH, i * cell, h3, max_z, (i + 1) * cell, BORDER_HEIGHT, max_z + BORDER_LENGTH, 0, 1, 0, 0, 1, 1), edit);
+			place_polygon(polygons, n + 3, polygon_c((i + 1) * cell, BORDER_HEIGHT, max_z + BORDER_LENGTH, i * cell, h3, max_z, (i + 1) * cell, h4, max_z, 1, 1, 0, 0, 1, 0), edit);
+		}
+		n+= 4;
+	}
+	for(uint j=0;j<H-1;j++) {
+		cfloat h1 = heights[j * W];
+		cfloat h2 = heights[j * W + W - 1];
+		cfloat h3 = heights[(j + 1) * W];
+		cfloat h4 = heights[(j + 1) * W + W - 1];
+		if(edit == NULL || edit->touches(0, 0, j, j + 1)) {
+			place_polygon(polygons, n, polygon_c(0, h1, j * cell, 0, h3, (j + 1) * cell, -BORDER_LENGTH, BORDER_HEIGHT, j * cell, 1, 0, 1, 1, 0, 0), edit);
+			place_polygon(polygons, n + 1, polygon_c(-BORDER_LENGTH, BORDER_HEIGHT, j * cell, 0, h3, (j + 1) * cell, -BORDER_LENGTH, BORDER_HEIGHT, (j + 1) * cell, 0, 0, 1, 1, 0, 1), edit);
+		}
+		if(edit == NULL || edit->touches(W - 1, W - 1, j, j + 1)) {
+			place_polygon(polygons, n + 2, polygon_c(max_x + BORDER_LENGTH, BORDER_HEIGHT, j * cell, max_x + BORDER_LENGTH, BORDER_HEIGHT, (j + 1) * cell, max_x, h2, j * cell, 1, 0, 1, 1, 0, 0), edit);
+			place_polygon(polygons, n + 3, polygon_c(max_x, h2, j * cell, max_x + BORDER_LENGTH, BORDER_HEIGHT, (j + 1) * cell, max_x, h4, (j + 1) * cell, 0, 0, 1, 1, 0, 1), edit);
+		}
+		n+= 4;
+	}
+	//Creating corner polygons
+	cfloat h1 = heights[0];
+	cfloat h2 = heights[W - 1];
+	cfloat h3 = heights[(H - 1) * W];
+	cfloat h4 = heights[(H - 1) * W + W - 1];
+	if(edit == NULL || edit->touches(0, 0, 0, 0)) {
+		place_polygon(polygons, n, polygon_c(0, h1, 0, -BORDER_LENGTH, BORDER_HEIGHT, 0, 0, BORDER_HEIGHT, -BORDER_LENGTH, 1, 1, 0, 1, 1, 0), edit);
+		place_polygon(polygons, n + 1, polygon_c(-BORDER_LENGTH, BORDER_HEIGHT, 0, -BORDER_LENGTH, BORDER_HEIGHT, -BORDER_LENGTH, 0, BORDER_HEIGHT, -BORDER_LENGTH, 0, 1, 0, 0, 1, 0), edit);
+	}
+	if(edit == NULL || edit->touches(W - 1, W - 1, 0, 0)) {
+		place_polygon(polygons, n + 2, polygon_c(max_x + BORDER_LENGTH, BORDER_HEIGHT, 0, max_x, h2, 0, max_x + BORDER_LENGTH, BORDER_HEIGHT, -BORDER_LENGTH, 1, 1, 0, 1, 1, 0), edit);
+		place_polygon(polygons, n + 3, polygon_c(max_x, h2, 0, max_x, BORDER_HEIGHT, -BORDER_LENGTH, max_x + BORDER_LENGTH, BORDER_HEIGHT, -BORDER_LENGTH, 0, 1, 0, 0, 1, 0), edit);
+	}
+	if(edit == NULL || edit->touches(0, 0, H - 1, H - 1)) {
+		place_polygon(polygons, n + 4, polygon_c(0, BORDER_HEIGHT, max_z + BORDER_LENGTH, -BORDER_LENGTH, BORDER_HEIGHT, max_z + BORDER_LENGTH, 0, h3, max_z, 1, 1, 0, 1, 1, 0), edit);
+		place_polygon(polygons, n + 5, polygon_c(-BORDER_LENGTH, BORDER_HEIGHT, max_z + BORDER_LENGTH, -BORDER_LENGTH, BORDER_HEIGHT, max_z, 0, h3, max_z, 0, 1, 0, 0, 1, 0), edit);
+	}
+	if(edit == NULL || edit->touches(W - 1, W - 1, H - 1, H - 1)) {
+		place_polygon(polygons, n + 6, polygon_c(max_x + BORDER_LENGTH, BORDER_HEIGHT, max_z + BORDER_LENGTH, max_x, BORDER_HEIGHT, max_z + BORDER_LENGTH, max_x + BORDER_LENGTH, BORDER_HEIGHT, max_z, 1, 1, 0, 1, 1, 0), edit);
+		place_polygon(polygons, n + 7, polygon_c(max_x, BORDER_HEIGHT, max_z + BORDER_LENGTH, max_x, h4, max_z, max_x + BORDER_LENGTH, BORDER_HEIGHT, max_z, 0, 1, 0, 0, 1, 0), edit);
+	}
+}
+
+#ifdef CUBE_AMOUNT
+//Returns the amount of cubes on every level including the empty cube at the end of every level
+static void count_cubes(cuint polygon_amount, uint *cube_count) {
+	cube_count[0] = polygon_amount / 4 + 1;
+	//The last cube of the level below is empty and is never placed in a cube
+	for(uchar i=1;i<CUBE_AMOUNT;i++) cube_count[i] = (cube_count[i - 1] - 1) / 4 + 1;
+}
+
+//Creates the acceleration structure with cubes (actually cuboids) into the given memory
+//This creates the part of it under the top level cubes from first to last (not included) on every level
+//	The parts under different top level cubes don't depend on each other so they can be created at the same time
+//	The last part, rest, also takes the cubes that aren't under any top level cube
+//The quads of every level but the top one are created from the cubes of the part too, see create_top_quads
+//The empty cube at the end of every level must be there before the part with the rest is created
+static void create_cube_part(const polygon_c *polygons, cube_c * const *cubes, cuint *cube_count, quad_c * const *quads, cuint *quad_count, cuint first, cuint last, const bool rest) {
+	uint scale = 1; //Cubes on the level under one top level cube
+	for(uchar i=1;i<CUBE_AMOUNT;i++) scale*= 4;
+	for(uchar i=0;i<CUBE_AMOUNT;i++) {
+		cuint begin = first * scale;
+		cuint end = rest ? cube_count[i] - 1 : last * scale;
+		for(uint j=begin;j<end;j++) {
+			if(i == 0) new (&cubes[0][j]) cube_c(polygons, j * 4, j * 4 + 1, j * 4 + 2, j * 4 + 3);
+			else new (&cubes[i][j]) cube_c(cubes[i - 1], j * 4, j * 4 + 1, j * 4 + 2, j * 4 + 3);
+		}
+		if(i + 1 < CUBE_AMOUNT) {
+			for(uint j=begin/QUAD_SIZE;j<(rest?quad_count[i]:end/QUAD_SIZE);j++) new (&quads[i][j]) quad_c(cubes[i], j * QUAD_SIZE, cube_count[i]);
+		}
+		scale/= 4;
+	}
+}
+
+//The quads of the top level once every part of the cubes has been created
+static void create_top_quads(cube_c * const *cubes, cuint *cube_count, quad_c * const *quads, cuint *quad_count) {
+	cuint top = CUBE_AMOUNT - 1;
+	for(uint j=0;j<quad_count[top];j++) new (&quads[top][j]) quad_c(cubes[top], j * QUAD_SIZE, cube_count[top]);
+}
+
+//Fits the cubes above the given polygons around them again and the cubes above those on every level
+//The empty cube at the end of every level is left as it is
+static void refit_cubes(const polygon_c *polygons, cube_c * const *cubes, cuint *cube_count, quad_c * const *quads, const std::vector<uint> &placed) {
+	std::vector<uint> dirty;
+	for(uint i=0;i<placed.size();i++) dirty.push_back(placed[i] / 4);
+	for(uchar i=0;i<CUBE_AMOUNT;i++) {
+		std::sort(dirty.begin(), dirty.end());
+		dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+		for(uint j=0;j<dirty.size();j++) {
+			cuint k = dirty[j];
+			dirty[j] = k / 4;
+			if(k >= cube_count[i] - 1) continue;
+			if(i == 0) new (&cubes[0][k]) cube_c(polygons, k * 4, k * 4 + 1, k * 4 + 2, k * 4 + 3);
+			else new (&cubes[i][k]) cube_c(cubes[i - 1], k * 4, k * 4 + 1, k * 4 + 2, k * 4 + 3);
+			new (&quads[i][k / QUAD_SIZE]) quad_c(cubes[i], k / QUAD_SIZE * QUAD_SIZE, cube_count[i]);
+		}
+	}
+}
+#endif
+
+//Loads a 256x256 texture straight into the scene
+//Only the red channel is kept if the texture is mono; the whole texture is loaded into temp first
+static bool load_texture(cchar *path, uchar *texture, uchar *temp) {
+	if(temp == NULL) return load_bmp(path, texture, TEXTURE_SIZE, TEXTURE_SIZE);
+	if(!load_bmp(path, temp, TEXTURE_SIZE, TEXTURE_SIZE)) return false;
+	for(uint i=0;i<TEXTURE_MONO;i++) texture[i] = temp[i * 3];
+	return true;
+}
+
+static size_t align_offset(const size_t offset) {
+	return (offset + SCENE_CACHE_ALIGN - 1) / SCENE_CACHE_ALIGN * SCENE_CACHE_ALIGN;
+}
+
+//Calculates the size and the place of everything in the scene block before anything is built
+//The block of a paged scene only has the textures; its heights are in the terrain file and it has no polygons or cubes
+static void lay_out_scene(scene_header_c &header, const uint64_t hash, cuint width, cuint height, cuint mesh_polygons, const bool paged) {
+	cuint texture_size[SCENE_CACHE_TEXTURES] = {TEXTURE_RGB, TEXTURE_RGB, TEXTURE_MONO, TEXTURE_MONO, TEXTURE_MONO, TEXTURE_RGB, TEXTURE_RGB};
+	memset(&header, 0, sizeof(header));
+	header.magic = SCENE_CACHE_MAGIC;
+	header.version = SCENE_CACHE_VERSION;
+	header.hash = hash;
+	header.polygon_size = sizeof(polygon_c);
+	header.cube_size = sizeof(cube_c);
+	header.polygon_count = paged ? 0 : polygon_amount(width, height) + mesh_polygons;
+	header.grid_width = width;
+	header.grid_height = height;
+	header.mesh_polygon_count = mesh_polygons;
+	size_t offset = align_offset(sizeof(header));
+	header.grid_offset = offset;
+	if(!paged) offset = align_offset(offset + (size_t)width * height * sizeof(float));
+	header.polygon_offset = offset;
+	offset = align_offset(offset + header.polygon_count * sizeof(polygon_c));
+	#ifdef CUBE_AMOUNT
+		header.cube_levels = CUBE_AMOUNT;
+		if(!paged) count_cubes(header.polygon_count, header.cube_count);
+		for(uchar i=0;i<CUBE_AMOUNT;i++) {
+			header.cube_offset[i] = offset;
+			offset = align_offset(offset + header.cube_count[i] * sizeof(cube_c));
+		}
+		for(uchar i=0;i<CUBE_AMOUNT;i++) {
+			header.quad_count[i] = (header.cube_count[i] + QUAD_SIZE - 1) / QUAD_SIZE;
+			header.quad_offset[i] = offset;
+			offset = align_offset(offset + header.quad_count[i] * sizeof(quad_c));
+		}
+	#endif
+	for(uchar i=0;i<SCENE_CACHE_TEXTURES;i++) {
+		header.texture_offset[i] = offset;
+		offset = align_offset(offset + texture_size[i]);
+	}
+	header.size = offset;
+}
+
+//Builds the whole scene from the source images into a single block of memory
+//The block has the layout of the scene cache file and everything is built in place
+//The heightmap is scaled down by acc like ACC does for HEIGHTMAP and the meshes in mesh_list are placed in it unless it is NULL
+static uchar *build_scene(cchar *heightmap, cuint acc, cchar *mesh_list, const uint64_t hash, const uint64_t stamp, size_t &size) {
+	uint source_width, source_height;
+	if(!heightmap_size(heightmap, source_width, source_height)) return NULL;
+	cuint width = source_width / acc;
+	cuint height = source_height / acc;
+	if(width < 2 || height < 2) {
+		std::cout << heightmap << " is too small for ACC " << acc << "!" << std::endl;
+		return NULL;
+	}
+	std::vector<mesh_c> meshes;
+	uint mesh_polygons = 0;
+	std::vector<mesh_place_c> places;
+	if(mesh_list != NULL && !read_mesh_list(mesh_list, places)) return NULL;
+	if(!places.empty()) {
+		#ifdef OUTPUT
+			std::cout << "Loading " << places.size() << " meshes" << std::endl;
+		#endif
+		meshes.resize(places.size());
+		for(uint i=0;i<places.size();i++) {
+			if(!load_mesh(places[i], meshes[i])) return NULL;
+			if(meshes[i].triangles.size() / 3 > 0x7fffffff - polygon_amount(width, height) - mesh_polygons) {
+				std::cout << "The meshes have too many triangles!" << std::endl;
+				return NULL;
+			}
+			mesh_polygons+= meshes[i].triangles.size() / 3;
+		}
+	}
+	scene_header_c header;
+	lay_out_scene(header, hash, width, height, mesh_polygons, false);
+	header.stamp = stamp;
+	size = header.size;
+	uchar *block = new uchar[size];
+	memset(block, 0, size);
+	memcpy(block, &header, sizeof(header));
+	//Scratch memory for the heightmap, a temporary copy of it for the blur and the scaled heightmap
+	//Only the heightmap tasks use it and each of them waits for the one before, so the stages never overlap
+	arena_c arena("Scene build", (size_t)source_width * source_height * sizeof(float) * 2 + width * height * sizeof(float) + 6 * ARENA_ALIGN);
+	//The mono textures are loaded at the same time with the heightmap tasks, their memory is taken before the tasks start
+	arena_c texture_arena("Scene textures", TEXTURE_RGB * TEXTURE_MONO_AMOUNT + TEXTURE_MONO_AMOUNT * ARENA_ALIGN);
+	polygon_c *polygons = (polygon_c*)(block + header.polygon_offset);
+	float *heights = (float*)(block + header.grid_offset);
+
+	//The scene is built by tasks that run as soon as the tasks they need are done:
+	//	the textures are loaded at the same time with each other and with the heightmap being blurred, scaled down and made into polygons
+	//	the mesh polygons are created at the same time with all of those and the cubes are created in parts once every polygon is there
+	#ifdef OUTPUT
+		std::cout << "Building the scene from " << heightmap << " (" << source_width << "x" << source_height << ") scaled down by " << acc << std::endl;
+	#endif
+	task_graph_c tasks;
+	arena.stage("Loading");
+	heightmap_c source, scaled;
+	cuint load_task = tasks.add("heightmap", [&]() {
+		return load_heightmap(heightmap, source, arena);
+	});
+	cuint blur_task = tasks.add("blur", [&]() {
+		arena.stage("Blurring");
+		blur_heightmap(source, arena);
+		return true;
+	}, std::vector<uint>(1, load_task));
+	cuint scale_task = tasks.add("scale down", [&]() {
+		arena.stage("Scaling down");
+		scale_down_heightmap(source, scaled, acc, arena);
+		return true;
+	}, std::vector<uint>(1, blur_task));
+	std::vector<uint> polygon_tasks(1, tasks.add("polygons", [&]() {
+		arena.stage("Creating polygons");
+		for(uint j=0;j<height;j++) {
+			for(uint i=0;i<width;i++) heights[j * width + i] = height_at(scaled, (height - 1 - j) * width + i);
+		}
+		create_polygons(heights, width, height, polygons, NULL);
+		return true;
+	}, std::vector<uint>(1, scale_task)));
+	if(mesh_polygons > 0) {
+		polygon_tasks.push_back(tasks.add("mesh polygons", [&]() {
+			uint n = header.polygon_count - mesh_polygons;
+			for(uint i=0;i<meshes.size();i++) {
+				create_mesh_polygons(meshes[i], polygons + n);
+				n+= meshes[i].triangles.size() / 3;
+			}
+			std::vector<mesh_c>().swap(meshes);
+			return true;
+		}));
+	}
+	//The order is the same as texture1 to texture7 of the scene
+	const bool mono[SCENE_CACHE_TEXTURES] = {false, false, true, true, true, false, false};
+	for(uint i=0;i<SCENE_CACHE_TEXTURES;i++) {
+		cchar *path = input_paths[i + 1];
+		uchar *texture = block + header.texture_offset[i];
+		uchar *temp = mono[i] ? texture_arena.alloc<uchar>(TEXTURE_RGB) : NULL;
+		tasks.add(strrchr(path, '/') + 1, [path, texture, temp]() {
+			return load_texture(path, texture, temp);
+		});
+	}
+	#ifdef CUBE_AMOUNT
+		cube_c *cubes[CUBE_AMOUNT];
+		quad_c *quads[CUBE_AMOUNT];
+		for(uchar i=0;i<CUBE_AMOUNT;i++) {
+			cubes[i] = (cube_c*)(block + header.cube_offset[i]);
+			quads[i] = (quad_c*)(block + header.quad_offset[i]);
+			new (&cubes[i][header.cube_count[i] - 1]) cube_c();
+		}
+		cuint top_cubes = header.cube_count[CUBE_AMOUNT - 1] - 1;
+		cuint parts = std::max(std::min((uint)CUBE_PARTS, top_cubes), 1u);
+		std::vector<uint> part_tasks;
+		for(uint i=0;i<parts;i++) {
+			cuint first = top_cubes * i / parts;
+			cuint last = top_cubes * (i + 1) / parts;
+			const bool rest = i + 1 == parts;
+			part_tasks.push_back(tasks.add("cubes " + std::to_string(i + 1) + "/" + std::to_string(parts), [polygons, &cubes, &header, &quads, first, last, rest]() {
+				create_cube_part(polygons, cubes, header.cube_count, quads, header.quad_count, first, last, rest);
+				return true;
+			}, polygon_tasks));
+		}
+		tasks.add("top quads", [&]() {
+			create_top_quads(cubes, header.cube_count, quads, header.quad_count);
+			return true;
+		}, part_tasks);
+	#endif
+	const bool built = tasks.run();
+	#ifdef OUTPUT
+		tasks.report();
+	#endif
+	if(!built) {
+		delete [] block;
+		return NULL;
+	}
+	#ifdef OUTPUT
+		std::cout << "     Created " << header.polygon_count - mesh_polygons << " polygons";
+		if(mesh_polygons > 0) std::cout << " and " << mesh_polygons << " mesh polygons";
+		std::cout << std::endl;
+		#ifdef CUBE_AMOUNT
+			for(uchar i=0;i<CUBE_AMOUNT;i++) std::cout << "     Created " << header.cube_count[i] << " level " << int(i + 1) << " cubes" << std::endl;
+		#endif
+	#endif
+	#ifdef OUTPUT
+		std::cout << "     Scene block: " << (size + 1023) / 1024 << " KB" << std::endl;
+	#endif
+	arena.report();
+	texture_arena.report();
+	return block;
+}
+
+//Everything that affects the built scene goes into the hash
+//With stamp the files go in with their sizes and modification times instead of their contents, see stamp_files
+static uint64_t scene_hash(cchar *heightmap, cuint acc, cchar *mesh_list, const bool stamp) {
+	uint64_t (*const hash_inputs)(cchar * const *paths, cuint count, uint64_t hash) = stamp ? stamp_files : hash_files;
+	cchar *paths[INPUT_AMOUNT];
+	for(uint i=0;i<INPUT_AMOUNT;i++) paths[i] = i == 0 ? heightmap : input_paths[i];
+	uint64_t hash = hash_inputs(paths, INPUT_AMOUNT, SCENE_HASH_SEED);
+	hash = hash_value(hash, SCENE_CACHE_VERSION);
+	hash = hash_value(hash, SCENE_WIDTH);
+	hash = hash_value(hash, acc);
+	#ifdef CUBE_AMOUNT
+		hash = hash_value(hash, CUBE_AMOUNT);
+	#else
+		hash = hash_value(hash, 0);
+	#endif
+	hash = hash_value(hash, BORDER_LENGTH);
+	hash = hash_value(hash, BORDER_HEIGHT);
+	hash = hash_value(hash, sizeof(polygon_c));
+	hash = hash_value(hash, sizeof(cube_c));
+	hash = hash_value(hash, sizeof(quad_c));
+	hash = hash_value(hash, QUAD_BITS);
+	if(mesh_list != NULL) {
+		//The list holds the places of the meshes
+		hash = hash_inputs(&mesh_list, 1, hash);
+		std::vector<mesh_place_c> places;
+		read_mesh_list(mesh_list, places);
+		for(uint i=0;i<places.size();i++) {
+			cchar *path = places[i].path.c_str();
+			hash = hash_inputs(&path, 1, hash);
+		}
+	}
+	return hash;
+}
+
+scene_c::scene_c(): data(NULL), size(0), mapped(false), polygons(NULL), polygon_count(0), heights(NULL), grid_width(0), grid_height(0), mesh_polygon_count(0), quad_test(true), terrain(NULL) {
+	#ifdef CUBE_AMOUNT
+		cube_levels = CUBE_AMOUNT;
+	#else
+		cube_levels = 0;
+	#endif
+}
+
+scene_c::~scene_c() {
+	release();
+}
+
+void scene_c::release() {
+	if(mapped) unmap_scene_cache(data, size);
+	else delete [] data;
+	data = NULL;
+	size = 0;
+	mapped = false;
+	polygons = NULL;
+	polygon_count = 0;
+	heights = NULL;
+	grid_width = 0;
+	grid_height = 0;
+	mesh_polygon_count = 0;
+	terrain = NULL;
+}
+
+//Points the scene into the given block if the block is a valid scene for the current inputs
+//A block without polygons is a paged scene that only has the textures
+//The scene takes the ownership of the block only if true is returned
+bool scene_c::attach(uchar *block, const size_t block_size, const bool block_mapped, const uint64_t hash) {
+	if(block_size < sizeof(scene_header_c)) return false;
+	const scene_header_c &header = *(const scene_header_c*)block;
+	const bool paged = header.polygon_count == 0;
+	if(header.magic != SCENE_CACHE_MAGIC || header.version != SCENE_CACHE_VERSION || header.hash != hash) return false;
+	if(header.size != block_size || header.polygon_size != sizeof(polygon_c) || header.cube_size != sizeof(cube_c)) return false;
+	if(header.polygon_offset + (uint64_t)header.polygon_count * sizeof(polygon_c) > block_size) return false;
+	if(header.grid_width < 2 || header.grid_height < 2) return false;
+	if(!paged && header.polygon_count != polygon_amount(header.grid_width, header.grid_height) + header.mesh_polygon_count) return false;
+	if(!paged && header.grid_offset + (uint64_t)header.grid_width * header.grid_height * sizeof(float) > block_size) return false;
+	#ifdef CUBE_AMOUNT
+		if(header.cube_levels != CUBE_AMOUNT) return false;
+		for(uchar i=0;i<CUBE_AMOUNT;i++) {
+			if(header.cube_offset[i] + (uint64_t)header.cube_count[i] * sizeof(cube_c) > block_size) return false;
+			if(header.quad_count[i] != (header.cube_count[i] + QUAD_SIZE - 1) / QUAD_SIZE) return false;
+			if(header.quad_offset[i] + (uint64_t)header.quad_count[i] * sizeof(quad_c) > block_size) return false;
+		}
+	#else
+		if(header.cube_levels != 0) return false;
+	#endif
+	for(uchar i=0;i<SCENE_CACHE_TEXTURES;i++) {
+		if(header.texture_offset[i] + TEXTURE_MONO > block_size) return false;
+	}
+	if(header.texture_offset[0] + TEXTURE_RGB > block_size || header.texture_offset[1] + TEXTURE_RGB > block_size) return false;
+	if(header.texture_offset[5] + TEXTURE_RGB > block_size || header.texture_offset[6] + TEXTURE_RGB > block_size) return false;
+
+	release();
+	data = block;
+	size = block_size;
+	mapped = block_mapped;
+	polygons = paged ? NULL : (const polygon_c*)(block + header.polygon_offset);
+	polygon_count = header.polygon_count;
+	heights = paged ? NULL : (const float*)(block + header.grid_offset);
+	grid_width = header.grid_width;
+	grid_height = header.grid_height;
+	mesh_polygon_count = header.mesh_polygon_count;
+	#ifdef CUBE_AMOUNT
+		for(uchar i=0;i<CUBE_AMOUNT;i++) {
+			cubes[i] = (const cube_c*)(block + header.cube_offset[i]);
+			cube_count[i] = header.cube_count[i];
+			quads[i] = (const quad_c*)(block + header.quad_offset[i]);
+			quad_count[i] = header.quad_count[i];
+		}
+	#endif
+	texture1 = block + header.texture_offset[0];
+	texture2 = block + header.texture_offset[1];
+	texture3 = block + header.texture_offset[2];
+	texture4 = block + header.texture_offset[3];
+	texture5 = block + header.texture_offset[4];
+	texture6 = block + header.texture_offset[5];
+	texture7 = block + header.texture_offset[6];
+	return true;
+}
+
+uint64_t scene_c::get_hash() const {
+	return data == NULL ? 0 : ((const scene_header_c*)data)->hash;
+}
+
+//Sets the height samples from x1, z1 to x2, z2 (not included) to new_heights which has a row of x2 - x1 samples for every z
+//Only the polygons using the samples are created again and the cubes above them are fitted around them again
+//changed gets a cube around the old and the new polygons for finding the rays the edit can change
+bool scene_c::edit(cuint x1, cuint x2, cuint z1, cuint z2, cfloat *new_heights, cube_c &changed) {
+	if(heights == NULL || x1 >= x2 || z1 >= z2 || x2 > grid_width || z2 > grid_height) {
+		std::cout << "Bad edit " << x1 << "," << x2 << "," << z1 << "," << z2 << "!" << std::endl;
+		return false;
+	}
+	if(mapped) {
+		//The mapping is read-only so the scene is copied before it is changed
+		uchar *block = new uchar[size];
+		memcpy(block, data, size);
+		const size_t block_size = size;
+		const uint64_t hash = get_hash();
+		if(!attach(block, block_size, false, hash)) {
+			delete [] block;
+			return false;
+		}
+	}
+	scene_header_c &header = *(scene_header_c*)data;
+	float *grid = (float*)(data + header.grid_offset);
+	for(uint j=z1;j<z2;j++) {
+		for(uint i=x1;i<x2;i++) {
+			cfloat height = new_heights[(j - z1) * (x2 - x1) + i - x1];
+			grid[j * grid_width + i] = height;
+			uint bits;
+			memcpy(&bits, &height, sizeof(bits));
+			header.hash = hash_value(hash_value(header.hash, j * grid_width + i), bits);
+		}
+	}
+	scene_edit_c edit;
+	edit.x1 = x1;
+	edit.x2 = x2;
+	edit.z1 = z1;
+	edit.z2 = z2;
+	polygon_c *writable = (polygon_c*)(data + header.polygon_offset);
+	create_polygons(grid, grid_width, grid_height, writable, &edit);
+	#ifdef CUBE_AMOUNT
+		cube_c *writable_cubes[CUBE_AMOUNT];
+		quad_c *writable_quads[CUBE_AMOUNT];
+		for(uchar i=0;i<CUBE_AMOUNT;i++) {
+			writable_cubes[i] = (cube_c*)(data + header.cube_offset[i]);
+			writable_quads[i] = (quad_c*)(data + header.quad_offset[i]);
+		}
+		refit_cubes(writable, writable_cubes, header.cube_count, writable_quads, edit.placed);
+	#endif
+	changed = edit.changed;
+	return true;
+}
+
+//Maps the scene from the scene cache file if it is up to date and builds it otherwise
+//A built scene is written into the scene cache file for the next run
+bool scene_c::load() {
+	#ifdef MESHES
+		cchar *mesh_list = MESHES;
+	#else
+		cchar *mesh_list = NULL;
+	#endif
+	#ifdef SCENE_CACHE
+		return load(HEIGHTMAP, ACC, mesh_list, true);
+	#else
+		return load(HEIGHTMAP, ACC, mesh_list, false);
+	#endif
+}
+
+//Builds the scene from another heightmap with another accuracy and the meshes in another list or none if it is NULL, for the tests
+//Without cached the scene cache is neither mapped nor saved
+//The contents of the inputs are only hashed when their sizes or modification times aren't the ones the cache was saved with
+bool scene_c::load(cchar *heightmap, cuint acc, cchar *mesh_list, const bool cached) {
+	const uint64_t stamp = scene_hash(heightmap, acc, mesh_list, true);
+	uint64_t hash = 0;
+	bool hashed = false;
+	size_t block_size;
+	uchar *block;
+	#ifdef SCENE_CACHE
+		block = cached ? map_scene_cache(SCENE_CACHE, block_size) : NULL;
+		if(block != NULL) {
+			const scene_header_c &cached_header = *(const scene_header_c*)block;
+			if(block_size >= sizeof(scene_header_c) && cached_header.stamp == stamp) hash = cached_header.hash;
+			else {
+				hash = scene_hash(heightmap, acc, mesh_list, false);
+				hashed = true;
+			}
+			if(attach(block, block_size, true, hash)) {
+				#ifdef OUTPUT
+					std::cout << "Mapped the scene from " << SCENE_CACHE << std::endl;
+					std::cout << "     " << polygon_count << " polygons" << std::endl;
+				#endif
+				if(cached_header.stamp != stamp) {
+					//The files were touched without changing them; the cache is saved with the new stamp so they aren't hashed again
+					uchar *stamped = new uchar[block_size];
+					memcpy(stamped, block, block_size);
+					((scene_header_c*)stamped)->stamp = stamp;
+					write_scene_cache(SCENE_CACHE, stamped, block_size);
+					delete [] stamped;
+				}
+				return true;
+			}
+			unmap_scene_cache(block, block_size);
+			#ifdef OUTPUT
+				std::cout << SCENE_CACHE << " is out of date; building the scene again" << std::endl;
+			#endif
+		}
+	#endif
+	if(!hashed) hash = scene_hash(heightmap, acc, mesh_list, false);
+	block = build_scene(heightmap, acc, mesh_list, hash, stamp, block_size);
+	if(block == NULL) return false;
+	if(!attach(block, block_size, false, hash)) {
+		delete [] block;
+		return false;
+	}
+	#ifdef SCENE_CACHE
+		if(cached && write_scene_cache(SCENE_CACHE, block, block_size)) {
+			#ifdef OUTPUT
+				std::cout << "     Saved the scene into " << SCENE_CACHE << std::endl;
+			#endif
+		}
+	#endif
+	return true;
+}
+
+//Loads the scene for tracing the rays through the paged terrain in TERRAIN_FILE instead of the polygons, see terrain_c
+//Only the textures are in the scene block: the heights go from the heightmap into the terrain file a row at a time
+//	so the heights, the polygons and the cubes of the whole scene are never in memory
+//The terrain file is only written if it is missing or was split from other inputs
+bool scene_c::load_paged(terrain_c &paged, cuint cache_chunks) {
+	#ifdef MESHES
+		std::vector<mesh_place_c> places;
+		if(read_mesh_list(MESHES, places) && !places.empty()) std::cout << "The meshes aren't traced with the paged terrain!" << std::endl;
+	#endif
+	return load_paged(HEIGHTMAP, ACC, TERRAIN_FILE, paged, cache_chunks);
+}
+
+//The same with another heightmap, accuracy and terrain file, for the tests
+bool scene_c::load_paged(cchar *heightmap, cuint acc, cchar *terrain_path, terrain_c &paged, cuint cache_chunks) {
+	//The lightmaps and the tuned settings of the paged scene aren't the ones of the scene in memory
+	const uint64_t hash = hash_value(scene_hash(heightmap, acc, NULL, false), TERRAIN_MAGIC);
+	uint source_width, source_height;
+	if(!heightmap_size(heightmap, source_width, source_height)) return false;
+	cuint width = source_width / acc;
+	cuint height = source_height / acc;
+	if(width < 2 || height < 2) {
+		std::cout << heightmap << " is too small for ACC " << acc << "!" << std::endl;
+		return false;
+	}
+	#ifdef OUTPUT
+		std::cout << "Paging the terrain of " << heightmap << " (" << source_width << "x" << source_height << ") scaled down by " << acc << std::endl;
+	#endif
+	scene_header_c header;
+	lay_out_scene(header, hash, width, height, 0, true);
+	uchar *block = new uchar[header.size];
+	memset(block, 0, header.size);
+	memcpy(block, &header, sizeof(header));
+	//Scratch memory for the rows of the heightmap reader, a row of heights and the mono textures
+	arena_c arena("Terrain split", ((size_t)BLUR_RADIUS * 2 + acc + 4) * source_width * sizeof(float) + TEXTURE_RGB + 8 * ARENA_ALIGN);
+	const bool mono[SCENE_CACHE_TEXTURES] = {false, false, true, true, true, false, false};
+	uchar *temp = arena.alloc<uchar>(TEXTURE_RGB);
+	for(uint i=0;i<SCENE_CACHE_TEXTURES;i++) {
+		if(!load_texture(input_paths[i + 1], block + header.texture_offset[i], mono[i] ? temp : NULL)) {
+			delete [] block;
+			return false;
+		}
+	}
+	if(!attach(block, header.size, false, hash)) {
+		delete [] block;
+		return false;
+	}
+	if(!paged.open(terrain_path, hash, cache_chunks)) {
+		#ifdef OUTPUT
+			std::cout << "Splitting the terrain into chunks" << std::endl;
+		#endif
+		heightmap_reader_c reader;
+		if(!reader.open(heightmap, acc, arena)) return false;
+		//The rows of the scene start from the top of the image
+		const bool written = write_terrain(terrain_path, hash, width, height, SCENE_WIDTH / (float)width, [&](cuint row, float *samples) {
+			if(!reader.read_row(height - 1 - row, samples)) {
+				std::cout << "Couldn't read " << heightmap << "!" << std::endl;
+				return false;
+			}
+			for(uint i=0;i<width;i++) samples[i] = height_of(samples[i], reader.integer);
+			return true;
+		});
+		if(!written || !paged.open(terrain_path, hash, cache_chunks)) {
+			std::cout << "Couldn't open " << terrain_path << "!" << std::endl;
+			return false;
+		}
+		arena.report();
+	}
+	terrain = &paged;
+	return true;
+}
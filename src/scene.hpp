@@ -0,0 +1,77 @@
+/** scene.hpp **/
+
+#ifndef SCENE_HPP
+#define SCENE_HPP
+
+#include "global.hpp"
+#include "polygon.hpp"
+#include "cube.hpp"
+#include <cstddef>
+#include <stdint.h>
+
+class terrain_c;
+
+#define HEIGHTMAP "malli.bmp" //The source image of the scene; 24 or 32 bit bmp, 8 or 16 bit binary pgm or grayscale pfm
+#define SCENE_WIDTH 192 //The source image is stretched to this width in the scene no matter how big it is
+#define ACC 1 //This is the accuracy of the scene; bigger values are less accurate; valid values are 1, 2, 4, 8, 16, 32 and 64 for the 192x128 malli.bmp
+#define CUBE_AMOUNT 5 //This can't be 0; comment out if 0 is wanted
+#define BORDER_LENGTH 50
+#define BORDER_HEIGHT 8
+
+//OBJ and binary STL meshes placed in the scene are listed in this file, a line "file x y z scale" for every mesh
+//The meshes are merged with the polygons of the heights into the same cubes; a missing file has no meshes
+//Comment out to ignore the file
+#define MESHES "meshes.txt"
+
+//The finished scene is stored in this file and mapped from it on the next run instead of building it again
+//Comment out to always build the scene from the source images
+#define SCENE_CACHE "scene.cache"
+
+//This class holds everything that is needed for tracing rays: the polygons, the cube levels and the prepared textures
+//All of the data lies in a single block of memory that has the same layout as the scene cache file
+//	The block is either built from the source images or mapped read-only straight from the scene cache file
+//	Either way nothing is parsed or copied after the block exists
+//	A mapped scene is copied into memory the first time it is edited and the cache file is never changed by edits
+//A paged scene only has the textures in the block and traces the rays through the terrain file instead, see load_paged
+class scene_c {
+	private:
+		uchar *data;
+		size_t size;
+		bool mapped;
+		bool attach(uchar *block, const size_t block_size, const bool block_mapped, const uint64_t hash);
+		void release();
+
+	public:
+		const polygon_c *polygons; //NULL for the paged terrain
+		uint polygon_count;
+		const float *heights; //The height of the scene at every sample, rows along x starting from z = 0; NULL for the paged terrain
+		uint grid_width, grid_height; //The samples are SCENE_WIDTH / (grid_width - 1) units apart
+		uint mesh_polygon_count; //The polygons of the meshes come after the polygons of the heights
+		#ifdef CUBE_AMOUNT
+			const cube_c *cubes[CUBE_AMOUNT];
+			uint cube_count[CUBE_AMOUNT];
+			const quad_c *quads[CUBE_AMOUNT]; //The cubes of every level in groups of 4
+			uint quad_count[CUBE_AMOUNT];
+		#endif
+		//How rays are traced through the cubes; these aren't part of the scene block and can be changed for benchmarking
+		uint cube_levels; //The lowest levels that are used; CUBE_AMOUNT by default
+		bool quad_test; //Test the 4 cubes under a cube at once nearest first instead of one by one in order
+		terrain_c *terrain; //Rays are traced through this paged terrain instead of the polygons when it is set
+		cuchar *texture1; //Rock texture
+		cuchar *texture2; //Snow texture
+		cuchar *texture3; //Texture mixing mask
+		cuchar *texture4; //Rock parallax map
+		cuchar *texture5; //Snow parallax map
+		cuchar *texture6; //Rock normalmap
+		cuchar *texture7; //Snow normalmap
+		scene_c();
+		~scene_c();
+		bool load();
+		bool load(cchar *heightmap, cuint acc, cchar *mesh_list, const bool cached);
+		bool load_paged(terrain_c &paged, cuint cache_chunks);
+		bool load_paged(cchar *heightmap, cuint acc, cchar *terrain_path, terrain_c &paged, cuint cache_chunks);
+		uint64_t get_hash() const; //Hash of the inputs the scene was built from and the edits made to it
+		bool edit(cuint x1, cuint x2, cuint z1, cuint z2, cfloat *new_heights, cube_c &changed);
+};
+
+#endif
@@ -0,0 +1,157 @@
+/** scene_cache.cpp **/
+
+#include "scene_cache.hpp"
+#include <iostream>
+#include <cstdio>
+#include <string>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+	#include <process.h>
+#else
+	#include <sys/mman.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+//The hash is 64 bit FNV-1a
+#define FNV_PRIME 1099511628211ULL
+
+//Hashes the contents of the given files on top of the given hash
+//A missing file is hashed as a marker so that the hash still changes if a file disappears
+uint64_t hash_files(cchar * const *paths, cuint count, uint64_t hash) {
+	uchar buffer[65536];
+	for(uint i=0;i<count;i++) {
+		FILE *file = fopen(paths[i], "rb");
+		if(file == NULL) {
+			hash = hash_value(hash, 0xffffffff);
+			continue;
+		}
+		size_t amount;
+		while((amount = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+			for(size_t j=0;j<amount;j++) {
+				hash^= buffer[j];
+				hash*= FNV_PRIME;
+			}
+		}
+		fclose(file);
+	}
+	return hash;
+}
+
+//Hashes the paths, the sizes and the modification times of the given files on top of the given hash
+//This only looks at the directory entries so it is used to tell if the contents have to be hashed again at all
+uint64_t stamp_files(cchar * const *paths, cuint count, uint64_t hash) {
+	for(uint i=0;i<count;i++) {
+		for(cchar *c=paths[i];*c!='\0';c++) {
+			hash^= (uchar)*c;
+			hash*= FNV_PRIME;
+		}
+		struct stat info;
+		if(stat(paths[i], &info) != 0) {
+			hash = hash_value(hash, 0xffffffff);
+			continue;
+		}
+		const uint64_t size = info.st_size;
+		const uint64_t time = info.st_mtime;
+		hash = hash_value(hash_value(hash, size), size >> 32);
+		hash = hash_value(hash_value(hash, time), time >> 32);
+		#ifdef __linux__
+			hash = hash_value(hash, info.st_mtim.tv_nsec);
+		#endif
+	}
+	return hash;
+}
+
+uint64_t hash_value(uint64_t hash, cuint value) {
+	for(uchar i=0;i<4;i++) {
+		hash^= (value >> (i * 8)) & 255;
+		hash*= FNV_PRIME;
+	}
+	return hash;
+}
+
+//Maps the whole file read-only into memory
+//Returns NULL if the file doesn't exist or can't be mapped
+//On Windows the file is read into memory instead
+uchar *map_scene_cache(cchar *path, size_t &size) {
+	size = 0;
+	#ifdef _WIN32
+		FILE *file = fopen(path, "rb");
+		if(file == NULL) return NULL;
+		fseek(file, 0, SEEK_END);
+		const long length = ftell(file);
+		fseek(file, 0, SEEK_SET);
+		if(length <= 0) {
+			fclose(file);
+			return NULL;
+		}
+		uchar *data = new uchar[length];
+		if(fread(data, 1, length, file) != (size_t)length) {
+			delete [] data;
+			fclose(file);
+			return NULL;
+		}
+		fclose(file);
+		size = length;
+		return data;
+	#else
+		cint file = open(path, O_RDONLY);
+		if(file < 0) return NULL;
+		struct stat info;
+		if(fstat(file, &info) != 0 || info.st_size <= 0) {
+			close(file);
+			return NULL;
+		}
+		void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		close(file); //The mapping stays valid after the file is closed
+		if(data == MAP_FAILED) return NULL;
+		size = info.st_size;
+		return (uchar*)data;
+	#endif
+}
+
+void unmap_scene_cache(uchar *data, const size_t size) {
+	if(data == NULL) return;
+	#ifdef _WIN32
+		delete [] data;
+	#else
+		munmap(data, size);
+	#endif
+}
+
+//The temporary name a file is written under before it is renamed to path
+//The name has the id of the process so that instances building the same file at the same time, like the workers of --distribute, never write into each other's file
+std::string temp_path_for(cchar *path) {
+	#ifdef _WIN32
+		return std::string(path) + "." + std::to_string(_getpid()) + ".tmp";
+	#else
+		return std::string(path) + "." + std::to_string(getpid()) + ".tmp";
+	#endif
+}
+
+//The file is first written under a temporary name and then renamed
+//This way another instance of the program never maps a half written file
+bool write_scene_cache(cchar *path, cuchar *data, const size_t size) {
+	const std::string temp_path = temp_path_for(path);
+	FILE *file = fopen(temp_path.c_str(), "wb");
+	if(file == NULL) {
+		std::cout << "Couldn't create " << temp_path << "!" << std::endl;
+		return false;
+	}
+	const bool written = fwrite(data, 1, size, file) == size;
+	if(fclose(file) != 0 || !written) {
+		std::cout << "Couldn't write " << temp_path << "!" << std::endl;
+		remove(temp_path.c_str());
+		return false;
+	}
+	#ifdef _WIN32
+		remove(path); //rename doesn't replace existing files on Windows
+	#endif
+	if(rename(temp_path.c_str(), path) != 0) {
+		std::cout << "Couldn't rename " << temp_path << " to " << path << "!" << std::endl;
+		remove(temp_path.c_str());
+		return false;
+	}
+	return true;
+}
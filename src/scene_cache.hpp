@@ -0,0 +1,51 @@
+/** scene_cache.hpp **/
+
+#ifndef SCENE_CACHE_HPP
+#define SCENE_CACHE_HPP
+
+#include "global.hpp"
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+
+#define SCENE_CACHE_MAGIC 0x43535452 //"RTSC"
+#define SCENE_CACHE_VERSION 5 //Increase this whenever the layout of the file or the classes stored in it change
+#define SCENE_CACHE_ALIGN 16 //Every section of the file starts at a multiple of this
+#define SCENE_CACHE_LEVELS 8 //Maximum amount of cube levels that fit in the header
+#define SCENE_CACHE_TEXTURES 7
+#define SCENE_HASH_SEED 14695981039346656037ULL //Starting value for the hash functions below
+
+//This is the beginning of the scene cache file and of the scene memory block
+//The offsets are counted from the beginning of the block
+//The sizes of the stored classes are saved so that a file made by a differently compiled program is never used
+class scene_header_c {
+	public:
+		uint magic;
+		uint version;
+		uint64_t hash; //Hash of the source images and the scene defines
+		uint64_t stamp; //The same with the sizes and the modification times of the files instead of their contents
+		uint64_t size; //Size of the whole block
+		uint polygon_size;
+		uint cube_size;
+		uint polygon_count;
+		uint cube_levels;
+		uint cube_count[SCENE_CACHE_LEVELS];
+		uint quad_count[SCENE_CACHE_LEVELS];
+		uint grid_width, grid_height; //Height samples the polygons are created from
+		uint mesh_polygon_count; //The polygons of the meshes come after the polygons of the heights
+		uint64_t grid_offset;
+		uint64_t polygon_offset;
+		uint64_t cube_offset[SCENE_CACHE_LEVELS];
+		uint64_t quad_offset[SCENE_CACHE_LEVELS];
+		uint64_t texture_offset[SCENE_CACHE_TEXTURES];
+};
+
+uint64_t hash_files(cchar * const *paths, cuint count, uint64_t hash);
+uint64_t stamp_files(cchar * const *paths, cuint count, uint64_t hash);
+uint64_t hash_value(uint64_t hash, cuint value);
+uchar *map_scene_cache(cchar *path, size_t &size);
+void unmap_scene_cache(uchar *data, const size_t size);
+bool write_scene_cache(cchar *path, cuchar *data, const size_t size);
+std::string temp_path_for(cchar *path);
+
+#endif
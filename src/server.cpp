@@ -0,0 +1,274 @@
+/** server.cpp **/
+
+/*
+
+	The server keeps the scene loaded and renders frames for clients connecting to a Unix socket.
+	Every request is a single line of text and the answer starts with a single line too:
+
+		render [size=WxH] [scale=N] [camera=x,y,z] [look=x,y,z] [sun=x,y,z] [flags=...] [shadows=baked|live] [frame=float|half] [threads=N] [output=path]
+			-> "ok <bytes>" followed by the bmp file, or "ok <path>" if the image was saved into output
+		stats
+			-> "ok jobs=N errors=N queued=N running=N workers=N last_ms=N average_ms=N max_ms=N"
+		quit
+			-> "ok" and the server stops after the frames already asked for are done
+
+	Anything that goes wrong is answered with "error <reason>".
+	A connection may send any amount of requests which are answered in order.
+	Every connection has a thread of its own that only reads the requests; the frames are rendered by a pool of workers.
+	Each worker keeps its own frame arena so that no memory is allocated per frame once the arena is big enough.
+
+*/
+
+#include "server.hpp"
+#include "render.hpp"
+#include "parallel.hpp"
+#include "arena.hpp"
+#include "bmp.hpp"
+#include "lightmap.hpp"
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <chrono>
+#include <atomic>
+#include <future>
+#include <set>
+#include <cerrno>
+
+#ifndef _WIN32
+	#include <sys/socket.h>
+	#include <sys/un.h>
+	#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+bool run_server(const scene_c &scene, cchar *path) {
+	std::cout << "The render server needs Unix sockets which are not supported on Windows!" << std::endl;
+	return false;
+}
+
+#else
+
+//Everything the connections share
+class server_c {
+	public:
+		const scene_c *scene;
+		thread_pool_c *pool;
+		arena_c **arenas; //One for every worker in the pool
+		lightmap_c *lightmaps; //Likewise
+		int socket;
+		std::atomic<bool> stopping;
+		std::mutex stats_mutex;
+		uint jobs, errors;
+		double last_ms, total_ms, max_ms;
+		std::mutex connections_mutex;
+		std::set<int> connections; //Closed for reading when the server quits so that idle clients don't keep it running
+		std::condition_variable closed;
+};
+
+static bool send_all(const int connection, const void *data, size_t bytes) {
+	cchar *position = (cchar*)data;
+	while(bytes > 0) {
+		const ssize_t sent = send(connection, position, bytes, MSG_NOSIGNAL);
+		if(sent <= 0) return false;
+		position+= sent;
+		bytes-= sent;
+	}
+	return true;
+}
+
+static bool send_line(const int connection, cchar *line) {
+	return send_all(connection, line, strlen(line)) && send_all(connection, "\n", 1);
+}
+
+//Reads a line without the line feed into line
+//Returns false when the connection is closed or the line is too long
+static bool read_line(const int connection, char *line, char *buffer, uint &buffered) {
+	while(true) {
+		for(uint i=0;i<buffered;i++) {
+			if(buffer[i] == '\n') {
+				memcpy(line, buffer, i);
+				line[i] = 0;
+				if(i > 0 && line[i - 1] == '\r') line[i - 1] = 0;
+				buffered-= i + 1;
+				memmove(buffer, buffer + i + 1, buffered);
+				return true;
+			}
+		}
+		if(buffered == SERVER_LINE) return false;
+		const ssize_t got = recv(connection, buffer + buffered, SERVER_LINE - buffered, 0);
+		if(got <= 0) return false;
+		buffered+= got;
+	}
+}
+
+//Renders a frame with the arena of the worker and sends it or saves it into a file
+//Returns false if the connection was lost
+static bool render_request(server_c &server, const int connection, render_params_c &params, cchar *output, cuint worker) {
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	if(!use_lightmap(*server.scene, params, server.lightmaps[worker])) {
+		std::lock_guard<std::mutex> lock(server.stats_mutex);
+		server.errors++;
+		return send_line(connection, "error couldn't bake the light");
+	}
+	cuint final_x = params.width / params.scale_down;
+	cuint final_y = params.height / params.scale_down;
+	arena_c &arena = *server.arenas[worker];
+	arena.reset();
+	uchar *final = arena.alloc<uchar>(final_x * final_y * 3);
+	render_frame(*server.scene, params, final, final_x * 3, arena);
+	char line[SERVER_LINE + 32];
+	bool sent;
+	bool failed = false;
+	if(output != NULL) {
+		failed = !save_bmp(final, final_x, final_y, output);
+		if(failed) snprintf(line, sizeof(line), "error couldn't save %s", output);
+		else snprintf(line, sizeof(line), "ok %s", output);
+		sent = send_line(connection, line);
+	}
+	else {
+		cuint size = bmp_size(final_x, final_y);
+		uchar *bmp = arena.alloc<uchar>(size);
+		encode_bmp(final, final_x, final_y, bmp);
+		snprintf(line, sizeof(line), "ok %u", size);
+		sent = send_line(connection, line) && send_all(connection, bmp, size);
+	}
+	const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::lock_guard<std::mutex> lock(server.stats_mutex);
+	if(failed) server.errors++;
+	else {
+		server.jobs++;
+		server.last_ms = ms;
+		server.total_ms+= ms;
+		if(ms > server.max_ms) server.max_ms = ms;
+	}
+	return sent;
+}
+
+//Reads the parameters and waits until a worker has rendered and sent the frame
+static bool queue_render(server_c &server, const int connection, char *request) {
+	render_params_c params;
+	params.threads = 1; //The frames are already rendered in parallel by the workers
+	cchar *output = NULL;
+	//Every connection parses on a thread of its own so strtok, which keeps its place in a static variable, can't be used
+	char *place;
+	for(char *arg=strtok_r(request, " ", &place);arg!=NULL;arg=strtok_r(NULL, " ", &place)) {
+		if(strncmp(arg, "output=", 7) == 0) output = arg + 7;
+		else if(!parse_render_param(arg, params)) {
+			char line[SERVER_LINE + 32];
+			snprintf(line, sizeof(line), "error bad parameter %s", arg);
+			{
+				std::lock_guard<std::mutex> lock(server.stats_mutex);
+				server.errors++;
+			}
+			return send_line(connection, line);
+		}
+	}
+	std::promise<bool> done;
+	server.pool->submit([&](cuint worker) { done.set_value(render_request(server, connection, params, output, worker)); });
+	return done.get_future().get();
+}
+
+static void serve_connection(server_c &server, const int connection) {
+	char buffer[SERVER_LINE];
+	char request[SERVER_LINE + 1];
+	uint buffered = 0;
+	while(read_line(connection, request, buffer, buffered)) {
+		bool open;
+		if(strncmp(request, "render", 6) == 0 && (request[6] == 0 || request[6] == ' ')) open = queue_render(server, connection, request + 6);
+		else if(strcmp(request, "stats") == 0) {
+			char line[256];
+			{
+				std::lock_guard<std::mutex> lock(server.stats_mutex);
+				snprintf(line, sizeof(line), "ok jobs=%u errors=%u queued=%u running=%u workers=%u last_ms=%.1f average_ms=%.1f max_ms=%.1f",
+					server.jobs, server.errors, server.pool->queued(), server.pool->running(), server.pool->size(),
+					server.last_ms, server.jobs > 0 ? server.total_ms / server.jobs : 0.0, server.max_ms);
+			}
+			open = send_line(connection, line);
+		}
+		else if(strcmp(request, "quit") == 0) {
+			send_line(connection, "ok");
+			server.stopping = true;
+			shutdown(server.socket, SHUT_RDWR); //Wakes up accept
+			std::lock_guard<std::mutex> lock(server.connections_mutex);
+			for(std::set<int>::iterator i=server.connections.begin();i!=server.connections.end();i++) shutdown(*i, SHUT_RD);
+			break;
+		}
+		else open = send_line(connection, "error unknown request");
+		if(!open) break;
+	}
+	std::lock_guard<std::mutex> lock(server.connections_mutex);
+	server.connections.erase(connection);
+	close(connection);
+	server.closed.notify_all();
+}
+
+//Listens to the socket until a client asks the server to quit
+bool run_server(const scene_c &scene, cchar *path) {
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(address.sun_path)) {
+		std::cout << "Socket path " << path << " is too long!" << std::endl;
+		return false;
+	}
+	strcpy(address.sun_path, path);
+	server_c server;
+	server.socket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(server.socket < 0) {
+		std::cout << "Couldn't create a socket!" << std::endl;
+		return false;
+	}
+	unlink(path); //Left behind by a server that didn't quit properly
+	if(bind(server.socket, (sockaddr*)&address, sizeof(address)) != 0 || listen(server.socket, 16) != 0) {
+		std::cout << "Couldn't listen to " << path << "!" << std::endl;
+		close(server.socket);
+		return false;
+	}
+	server.scene = &scene;
+	server.stopping = false;
+	server.jobs = 0;
+	server.errors = 0;
+	server.last_ms = 0;
+	server.total_ms = 0;
+	server.max_ms = 0;
+	thread_pool_c pool(SERVER_WORKERS);
+	server.pool = &pool;
+	const render_params_c defaults;
+	server.arenas = new arena_c*[pool.size()];
+	server.lightmaps = new lightmap_c[pool.size()];
+	for(uint i=0;i<pool.size();i++) server.arenas[i] = new arena_c("Server frame", bmp_size(defaults.width, defaults.height) + frame_memory(defaults));
+	#ifdef OUTPUT
+		std::cout << "Listening to " << path << " with " << pool.size() << " workers" << std::endl;
+	#endif
+	while(!server.stopping) {
+		const int connection = accept(server.socket, NULL, NULL);
+		if(connection < 0) {
+			if(errno == EINTR || server.stopping) continue;
+			std::cout << "Couldn't accept a connection!" << std::endl;
+			break;
+		}
+		{
+			std::lock_guard<std::mutex> lock(server.connections_mutex);
+			server.connections.insert(connection);
+			if(server.stopping) shutdown(connection, SHUT_RD);
+		}
+		std::thread(serve_connection, std::ref(server), connection).detach();
+	}
+	{
+		//Every connection finishes the frame it is waiting for
+		std::unique_lock<std::mutex> lock(server.connections_mutex);
+		while(!server.connections.empty()) server.closed.wait(lock);
+	}
+	for(uint i=0;i<pool.size();i++) delete server.arenas[i];
+	delete [] server.arenas;
+	delete [] server.lightmaps;
+	close(server.socket);
+	unlink(path);
+	#ifdef OUTPUT
+		std::cout << "Server stopped after " << server.jobs << " frames" << std::endl;
+	#endif
+	return true;
+}
+
+#endif
@@ -0,0 +1,15 @@
+/** server.hpp **/
+
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include "global.hpp"
+#include "scene.hpp"
+
+#define SERVER_SOCKET "raytracer.sock" //Default path of the Unix socket the server listens to
+#define SERVER_WORKERS 0 //Amount of connections served at the same time; 0 uses every core of the machine
+#define SERVER_LINE 1024 //Longest request line accepted
+
+bool run_server(const scene_c &scene, cchar *path);
+
+#endif
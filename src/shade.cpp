@@ -0,0 +1,366 @@
+/** shade.cpp **/
+
+#include "shade.hpp"
+#include "math.hpp"
+#include <cmath>
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+hit_batch_c::hit_batch_c(): count(0) {}
+
+bool hit_batch_c::add(cfloat hitx, cfloat hity, cfloat hitz, const tangent_frame_c &hitframe, cfloat hitlight, cfloat hitdiffuse, float *hitpixel, float *hitdepth) {
+	x[count] = hitx;
+	y[count] = hity;
+	z[count] = hitz;
+	frame[count] = hitframe;
+	light[count] = hitlight;
+	diffuse[count] = hitdiffuse;
+	pixel[count] = hitpixel;
+	depth[count] = hitdepth;
+	count++;
+	return count == SHADE_BATCH;
+}
+
+//Calculates the color of a hit position into pixel
+//The sun vector must be normalized
+//light is the share of the sun that reaches the position and frame is of the polygon hit
+//diffuse is the baked diffuse brightness of the lightmap, it is used instead of the one of the normalmap when it isn't negative
+void shade_hit(const scene_c &scene, const render_params_c &params, cfloat hitx, cfloat hity, cfloat hitz, const tangent_frame_c &frame, cfloat light, cfloat diffuse, cfloat sunx, cfloat suny, cfloat sunz, float *pixel, float &depth) {
+	cuint flags = params.flags;
+		//normal vector
+	cfloat nx = frame.nx;
+	cfloat ny = frame.ny;
+	cfloat nz = frame.nz;
+		//tangent vector
+	cfloat tx = frame.tx;
+	cfloat ty = frame.ty;
+	cfloat tz = frame.tz;
+		//binormal vector
+	cfloat bx = frame.bx;
+	cfloat by = frame.by;
+	cfloat bz = frame.bz;
+		//camera vector
+	float cx = hitx - params.camera_x;
+	float cy = hity - params.camera_y;
+	float cz = hitz - params.camera_z;
+	cfloat cl = sqrt(cx * cx + cy * cy + cz * cz);
+	cx/= cl;
+	cy/= cl;
+	cz/= cl;
+	depth = cl;
+		//camera vector in tangent space
+	cfloat tscx = tx * cx + bx * cy + nx * cz;
+	cfloat tscy = ty * cx + by * cy + ny * cz;
+	cfloat tscz = tz * cx + bz * cy + nz * cz;
+		//texture position
+	short tex_idx = (short)mix(0, 191, 0, 255, hitx);
+	short tex_idy = (short)mix(0, 127, 0, 255, hitz);
+	while(tex_idx > 255) tex_idx-= 256;
+	while(tex_idx < 0) tex_idx+= 256;
+	while(tex_idy > 255) tex_idy-= 256;
+	while(tex_idy < 0) tex_idy+= 256;
+	cuint tex_id = tex_idy * 256 + tex_idx;
+	const bool tex = hity < mix(0, 255, 4, 19, scene.texture3[tex_id]);
+	cuchar *texture = tex ? scene.texture1 : scene.texture2;
+	if(flags & FLAG_PARALLAX) {
+		//Parallax offset
+		cfloat mult = 0.2 * (float(tex ? scene.texture4[tex_id] : scene.texture5[tex_id]) - 128.0);
+		tex_idx+= mult * tscx;
+		tex_idy+= mult * tscy;
+		while(tex_idx > 255) tex_idx-= 256;
+		while(tex_idx < 0) tex_idx+= 256;
+		while(tex_idy > 255) tex_idy-= 256;
+		while(tex_idy < 0) tex_idy+= 256;
+	}
+	cuint tex_id2 = (tex_idy * 256 + tex_idx) * 3;
+	cfloat texr = texture[tex_id2];
+	cfloat texg = texture[tex_id2 + 1];
+	cfloat texb = texture[tex_id2 + 2];
+		//normalmap
+	float nmx = 0;
+	float nmy = 0;
+	float nmz = 1;
+	if(flags & FLAG_NORMAL) {
+		cuchar *normalmap = tex ? scene.texture6 : scene.texture7;
+		nmx = (float(normalmap[tex_id2]) / 255.0 - 0.5) * 2.0;
+		nmy = (float(normalmap[tex_id2 + 1]) / 255.0 - 0.5) * 2.0;
+		nmz = (float(normalmap[tex_id2 + 2]) / 255.0 - 0.5) * 2.0 * 0.3;
+		cfloat nml = sqrt(nmx * nmx + nmy * nmy + nmz * nmz);
+		nmx/= nml;
+		nmy/= nml;
+		nmz/= nml;
+	}
+	//Add ambient lighting
+	if(flags & FLAG_AMBIENT) {
+		cfloat brightness = nmx * -bx + nmy * -by + nmz * -bz; //equals vector {0, -1, 0}
+		pixel[0] = texr * brightness * 0.3;
+		pixel[1] = texg * brightness * 0.4;
+		pixel[2] = texb * brightness * 0.5;
+	}
+	else {
+		pixel[0] = 0;
+		pixel[1] = 0;
+		pixel[2] = 0;
+	}
+	if(light > 0) {
+			//sun vector in tangent space
+		cfloat tssunx = tx * sunx + bx * suny + nx * sunz;
+		cfloat tssuny = ty * sunx + by * suny + ny * sunz;
+		cfloat tssunz = tz * sunx + bz * suny + nz * sunz;
+		//Calculate sun lighting
+		if(flags & FLAG_DIFFUSE) {
+			cfloat dbrightness = diffuse >= 0 && (flags & FLAG_NORMAL) ? diffuse : max(nmx * tssunx + nmy * tssuny + nmz * tssunz, 0.0) * 1.5 * light;
+			pixel[0]+= texr * dbrightness * 1.0;
+			pixel[1]+= texg * dbrightness * 0.6;
+			pixel[2]+= texb * dbrightness * 0.5;
+		}
+		//Calculate phong lighting
+		if(flags & FLAG_PHONG) {
+			cfloat dot = nmx * tscx + nmy * tscy + nmz * tscz * 2.0;
+				//phong vector
+			cfloat px = tscx - dot * nmx;
+			cfloat py = tscy - dot * nmy;
+			cfloat pz = tscz - dot * nmz;
+			//The 10th power is multiplied out as pow is slow
+			cdouble base = max(px * -tssunx + py * -tssuny + pz * -tssunz, 0.0);
+			cdouble base2 = base * base;
+			cdouble base4 = base2 * base2;
+			cfloat pbrightness = base4 * base4 * base2 * 5.0 * light;
+			pixel[0]+= texr * pbrightness * 1.0;
+			pixel[1]+= texg * pbrightness * 0.6;
+			pixel[2]+= texb * pbrightness * 0.5;
+		}
+	}
+}
+
+#ifdef __SSE2__
+
+//The values of the texture maps as shade_hit turns them into floats
+class shade_tables_c {
+	public:
+		float parallax[256];
+		float normal[256], normal_z[256];
+		shade_tables_c() {
+			for(uint i=0;i<256;i++) {
+				parallax[i] = 0.2 * (float(i) - 128.0);
+				normal[i] = (float(i) / 255.0 - 0.5) * 2.0;
+				normal_z[i] = (float(i) / 255.0 - 0.5) * 2.0 * 0.3;
+			}
+		}
+};
+
+static const shade_tables_c tables;
+
+//shade_hit does some of its steps in double precision and these do them the same way for 4 floats
+//pixel + value * mult rounded once into floats
+static inline __m128 add_double(const __m128 pixel, const __m128 value, cdouble mult) {
+	const __m128d m = _mm_set1_pd(mult);
+	const __m128d low = _mm_add_pd(_mm_cvtps_pd(pixel), _mm_mul_pd(_mm_cvtps_pd(value), m));
+	const __m128d high = _mm_add_pd(_mm_cvtps_pd(_mm_movehl_ps(pixel, pixel)), _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(value, value)), m));
+	return _mm_movelh_ps(_mm_cvtpd_ps(low), _mm_cvtpd_ps(high));
+}
+
+//value * mult rounded once
+static inline __m128 mul_double(const __m128 value, cdouble mult) {
+	const __m128d m = _mm_set1_pd(mult);
+	return _mm_movelh_ps(_mm_cvtpd_ps(_mm_mul_pd(_mm_cvtps_pd(value), m)), _mm_cvtpd_ps(_mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(value, value)), m)));
+}
+
+//value * mult * light rounded once
+static inline __m128 light_double(const __m128 value, cdouble mult, const __m128 light) {
+	const __m128d m = _mm_set1_pd(mult);
+	const __m128d low = _mm_mul_pd(_mm_mul_pd(_mm_cvtps_pd(value), m), _mm_cvtps_pd(light));
+	const __m128d high = _mm_mul_pd(_mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(value, value)), m), _mm_cvtps_pd(_mm_movehl_ps(light, light)));
+	return _mm_movelh_ps(_mm_cvtpd_ps(low), _mm_cvtpd_ps(high));
+}
+
+//value^10 * mult * light rounded once
+static inline __m128 phong_double(const __m128 value, cdouble mult, const __m128 light) {
+	const __m128d m = _mm_set1_pd(mult);
+	__m128d d[2] = {_mm_cvtps_pd(value), _mm_cvtps_pd(_mm_movehl_ps(value, value))};
+	const __m128d l[2] = {_mm_cvtps_pd(light), _mm_cvtps_pd(_mm_movehl_ps(light, light))};
+	for(uint i=0;i<2;i++) {
+		const __m128d d2 = _mm_mul_pd(d[i], d[i]);
+		const __m128d d4 = _mm_mul_pd(d2, d2);
+		d[i] = _mm_mul_pd(_mm_mul_pd(_mm_mul_pd(_mm_mul_pd(d4, d4), d2), m), l[i]);
+	}
+	return _mm_movelh_ps(_mm_cvtpd_ps(d[0]), _mm_cvtpd_ps(d[1]));
+}
+
+static inline __m128 dot(const __m128 x1, const __m128 y1, const __m128 z1, const __m128 x2, const __m128 y2, const __m128 z2) {
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(x1, x2), _mm_mul_ps(y1, y2)), _mm_mul_ps(z1, z2));
+}
+
+static inline __m128 negate(const __m128 value) {
+	return _mm_xor_ps(value, _mm_set1_ps(-0.0f));
+}
+
+//Keeps the lanes of a where mask is set and takes the rest from b
+static inline __m128 blend(const __m128 mask, const __m128 a, const __m128 b) {
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+//Texture positions of the 4 lanes wrapped to 0 - 255
+static inline __m128i wrap_texture(const __m128 position) {
+	return _mm_and_si128(_mm_cvttps_epi32(position), _mm_set1_epi32(255));
+}
+
+//Shades the hits first to first + 3 of the batch the same way as shade_hit
+//The texture values are fetched lane by lane as SSE2 has no gather
+static void shade_lanes(const scene_c &scene, const render_params_c &params, cfloat sunx, cfloat suny, cfloat sunz, const hit_batch_c &batch, cuint first) {
+	cuint flags = params.flags;
+	float vectors[9][4];
+	for(uint l=0;l<4;l++) {
+		const tangent_frame_c &frame = batch.frame[first + l];
+		vectors[0][l] = frame.nx; vectors[1][l] = frame.ny; vectors[2][l] = frame.nz;
+		vectors[3][l] = frame.tx; vectors[4][l] = frame.ty; vectors[5][l] = frame.tz;
+		vectors[6][l] = frame.bx; vectors[7][l] = frame.by; vectors[8][l] = frame.bz;
+	}
+		//normal, tangent and binormal vectors
+	const __m128 nx = _mm_loadu_ps(vectors[0]), ny = _mm_loadu_ps(vectors[1]), nz = _mm_loadu_ps(vectors[2]);
+	const __m128 tx = _mm_loadu_ps(vectors[3]), ty = _mm_loadu_ps(vectors[4]), tz = _mm_loadu_ps(vectors[5]);
+	const __m128 bx = _mm_loadu_ps(vectors[6]), by = _mm_loadu_ps(vectors[7]), bz = _mm_loadu_ps(vectors[8]);
+	const __m128 hitx = _mm_loadu_ps(batch.x + first), hity = _mm_loadu_ps(batch.y + first), hitz = _mm_loadu_ps(batch.z + first);
+	const __m128 light = _mm_loadu_ps(batch.light + first);
+		//camera vector
+	__m128 cx = _mm_sub_ps(hitx, _mm_set1_ps(params.camera_x));
+	__m128 cy = _mm_sub_ps(hity, _mm_set1_ps(params.camera_y));
+	__m128 cz = _mm_sub_ps(hitz, _mm_set1_ps(params.camera_z));
+	const __m128 cl = _mm_sqrt_ps(dot(cx, cy, cz, cx, cy, cz));
+	cx = _mm_div_ps(cx, cl);
+	cy = _mm_div_ps(cy, cl);
+	cz = _mm_div_ps(cz, cl);
+		//camera vector in tangent space
+	const __m128 tscx = dot(tx, bx, nx, cx, cy, cz);
+	const __m128 tscy = dot(ty, by, ny, cx, cy, cz);
+	const __m128 tscz = dot(tz, bz, nz, cx, cy, cz);
+		//texture position
+	__m128i tex_idx = wrap_texture(_mm_mul_ps(_mm_set1_ps((0.0f - 255.0f) / (0.0f - 191.0f)), hitx));
+	__m128i tex_idy = wrap_texture(_mm_mul_ps(_mm_set1_ps((0.0f - 255.0f) / (0.0f - 127.0f)), hitz));
+	int ids[4];
+	_mm_storeu_si128((__m128i*)ids, _mm_add_epi32(_mm_slli_epi32(tex_idy, 8), tex_idx));
+	float mask[4];
+	for(uint l=0;l<4;l++) mask[l] = scene.texture3[ids[l]];
+	const __m128 tex = _mm_cmplt_ps(hity, _mm_add_ps(_mm_mul_ps(_mm_set1_ps((4.0f - 19.0f) / (0.0f - 255.0f)), _mm_loadu_ps(mask)), _mm_set1_ps(4)));
+	cuint rock = _mm_movemask_ps(tex);
+	if(flags & FLAG_PARALLAX) {
+		//Parallax offset
+		float mult[4];
+		for(uint l=0;l<4;l++) mult[l] = tables.parallax[(rock & (1 << l) ? scene.texture4 : scene.texture5)[ids[l]]];
+		const __m128 m = _mm_loadu_ps(mult);
+		tex_idx = wrap_texture(_mm_add_ps(_mm_cvtepi32_ps(tex_idx), _mm_mul_ps(m, tscx)));
+		tex_idy = wrap_texture(_mm_add_ps(_mm_cvtepi32_ps(tex_idy), _mm_mul_ps(m, tscy)));
+		_mm_storeu_si128((__m128i*)ids, _mm_add_epi32(_mm_slli_epi32(tex_idy, 8), tex_idx));
+	}
+	float colors[3][4];
+	float normals[3][4];
+	for(uint l=0;l<4;l++) {
+		cuint id = ids[l] * 3;
+		cuchar *texture = rock & (1 << l) ? scene.texture1 : scene.texture2;
+		colors[0][l] = texture[id];
+		colors[1][l] = texture[id + 1];
+		colors[2][l] = texture[id + 2];
+		if(flags & FLAG_NORMAL) {
+			cuchar *normalmap = rock & (1 << l) ? scene.texture6 : scene.texture7;
+			normals[0][l] = tables.normal[normalmap[id]];
+			normals[1][l] = tables.normal[normalmap[id + 1]];
+			normals[2][l] = tables.normal_z[normalmap[id + 2]];
+		}
+	}
+	const __m128 texr = _mm_loadu_ps(colors[0]), texg = _mm_loadu_ps(colors[1]), texb = _mm_loadu_ps(colors[2]);
+		//normalmap
+	__m128 nmx = _mm_setzero_ps();
+	__m128 nmy = _mm_setzero_ps();
+	__m128 nmz = _mm_set1_ps(1);
+	if(flags & FLAG_NORMAL) {
+		nmx = _mm_loadu_ps(normals[0]);
+		nmy = _mm_loadu_ps(normals[1]);
+		nmz = _mm_loadu_ps(normals[2]);
+		const __m128 nml = _mm_sqrt_ps(dot(nmx, nmy, nmz, nmx, nmy, nmz));
+		nmx = _mm_div_ps(nmx, nml);
+		nmy = _mm_div_ps(nmy, nml);
+		nmz = _mm_div_ps(nmz, nml);
+	}
+	//Add ambient lighting
+	__m128 red = _mm_setzero_ps(), green = _mm_setzero_ps(), blue = _mm_setzero_ps();
+	if(flags & FLAG_AMBIENT) {
+		const __m128 brightness = dot(nmx, nmy, nmz, negate(bx), negate(by), negate(bz));
+		red = mul_double(_mm_mul_ps(texr, brightness), 0.3);
+		green = mul_double(_mm_mul_ps(texg, brightness), 0.4);
+		blue = mul_double(_mm_mul_ps(texb, brightness), 0.5);
+	}
+	const __m128 lit = _mm_cmpgt_ps(light, _mm_setzero_ps());
+	if(_mm_movemask_ps(lit) && (flags & (FLAG_DIFFUSE | FLAG_PHONG))) {
+		__m128 sun_red = red, sun_green = green, sun_blue = blue;
+			//sun vector in tangent space
+		const __m128 sx = _mm_set1_ps(sunx), sy = _mm_set1_ps(suny), sz = _mm_set1_ps(sunz);
+		const __m128 tssunx = dot(tx, bx, nx, sx, sy, sz);
+		const __m128 tssuny = dot(ty, by, ny, sx, sy, sz);
+		const __m128 tssunz = dot(tz, bz, nz, sx, sy, sz);
+		//Calculate sun lighting
+		if(flags & FLAG_DIFFUSE) {
+			__m128 dbrightness = light_double(_mm_max_ps(dot(nmx, nmy, nmz, tssunx, tssuny, tssunz), _mm_setzero_ps()), 1.5, light);
+			if(flags & FLAG_NORMAL) {
+				const __m128 diffuse = _mm_loadu_ps(batch.diffuse + first);
+				dbrightness = blend(_mm_cmpge_ps(diffuse, _mm_setzero_ps()), diffuse, dbrightness);
+			}
+			sun_red = add_double(sun_red, _mm_mul_ps(texr, dbrightness), 1.0);
+			sun_green = add_double(sun_green, _mm_mul_ps(texg, dbrightness), 0.6);
+			sun_blue = add_double(sun_blue, _mm_mul_ps(texb, dbrightness), 0.5);
+		}
+		//Calculate phong lighting
+		if(flags & FLAG_PHONG) {
+			const __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nmx, tscx), _mm_mul_ps(nmy, tscy)), _mm_mul_ps(_mm_mul_ps(nmz, tscz), _mm_set1_ps(2)));
+				//phong vector
+			const __m128 px = _mm_sub_ps(tscx, _mm_mul_ps(d, nmx));
+			const __m128 py = _mm_sub_ps(tscy, _mm_mul_ps(d, nmy));
+			const __m128 pz = _mm_sub_ps(tscz, _mm_mul_ps(d, nmz));
+			const __m128 pbrightness = phong_double(_mm_max_ps(dot(px, py, pz, negate(tssunx), negate(tssuny), negate(tssunz)), _mm_setzero_ps()), 5.0, light);
+			sun_red = add_double(sun_red, _mm_mul_ps(texr, pbrightness), 1.0);
+			sun_green = add_double(sun_green, _mm_mul_ps(texg, pbrightness), 0.6);
+			sun_blue = add_double(sun_blue, _mm_mul_ps(texb, pbrightness), 0.5);
+		}
+		red = blend(lit, sun_red, red);
+		green = blend(lit, sun_green, green);
+		blue = blend(lit, sun_blue, blue);
+	}
+	float pixels[3][4], depths[4];
+	_mm_storeu_ps(pixels[0], red);
+	_mm_storeu_ps(pixels[1], green);
+	_mm_storeu_ps(pixels[2], blue);
+	_mm_storeu_ps(depths, cl);
+	for(uint l=0;l<4&&first+l<batch.count;l++) {
+		batch.pixel[first + l][0] = pixels[0][l];
+		batch.pixel[first + l][1] = pixels[1][l];
+		batch.pixel[first + l][2] = pixels[2][l];
+		*batch.depth[first + l] = depths[l];
+	}
+}
+
+#endif
+
+	/** Shading stage **/
+//Colors every hit of the batch and empties it
+//With SSE2 the hits are shaded 4 at a time and the colors are exactly the same as with shade_hit
+void shade_hits(const scene_c &scene, const render_params_c &params, cfloat sunx, cfloat suny, cfloat sunz, hit_batch_c &batch) {
+	#ifdef __SSE2__
+		if(batch.count == 0) return;
+		//The last lanes are filled with copies of the last hit and aren't written anywhere
+		for(uint i=batch.count;i%4!=0;i++) {
+			batch.x[i] = batch.x[batch.count - 1];
+			batch.y[i] = batch.y[batch.count - 1];
+			batch.z[i] = batch.z[batch.count - 1];
+			batch.light[i] = batch.light[batch.count - 1];
+			batch.diffuse[i] = batch.diffuse[batch.count - 1];
+			batch.frame[i] = batch.frame[batch.count - 1];
+		}
+		for(uint i=0;i<batch.count;i+=4) shade_lanes(scene, params, sunx, suny, sunz, batch, i);
+	#else
+		for(uint i=0;i<batch.count;i++) {
+			shade_hit(scene, params, batch.x[i], batch.y[i], batch.z[i], batch.frame[i], batch.light[i], batch.diffuse[i], sunx, suny, sunz, batch.pixel[i], *batch.depth[i]);
+		}
+	#endif
+	batch.count = 0;
+}
@@ -0,0 +1,29 @@
+/** shade.hpp **/
+
+#ifndef SHADE_HPP
+#define SHADE_HPP
+
+#include "global.hpp"
+#include "scene.hpp"
+#include "render.hpp"
+
+#define SHADE_BATCH 64 //Hits collected from the tracing before they are shaded together; must be a multiple of 4
+
+//Hit records of a tile of pixels waiting for shading
+//Tracing adds the hits with the share of the sun that reaches them and shade_hits colors them 4 at a time
+class hit_batch_c {
+	public:
+		float x[SHADE_BATCH], y[SHADE_BATCH], z[SHADE_BATCH];
+		float light[SHADE_BATCH]; //0 for a hit in the shadow
+		float diffuse[SHADE_BATCH]; //Diffuse brightness from the lightmap or negative when it is calculated from the normalmap
+		tangent_frame_c frame[SHADE_BATCH]; //Of the polygon hit
+		float *pixel[SHADE_BATCH], *depth[SHADE_BATCH]; //Where the color and the depth of the hit are written
+		uint count;
+		hit_batch_c();
+		bool add(cfloat hitx, cfloat hity, cfloat hitz, const tangent_frame_c &hitframe, cfloat hitlight, cfloat hitdiffuse, float *hitpixel, float *hitdepth); //Returns true once the batch is full
+};
+
+void shade_hit(const scene_c &scene, const render_params_c &params, cfloat hitx, cfloat hity, cfloat hitz, const tangent_frame_c &frame, cfloat light, cfloat diffuse, cfloat sunx, cfloat suny, cfloat sunz, float *pixel, float &depth);
+void shade_hits(const scene_c &scene, const render_params_c &params, cfloat sunx, cfloat suny, cfloat sunz, hit_batch_c &batch);
+
+#endif
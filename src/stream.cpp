@@ -0,0 +1,115 @@
+/** stream.cpp **/
+
+#include "stream.hpp"
+#include <iostream>
+#include <cstring>
+
+#ifdef _WIN32
+	#include <fcntl.h>
+	#include <io.h>
+#endif
+
+frame_stream_c::frame_stream_c(): file(NULL), format(STREAM_RGB24), width(0), height(0), converted(NULL), current(0), failed(false) {
+	buffers[0] = NULL;
+	buffers[1] = NULL;
+}
+
+frame_stream_c::~frame_stream_c() {
+	close();
+}
+
+//target is a path or "-" for the standard output
+bool frame_stream_c::open(cchar *target, cuint frame_format, cuint frame_width, cuint frame_height) {
+	if(frame_format == STREAM_YUV420 && (frame_width % 2 != 0 || frame_height % 2 != 0)) {
+		std::cout << "YUV frames must be of even size!" << std::endl;
+		return false;
+	}
+	if(strcmp(target, "-") == 0) {
+		#ifdef _WIN32
+			_setmode(_fileno(stdout), _O_BINARY);
+		#endif
+		file = stdout;
+	}
+	else file = fopen(target, "wb");
+	if(file == NULL) {
+		std::cout << "Couldn't open " << target << "!" << std::endl;
+		return false;
+	}
+	format = frame_format;
+	width = frame_width;
+	height = frame_height;
+	buffers[0] = new uchar[width * height * 3];
+	buffers[1] = new uchar[width * height * 3];
+	converted = new uchar[frame_size()];
+	current = 0;
+	failed = false;
+	return true;
+}
+
+uchar *frame_stream_c::frame() {
+	return buffers[current];
+}
+
+uint frame_stream_c::frame_size() const {
+	return format == STREAM_YUV420 ? width * height * 3 / 2 : width * height * 3;
+}
+
+//Converts the frame into the stream format and writes it, this is run by the writer thread
+void frame_stream_c::write(cuchar *frame) {
+	if(format == STREAM_RGB24) {
+		for(uint j=0;j<height;j++) memcpy(converted + j * width * 3, frame + (height - j - 1) * width * 3, width * 3);
+	}
+	else {
+		uchar *y_plane = converted;
+		uchar *u_plane = converted + width * height;
+		uchar *v_plane = u_plane + width * height / 4;
+		for(uint j=0;j<height;j++) {
+			cuchar *row = frame + (height - j - 1) * width * 3;
+			for(uint i=0;i<width;i++) {
+				y_plane[j * width + i] = uchar(((66 * row[i * 3] + 129 * row[i * 3 + 1] + 25 * row[i * 3 + 2] + 128) >> 8) + 16);
+			}
+		}
+		for(uint j=0;j<height/2;j++) {
+			cuchar *row1 = frame + (height - j * 2 - 1) * width * 3;
+			cuchar *row2 = row1 - width * 3;
+			for(uint i=0;i<width/2;i++) {
+				//The average of the 2x2 pixels
+				cint r = row1[i * 6] + row1[i * 6 + 3] + row2[i * 6] + row2[i * 6 + 3];
+				cint g = row1[i * 6 + 1] + row1[i * 6 + 4] + row2[i * 6 + 1] + row2[i * 6 + 4];
+				cint b = row1[i * 6 + 2] + row1[i * 6 + 5] + row2[i * 6 + 2] + row2[i * 6 + 5];
+				u_plane[j * width / 2 + i] = uchar(((-38 * r - 74 * g + 112 * b + 512) >> 10) + 128);
+				v_plane[j * width / 2 + i] = uchar(((112 * r - 94 * g - 18 * b + 512) >> 10) + 128);
+			}
+		}
+	}
+	if(fwrite(converted, frame_size(), 1, file) != 1 || fflush(file) != 0) failed = true;
+}
+
+//Returns false if writing any of the earlier frames failed
+bool frame_stream_c::submit() {
+	if(writer.joinable()) writer.join();
+	if(failed) return false;
+	writer = std::thread(&frame_stream_c::write, this, buffers[current]);
+	current = 1 - current;
+	return true;
+}
+
+bool frame_stream_c::close() {
+	if(writer.joinable()) writer.join();
+	if(file != NULL && file != stdout) fclose(file);
+	file = NULL;
+	delete [] buffers[0];
+	delete [] buffers[1];
+	delete [] converted;
+	buffers[0] = NULL;
+	buffers[1] = NULL;
+	converted = NULL;
+	return !failed;
+}
+
+bool parse_stream_format(cchar *text, uint &format) {
+	if(strcmp(text, "rgb24") == 0) format = STREAM_RGB24;
+	else if(strcmp(text, "yuv420") == 0) format = STREAM_YUV420;
+	else return false;
+	return true;
+}
@@ -0,0 +1,38 @@
+/** stream.hpp **/
+
+#ifndef STREAM_HPP
+#define STREAM_HPP
+
+#include "global.hpp"
+#include <cstdio>
+#include <thread>
+
+#define STREAM_RGB24 0 //Top row first, 3 bytes per pixel
+#define STREAM_YUV420 1 //Planar Y, U and V with the colors at half resolution (BT.601 studio range), the size must be even
+
+//Writes frames of a fixed size back to back into a file, a named pipe or the standard output
+//While a frame is being converted and written the next one can be rendered into the other buffer
+class frame_stream_c {
+	private:
+		FILE *file;
+		uint format;
+		uint width, height;
+		uchar *buffers[2];
+		uchar *converted;
+		uint current; //The buffer that is being rendered into
+		std::thread writer;
+		bool failed;
+		void write(cuchar *frame);
+	public:
+		frame_stream_c();
+		~frame_stream_c();
+		bool open(cchar *target, cuint frame_format, cuint frame_width, cuint frame_height);
+		uchar *frame(); //The buffer for the next frame, bottom row first like everywhere else
+		bool submit(); //Starts writing the frame and swaps the buffers
+		bool close(); //Waits for the last frame to be written
+		uint frame_size() const;
+};
+
+bool parse_stream_format(cchar *text, uint &format);
+
+#endif
@@ -0,0 +1,448 @@
+/** terrain.cpp **/
+
+#include "terrain.hpp"
+#include "cast_ray.hpp"
+#include "math.hpp"
+#include "scene_cache.hpp"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cmath>
+
+#ifndef _WIN32
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+#define TERRAIN_FAR 1e30f //Limit of the shadow rays
+#define TERRAIN_MARGIN 0.01f //Bounds are grown by this much so that rays grazing them aren't lost to rounding
+#define TERRAIN_CORNER 0.001f //Share of a cell a ray may pass a corner by and still visit the cells on both sides of it
+
+terrain_stats_c::terrain_stats_c(): hits(0), misses(0), bytes(0), stall(0) {}
+
+//Size of a chunk in the terrain file
+static size_t chunk_bytes() {
+	return (size_t)(TERRAIN_CHUNK + 1) * (TERRAIN_CHUNK + 1) * sizeof(float);
+}
+
+static size_t chunk_offset(const terrain_header_c &header, cuint chunk) {
+	return sizeof(terrain_header_c) + (size_t)header.chunks_x * header.chunks_z * sizeof(terrain_bounds_c) + chunk * chunk_bytes();
+}
+
+//Splits the terrain into chunks in the terrain file
+//read_row is asked for the rows of height samples in order and only the rows of one row of chunks are kept in memory at once
+//Nothing is written if read_row fails
+//The file is written under a temporary name first like the scene cache
+bool write_terrain(cchar *path, const uint64_t hash, cuint grid_width, cuint grid_height, cfloat cell, const std::function<bool(cuint row, float *samples)> &read_row) {
+	if(grid_width < 2 || grid_height < 2) return false;
+	terrain_header_c header;
+	header.magic = TERRAIN_MAGIC;
+	header.version = TERRAIN_VERSION;
+	header.hash = hash;
+	header.grid_width = grid_width;
+	header.grid_height = grid_height;
+	header.chunk_size = TERRAIN_CHUNK;
+	header.chunks_x = (grid_width - 2) / TERRAIN_CHUNK + 1;
+	header.chunks_z = (grid_height - 2) / TERRAIN_CHUNK + 1;
+	header.cell = cell;
+	const std::string temp_path = temp_path_for(path);
+	FILE *file = fopen(temp_path.c_str(), "wb");
+	if(file == NULL) {
+		std::cout << "Couldn't create " << temp_path << "!" << std::endl;
+		return false;
+	}
+	std::vector<terrain_bounds_c> bounds(header.chunks_x * header.chunks_z);
+	std::vector<float> rows((size_t)(TERRAIN_CHUNK + 1) * grid_width);
+	std::vector<float> chunk((TERRAIN_CHUNK + 1) * (TERRAIN_CHUNK + 1));
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+	written&= fwrite(&bounds[0], sizeof(terrain_bounds_c), bounds.size(), file) == bounds.size();
+	uint read = 0; //Rows read so far
+	for(uint cz=0;cz<header.chunks_z&&written;cz++) {
+		//The first row of a row of chunks is the last row of the one before it
+		cuint first = cz * TERRAIN_CHUNK;
+		if(cz > 0) std::copy(rows.begin() + (size_t)TERRAIN_CHUNK * grid_width, rows.end(), rows.begin());
+		for(;read<=first+TERRAIN_CHUNK&&read<grid_height&&written;read++) written = read_row(read, &rows[(size_t)(read - first) * grid_width]);
+		for(uint cx=0;cx<header.chunks_x;cx++) {
+			terrain_bounds_c &bound = bounds[cz * header.chunks_x + cx];
+			bound.min_y = TERRAIN_FAR;
+			bound.max_y = -TERRAIN_FAR;
+			//Samples past the edge of the terrain repeat the last sample
+			for(uint lj=0;lj<=TERRAIN_CHUNK;lj++) {
+				cuint j = min(first + lj, grid_height - 1) - first;
+				for(uint li=0;li<=TERRAIN_CHUNK;li++) {
+					cuint i = min(cx * TERRAIN_CHUNK + li, grid_width - 1);
+					cfloat height = rows[(size_t)j * grid_width + i];
+					chunk[lj * (TERRAIN_CHUNK + 1) + li] = height;
+					bound.min_y = min(bound.min_y, height);
+					bound.max_y = max(bound.max_y, height);
+				}
+			}
+			written&= fwrite(&chunk[0], sizeof(float), chunk.size(), file) == chunk.size();
+		}
+	}
+	written&= fseek(file, sizeof(header), SEEK_SET) == 0;
+	written&= fwrite(&bounds[0], sizeof(terrain_bounds_c), bounds.size(), file) == bounds.size();
+	if(fclose(file) != 0 || !written) {
+		std::cout << "Couldn't write " << temp_path << "!" << std::endl;
+		remove(temp_path.c_str());
+		return false;
+	}
+	#ifdef _WIN32
+		remove(path);
+	#endif
+	if(rename(temp_path.c_str(), path) != 0) {
+		std::cout << "Couldn't rename " << temp_path << " to " << path << "!" << std::endl;
+		remove(temp_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+terrain_c::terrain_c(): bounds(NULL), slot_of(NULL), slots(NULL), slot_amount(0), newest(0), oldest(0),
+		#ifdef _WIN32
+			file(NULL),
+		#else
+			file(-1),
+		#endif
+		hits(0), misses(0), bytes(0), stall_ns(0) {}
+
+terrain_c::~terrain_c() {
+	close();
+}
+
+void terrain_c::close() {
+	for(uint i=0;i<slot_amount;i++) {
+		delete [] (uchar*)slots[i].polygons;
+		delete [] slots[i].min_y;
+		delete [] slots[i].max_y;
+	}
+	delete [] slots;
+	delete [] slot_of;
+	delete [] bounds;
+	slots = NULL;
+	slot_of = NULL;
+	bounds = NULL;
+	slot_amount = 0;
+	#ifdef _WIN32
+		if(file != NULL) fclose(file);
+		file = NULL;
+	#else
+		if(file >= 0) ::close(file);
+		file = -1;
+	#endif
+}
+
+//Reads the header and the bounds of the chunks of a terrain file split from the scene with the given hash
+//Nothing else is read until rays need it; cache_chunks chunks are kept in memory
+bool terrain_c::open(cchar *path, const uint64_t hash, cuint cache_chunks) {
+	close();
+	if(cache_chunks == 0) return false;
+	FILE *input = fopen(path, "rb");
+	if(input == NULL) return false;
+	bool good = fread(&header, sizeof(header), 1, input) == 1;
+	good = good && header.magic == TERRAIN_MAGIC && header.version == TERRAIN_VERSION && header.hash == hash && header.chunk_size == TERRAIN_CHUNK;
+	good = good && header.grid_width >= 2 && header.grid_height >= 2;
+	good = good && header.chunks_x == (header.grid_width - 2) / TERRAIN_CHUNK + 1 && header.chunks_z == (header.grid_height - 2) / TERRAIN_CHUNK + 1;
+	cuint chunks = good ? header.chunks_x * header.chunks_z : 0;
+	if(good) {
+		bounds = new terrain_bounds_c[chunks];
+		good = fread(bounds, sizeof(terrain_bounds_c), chunks, input) == chunks;
+		good = good && fseek(input, 0, SEEK_END) == 0 && (size_t)ftell(input) == chunk_offset(header, chunks);
+	}
+	#ifdef _WIN32
+		file = input;
+	#else
+		fclose(input);
+		if(good) {
+			file = ::open(path, O_RDONLY);
+			good = file >= 0;
+		}
+	#endif
+	if(!good) {
+		close();
+		return false;
+	}
+	slot_of = new int[chunks];
+	for(uint i=0;i<chunks;i++) slot_of[i] = -1;
+	slot_amount = min(cache_chunks, chunks);
+	slots = new slot_c[slot_amount];
+	for(uint i=0;i<slot_amount;i++) {
+		slot_c &slot = slots[i];
+		slot.chunk = -1;
+		slot.users = 0;
+		slot.loading = false;
+		slot.polygons = (polygon_c*)new uchar[TERRAIN_CHUNK * TERRAIN_CHUNK * 2 * sizeof(polygon_c)];
+		slot.min_y = new float[TERRAIN_CHUNK * TERRAIN_CHUNK];
+		slot.max_y = new float[TERRAIN_CHUNK * TERRAIN_CHUNK];
+		slot.newer = i > 0 ? i - 1 : slot_amount;
+		slot.older = i + 1 < slot_amount ? i + 1 : slot_amount;
+	}
+	newest = 0;
+	oldest = slot_amount - 1;
+	reset_stats();
+	return true;
+}
+
+//Moves the slot to the front of the list of the used slots; the mutex must be locked
+void terrain_c::touch(cuint slot) {
+	if(slot == newest) return;
+	slot_c &s = slots[slot];
+	//Unlink
+	slots[s.newer].older = s.older;
+	if(s.older < slot_amount) slots[s.older].newer = s.newer;
+	else oldest = s.newer;
+	//Link at the front
+	s.newer = slot_amount;
+	s.older = newest;
+	slots[newest].newer = slot;
+	newest = slot;
+}
+
+//Returns the slot holding the chunk and keeps it there until it is released
+//A chunk that isn't in the cache is loaded into the least recently used slot nobody is using
+//The time spent waiting for chunks to load, either by this thread or another one, is counted as stall time
+uint terrain_c::acquire(cuint chunk) {
+	std::unique_lock<std::mutex> lock(mutex);
+	std::chrono::steady_clock::time_point start;
+	bool stalled = false;
+	while(true) {
+		cint s = slot_of[chunk];
+		if(s >= 0 && !slots[s].loading) {
+			slots[s].users++;
+			touch(s);
+			if(stalled) stall_ns+= std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+			else hits++;
+			return s;
+		}
+		if(!stalled) {
+			start = std::chrono::steady_clock::now();
+			stalled = true;
+		}
+		if(s >= 0) { //Another thread is loading it
+			loaded.wait(lock);
+			continue;
+		}
+		uint unused = oldest;
+		while(unused < slot_amount && (slots[unused].users > 0 || slots[unused].loading)) unused = slots[unused].newer;
+		if(unused == slot_amount) { //Every slot is in use
+			loaded.wait(lock);
+			continue;
+		}
+		slot_c &slot = slots[unused];
+		if(slot.chunk >= 0) slot_of[slot.chunk] = -1;
+		slot.chunk = chunk;
+		slot.loading = true;
+		slot.users = 1;
+		slot_of[chunk] = unused;
+		touch(unused);
+		lock.unlock();
+		load(slot, chunk);
+		lock.lock();
+		slot.loading = false;
+		misses++;
+		stall_ns+= std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		loaded.notify_all();
+		return unused;
+	}
+}
+
+void terrain_c::release(cuint slot) {
+	std::lock_guard<std::mutex> lock(mutex);
+	slots[slot].users--;
+	if(slots[slot].users == 0) loaded.notify_all();
+}
+
+//Reads the samples of the chunk and creates its polygons the same way the scene does
+//A chunk that can't be read has no polygons
+bool terrain_c::load(slot_c &slot, cuint chunk) {
+	std::vector<float> samples((TERRAIN_CHUNK + 1) * (TERRAIN_CHUNK + 1));
+	const size_t offset = chunk_offset(header, chunk);
+	bool good;
+	#ifdef _WIN32
+		{
+			std::lock_guard<std::mutex> lock(file_mutex);
+			good = fseek(file, (long)offset, SEEK_SET) == 0 && fread(&samples[0], 1, chunk_bytes(), file) == chunk_bytes();
+		}
+	#else
+		good = pread(file, &samples[0], chunk_bytes(), offset) == (ssize_t)chunk_bytes();
+	#endif
+	bytes+= chunk_bytes();
+	cuint cx = chunk % header.chunks_x;
+	cuint cz = chunk / header.chunks_x;
+	cuint W = header.grid_width;
+	cuint H = header.grid_height;
+	cfloat cell = header.cell;
+	for(uint li=0;li<TERRAIN_CHUNK;li++) {
+		for(uint lj=0;lj<TERRAIN_CHUNK;lj++) {
+			cuint c = li * TERRAIN_CHUNK + lj;
+			cuint i = cx * TERRAIN_CHUNK + li;
+			cuint j = cz * TERRAIN_CHUNK + lj;
+			if(!good || i >= W - 1 || j >= H - 1) {
+				slot.min_y[c] = TERRAIN_FAR;
+				slot.max_y[c] = -TERRAIN_FAR;
+				continue;
+			}
+			cfloat h1 = samples[lj * (TERRAIN_CHUNK + 1) + li];
+			cfloat h2 = samples[lj * (TERRAIN_CHUNK + 1) + li + 1];
+			cfloat h3 = samples[(lj + 1) * (TERRAIN_CHUNK + 1) + li];
+			cfloat h4 = samples[(lj + 1) * (TERRAIN_CHUNK + 1) + li + 1];
+			slot.polygons[c * 2] = polygon_c(i * cell, h1, j * cell, (i + 1) * cell, h2, j * cell, i * cell, h3, (j + 1) * cell, 0, 0, 1, 0, 0, 1);
+			slot.polygons[c * 2 + 1] = polygon_c((i + 1) * cell, h2, j * cell, (i + 1) * cell, h4, (j + 1) * cell, i * cell, h3, (j + 1) * cell, 1, 0, 1, 1, 0, 1);
+			slot.min_y[c] = min(min(h1, h2), min(h3, h4));
+			slot.max_y[c] = max(max(h1, h2), max(h3, h4));
+		}
+	}
+	if(!good) std::cout << "Couldn't read the chunk " << chunk << " of the terrain!" << std::endl;
+	return good;
+}
+
+//Walks the cells of size size in a grid starting from x1, z1 that the ray J + t * M, L + t * O crosses between t0 and t1, in order
+//visit(i, j, enter, leave) is called for every cell and the walk stops once it returns true
+//A ray running exactly along a line between the cells visits the cells on both sides of the line as the polygons on both sides touch it
+template <class F> bool walk_grid(cfloat x1, cfloat z1, cfloat size, cuint cells_x, cuint cells_z, cfloat J, cfloat L, cfloat M, cfloat O, float t0, cfloat t1, const F &visit) {
+	int i = (int)clampf(floor((J + M * t0 - x1) / size), 0, cells_x - 1);
+	int j = (int)clampf(floor((L + O * t0 - z1) / size), 0, cells_z - 1);
+	cint step_i = M > 0 ? 1 : -1;
+	cint step_j = O > 0 ? 1 : -1;
+	cfloat delta_x = M != 0 ? size / fabs(M) : TERRAIN_FAR;
+	cfloat delta_z = O != 0 ? size / fabs(O) : TERRAIN_FAR;
+	float next_x = M != 0 ? (x1 + (i + (M > 0)) * size - J) / M : TERRAIN_FAR;
+	float next_z = O != 0 ? (z1 + (j + (O > 0)) * size - L) / O : TERRAIN_FAR;
+	cint side_i = M == 0 && i > 0 && (J - x1) / size == i ? 1 : 0;
+	cint side_j = O == 0 && j > 0 && (L - z1) / size == j ? 1 : 0;
+	while(true) {
+		cfloat leave = min(min(next_x, next_z), t1);
+		bool done = false;
+		for(int di=0;di<=side_i;di++) {
+			for(int dj=0;dj<=side_j;dj++) done = visit(i - di, j - dj, t0, leave) || done;
+		}
+		if(done) return true;
+		if(leave >= t1) return false;
+		//Close to a corner the cell the ray only nearly crosses is visited too as the polygons meeting there may not hit the ray exactly
+		if(fabs(next_x - next_z) < min(delta_x, delta_z) * TERRAIN_CORNER) {
+			cint corner_i = next_x < next_z ? i : i + step_i;
+			cint corner_j = next_x < next_z ? j + step_j : j;
+			if(corner_i >= 0 && corner_j >= 0 && corner_i < (int)cells_x && corner_j < (int)cells_z && visit(corner_i, corner_j, leave, leave)) return true;
+		}
+		if(next_x < next_z) {
+			i+= step_i;
+			t0 = next_x;
+			next_x+= delta_x;
+		}
+		else {
+			j+= step_j;
+			t0 = next_z;
+			next_z+= delta_z;
+		}
+		if(i < 0 || j < 0 || i >= (int)cells_x || j >= (int)cells_z) return false;
+	}
+}
+
+//Tells if the height of the ray between t0 and t1 can be between min_y and max_y
+static inline bool crosses(cfloat K, cfloat N, cfloat t0, cfloat t1, cfloat min_y, cfloat max_y) {
+	cfloat y0 = K + N * t0;
+	cfloat y1 = K + N * t1;
+	return max(y0, y1) >= min_y - TERRAIN_MARGIN && min(y0, y1) <= max_y + TERRAIN_MARGIN;
+}
+
+//Traces the ray through the cells of a loaded chunk between t0 and t1 and returns true once nothing after the cells can be closer
+//The cells are visited in the order the ray crosses them so the closest hit is found in the first cell with a hit
+//	The cells the ray enters at the same distance are still tested so that a hit on a shared edge goes to the lower polygon like in the scene
+bool terrain_c::trace_chunk(const slot_c &slot, cuint chunk, cfloat J, cfloat K, cfloat L, cfloat x, cfloat y, cfloat z, cfloat t0, cfloat t1,
+		const bool any, cuint skip, float &best, float &hitx, float &hity, float &hitz, uint &hitpolygon, tangent_frame_c *frame) const {
+	cuint cx = chunk % header.chunks_x;
+	cuint cz = chunk / header.chunks_x;
+	cfloat cell = header.cell;
+	cfloat M = x - J, N = y - K, O = z - L;
+	cuint H = header.grid_height;
+	return walk_grid(cx * TERRAIN_CHUNK * cell, cz * TERRAIN_CHUNK * cell, cell, TERRAIN_CHUNK, TERRAIN_CHUNK, J, L, M, O, t0, t1, [&](cint li, cint lj, cfloat enter, cfloat leave) {
+		if(enter > best + TERRAIN_MARGIN) return true;
+		cuint n = li * TERRAIN_CHUNK + lj;
+		if(!crosses(K, N, enter, leave, slot.min_y[n], slot.max_y[n])) return false;
+		for(uint k=0;k<2;k++) {
+			cuint id = ((cx * TERRAIN_CHUNK + li) * (H - 1) + cz * TERRAIN_CHUNK + lj) * 2 + k;
+			float a, b, c, rx, ry, rz;
+			if(cast_ray(slot.polygons[n * 2 + k], a, b, c, rx, ry, rz, J, K, L, x, y, z)) {
+				if(a >= 0 && b >= 0 && a + b <= 1 && c > 0 && (c < best || (c == best && id < hitpolygon)) && id != skip) {
+					best = c;
+					hitx = rx; hity = ry; hitz = rz; hitpolygon = id;
+					if(any) return true;
+					if(frame != NULL) *frame = slot.polygons[n * 2 + k];
+				}
+			}
+		}
+		return false;
+	});
+}
+
+//Walks the chunks the ray crosses and traces the ones whose bounds it passes through
+//With any the first hit is enough, otherwise the closest hit before c = 1000 like in trace_primary
+//The tangent frame of the closest hit is copied out of the chunk while it is still acquired
+bool terrain_c::trace(cfloat J, cfloat K, cfloat L, cfloat x, cfloat y, cfloat z, const bool any, cuint skip, float &hitx, float &hity, float &hitz, uint &hitpolygon, tangent_frame_c *frame) {
+	if(bounds == NULL) return false;
+	cfloat M = x - J, N = y - K, O = z - L;
+	cfloat cell = header.cell;
+	//The part of the ray above the grid of samples
+	float t0 = 0, t1 = any ? TERRAIN_FAR : 1000;
+	cfloat low[2] = {0, 0};
+	cfloat high[2] = {(header.grid_width - 1) * cell, (header.grid_height - 1) * cell};
+	cfloat start[2] = {J, L};
+	cfloat direction[2] = {M, O};
+	for(uint i=0;i<2;i++) {
+		if(direction[i] == 0) {
+			if(start[i] < low[i] || start[i] > high[i]) return false;
+			continue;
+		}
+		cfloat a = (low[i] - start[i]) / direction[i];
+		cfloat b = (high[i] - start[i]) / direction[i];
+		t0 = max(t0, min(a, b));
+		t1 = min(t1, max(a, b));
+	}
+	if(t0 > t1) return false;
+	float best = any ? TERRAIN_FAR : 1000;
+	hitpolygon = 0xFFFFFFFF;
+	cfloat size = TERRAIN_CHUNK * cell;
+	walk_grid(0, 0, size, header.chunks_x, header.chunks_z, J, L, M, O, t0, t1, [&](cint cx, cint cz, cfloat enter, cfloat leave) {
+		if(enter > best + TERRAIN_MARGIN) return true;
+		cuint chunk = cz * header.chunks_x + cx;
+		if(!crosses(K, N, enter, leave, bounds[chunk].min_y, bounds[chunk].max_y)) return false;
+		cuint slot = acquire(chunk);
+		const bool done = trace_chunk(slots[slot], chunk, J, K, L, x, y, z, enter, leave, any, skip, best, hitx, hity, hitz, hitpolygon, frame);
+		release(slot);
+		return done;
+	});
+	return hitpolygon != 0xFFFFFFFF && best < (any ? TERRAIN_FAR : 999);
+}
+
+bool terrain_c::trace_primary(cfloat J, cfloat K, cfloat L, cfloat x, cfloat y, cfloat z, float &hitx, float &hity, float &hitz, uint &hitpolygon, tangent_frame_c *frame) {
+	return trace(J, K, L, x, y, z, false, 0xFFFFFFFF, hitx, hity, hitz, hitpolygon, frame);
+}
+
+//Same ray as trace_shadow of the scene
+bool terrain_c::trace_shadow(cfloat hitx, cfloat hity, cfloat hitz, cuint hitpolygon, cfloat sunx, cfloat suny, cfloat sunz) {
+	float x, y, z;
+	uint polygon;
+	return trace(hitx, hity + 0.01, hitz, hitx - sunx, hity - suny + 0.01, hitz - sunz, true, hitpolygon, x, y, z, polygon, NULL);
+}
+
+terrain_stats_c terrain_c::stats() const {
+	terrain_stats_c result;
+	result.hits = hits;
+	result.misses = misses;
+	result.bytes = bytes;
+	result.stall = stall_ns / 1000000.0;
+	return result;
+}
+
+void terrain_c::reset_stats() {
+	hits = 0;
+	misses = 0;
+	bytes = 0;
+	stall_ns = 0;
+}
+
+//Memory taken by the chunks in the cache
+size_t terrain_c::cache_memory() const {
+	return (size_t)slot_amount * TERRAIN_CHUNK * TERRAIN_CHUNK * (2 * sizeof(polygon_c) + 2 * sizeof(float));
+}
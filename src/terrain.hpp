@@ -0,0 +1,102 @@
+/** terrain.hpp **/
+
+#ifndef TERRAIN_HPP
+#define TERRAIN_HPP
+
+#include "global.hpp"
+#include "polygon.hpp"
+#include <cstdio>
+#include <stdint.h>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#define TERRAIN_FILE "terrain.chunks" //The paged terrain is split into this file next to the scene cache
+#define TERRAIN_MAGIC 0x43545452 //"RTTC"
+#define TERRAIN_VERSION 1
+#define TERRAIN_CHUNK 32 //Cells per side of a chunk
+#define TERRAIN_CACHE 64 //Chunks kept in memory by default
+
+//The beginning of the terrain file
+//The bounds of every chunk follow the header and the chunks follow them, each (TERRAIN_CHUNK + 1)^2 height samples with the samples of the next chunks on the last row and column
+class terrain_header_c {
+	public:
+		uint magic;
+		uint version;
+		uint64_t hash; //Hash of the scene the terrain was split from
+		uint grid_width, grid_height; //Height samples of the whole terrain
+		uint chunk_size;
+		uint chunks_x, chunks_z;
+		float cell; //Distance between the samples
+};
+
+//The lowest and the highest sample of a chunk; a ray that doesn't pass between them never loads the chunk
+class terrain_bounds_c {
+	public:
+		float min_y, max_y;
+};
+
+//What the terrain cache has done since the last reset
+class terrain_stats_c {
+	public:
+		uint64_t hits, misses; //Chunks asked for that were and weren't in memory
+		uint64_t bytes; //Read from the terrain file
+		double stall; //Milliseconds threads waited for chunks to be loaded, summed over the threads
+		terrain_stats_c();
+};
+
+//A terrain whose height samples stay in the terrain file
+//Only the bounds of the chunks are in memory and the chunks rays enter are loaded into a cache of the least recently used chunks
+//	The cache is shared by every thread tracing rays; a chunk in use isn't thrown away until it has been released
+//The polygons are numbered the same way and are exactly the same as the polygons of the scene between the samples, without the border
+//A primary hit comes with the tangent frame of its polygon so that shading never has to load the chunk again
+class terrain_c {
+	private:
+		class slot_c {
+			public:
+				int chunk; //-1 if empty
+				uint users;
+				bool loading;
+				polygon_c *polygons; //2 for every cell, cells along z first like in the scene
+				float *min_y, *max_y; //Of every cell
+				uint newer, older; //The list of the slots from the most to the least recently used
+		};
+		terrain_header_c header;
+		terrain_bounds_c *bounds;
+		int *slot_of; //The slot every chunk is in or -1
+		slot_c *slots;
+		uint slot_amount;
+		uint newest, oldest;
+		std::mutex mutex;
+		std::condition_variable loaded;
+		#ifdef _WIN32
+			FILE *file;
+			std::mutex file_mutex;
+		#else
+			int file;
+		#endif
+		std::atomic<uint64_t> hits, misses, bytes, stall_ns;
+		void touch(cuint slot);
+		uint acquire(cuint chunk);
+		void release(cuint slot);
+		bool load(slot_c &slot, cuint chunk);
+		void close();
+		bool trace_chunk(const slot_c &slot, cuint chunk, cfloat J, cfloat K, cfloat L, cfloat x, cfloat y, cfloat z, cfloat t0, cfloat t1,
+			const bool any, cuint skip, float &best, float &hitx, float &hity, float &hitz, uint &hitpolygon, tangent_frame_c *frame) const;
+		bool trace(cfloat J, cfloat K, cfloat L, cfloat x, cfloat y, cfloat z, const bool any, cuint skip, float &hitx, float &hity, float &hitz, uint &hitpolygon, tangent_frame_c *frame);
+
+	public:
+		terrain_c();
+		~terrain_c();
+		bool open(cchar *path, const uint64_t hash, cuint cache_chunks);
+		bool trace_primary(cfloat J, cfloat K, cfloat L, cfloat x, cfloat y, cfloat z, float &hitx, float &hity, float &hitz, uint &hitpolygon, tangent_frame_c *frame = NULL);
+		bool trace_shadow(cfloat hitx, cfloat hity, cfloat hitz, cuint hitpolygon, cfloat sunx, cfloat suny, cfloat sunz);
+		terrain_stats_c stats() const;
+		void reset_stats();
+		size_t cache_memory() const;
+};
+
+bool write_terrain(cchar *path, const uint64_t hash, cuint grid_width, cuint grid_height, cfloat cell, const std::function<bool(cuint row, float *samples)> &read_row);
+
+#endif
@@ -0,0 +1,218 @@
+/** tune.cpp **/
+
+#include "tune.hpp"
+#include "parallel.hpp"
+#include "arena.hpp"
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <vector>
+
+tune_profile_c::tune_profile_c(): hash(0), cores(0), cube_levels(0), quad_test(true), threads(0), tile(0) {
+	#ifdef CUBE_AMOUNT
+		cube_levels = CUBE_AMOUNT;
+	#endif
+}
+
+//The file has a line "name value" for every setting
+bool tune_profile_c::load(cchar *path, const uint64_t scene_hash) {
+	FILE *file = fopen(path, "r");
+	if(file == NULL) return false;
+	char name[64];
+	unsigned long long value;
+	uint found = 0;
+	tune_profile_c loaded;
+	while(fscanf(file, "%63s %llu", name, &value) == 2) {
+		if(strcmp(name, "hash") == 0) loaded.hash = value;
+		else if(strcmp(name, "cores") == 0) loaded.cores = value;
+		else if(strcmp(name, "levels") == 0) loaded.cube_levels = value;
+		else if(strcmp(name, "quads") == 0) loaded.quad_test = value != 0;
+		else if(strcmp(name, "threads") == 0) loaded.threads = value;
+		else if(strcmp(name, "tile") == 0) loaded.tile = value;
+		else continue;
+		found++;
+	}
+	fclose(file);
+	#ifdef CUBE_AMOUNT
+		const bool levels_good = loaded.cube_levels > 0 && loaded.cube_levels <= CUBE_AMOUNT;
+	#else
+		const bool levels_good = loaded.cube_levels == 0;
+	#endif
+	if(found != 6 || !levels_good || loaded.threads == 0) {
+		std::cout << "Bad " << path << "!" << std::endl;
+		return false;
+	}
+	if(loaded.hash != scene_hash || loaded.cores != thread_amount()) {
+		#ifdef OUTPUT
+			std::cout << path << " was tuned for another scene or machine, --tune tunes it again" << std::endl;
+		#endif
+		return false;
+	}
+	*this = loaded;
+	#ifdef OUTPUT
+		std::cout << "Using the settings tuned in " << path << std::endl;
+	#endif
+	return true;
+}
+
+bool tune_profile_c::save(cchar *path) const {
+	FILE *file = fopen(path, "w");
+	if(file == NULL) {
+		std::cout << "Couldn't create " << path << "!" << std::endl;
+		return false;
+	}
+	fprintf(file, "hash %llu\ncores %u\n", (unsigned long long)hash, cores);
+	fprintf(file, "levels %u\nquads %u\nthreads %u\ntile %u\n", cube_levels, quad_test ? 1 : 0, threads, tile);
+	return fclose(file) == 0;
+}
+
+void tune_profile_c::apply(scene_c &scene) const {
+	scene.cube_levels = cube_levels;
+	scene.quad_test = quad_test;
+}
+
+void tune_profile_c::apply(render_params_c &params) const {
+	if(params.threads == 0) params.threads = threads;
+	if(params.tile == 0) params.tile = tile;
+}
+
+//A trial frame that has been traced once with its settings
+class tune_trial_c {
+	public:
+		tune_profile_c settings;
+		double time;
+		bool same; //The frame is the same as the first trial frame
+};
+
+static bool same_settings(const tune_profile_c &a, const tune_profile_c &b) {
+	return a.cube_levels == b.cube_levels && a.quad_test == b.quad_test && a.threads == b.threads && a.tile == b.tile;
+}
+
+//Traces the trial frame with the settings unless it already has been and returns the trial
+//The first trial frame is kept in reference and every other one is compared to it
+static const tune_trial_c &run_trial(scene_c &scene, const render_params_c &params, const tune_profile_c &settings, std::vector<tune_trial_c> &trials, float *image, float *depth_buffer, float *reference) {
+	for(uint i=0;i<trials.size();i++) {
+		if(same_settings(trials[i].settings, settings)) return trials[i];
+	}
+	render_params_c trial_params = params;
+	settings.apply(scene);
+	trial_params.threads = settings.threads;
+	trial_params.tile = settings.tile;
+	tune_trial_c trial;
+	trial.settings = settings;
+	trial.time = 0;
+	for(uint run=0;run<TUNE_RUNS;run++) {
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		trace_frame(scene, trial_params, image, depth_buffer, params.width, 0, params.width, 0, params.height);
+		cdouble time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		if(run == 0 || time < trial.time) trial.time = time;
+	}
+	cuint pixels = params.width * params.height;
+	if(trials.empty()) memcpy(reference, image, pixels * 3 * sizeof(float));
+	trial.same = memcmp(reference, image, pixels * 3 * sizeof(float)) == 0;
+	std::cout.width(6);
+	std::cout << settings.cube_levels;
+	std::cout.width(7);
+	std::cout << (settings.quad_test ? "yes" : "no");
+	std::cout.width(9);
+	std::cout << settings.threads;
+	std::cout.width(6);
+	std::cout << settings.tile;
+	std::cout.width(8);
+	std::cout << int(trial.time + 0.5) << " ms";
+	std::cout.width(12);
+	std::cout << int(pixels * 1000.0 / trial.time);
+	if(!trial.same) std::cout << " (the frame differs!)";
+	std::cout << std::endl;
+	trials.push_back(trial);
+	return trials.back();
+}
+
+//Tunes the settings of tune_profile_c for the scene and the frame on this machine with short trial frames
+//The settings are tuned one after another, each starting from the best ones found so far:
+//	the amount of cube levels and testing the cubes 4 at a time, the amount of threads and the columns taken by a thread at a time
+//The cube levels are tried from the most to the fewest until they are TUNE_GIVE_UP times slower than the best settings
+//This is done again with the new best settings until nothing changes or TUNE_PASSES runs out
+//Only the tracing is timed as the post processing doesn't depend on the settings
+//The speed is given in primary rays, one for every pixel, per second
+bool run_autotune(scene_c &scene, const render_params_c &params, tune_profile_c &profile) {
+	render_params_c trial_params = params;
+	trial_params.progress = false;
+	trial_params.baked = false;
+	trial_params.lightmap = NULL;
+	cdouble pixels = (double)params.width * params.height;
+	if(pixels > TUNE_PIXELS) {
+		cdouble scale = sqrt(TUNE_PIXELS / pixels);
+		trial_params.width = params.width * scale > 1 ? uint(params.width * scale) : 1;
+		trial_params.height = params.height * scale > 1 ? uint(params.height * scale) : 1;
+	}
+	cuint trial_pixels = trial_params.width * trial_params.height;
+	arena_c arena("Tuning", (size_t)trial_pixels * sizeof(float) * 7 + 3 * ARENA_ALIGN);
+	float *image = arena.alloc<float>(trial_pixels * 3);
+	float *depth_buffer = arena.alloc<float>(trial_pixels);
+	float *reference = arena.alloc<float>(trial_pixels * 3);
+
+	cuint cores = thread_amount();
+	const uint thread_options[] = {1, cores / 2, cores, cores * 2};
+	const uint tile_options[] = {0, 1, 4, 16, 64};
+	std::vector<tune_trial_c> trials;
+	tune_profile_c best;
+	best.threads = cores;
+	std::cout << "Tuning with " << trial_params.width << "x" << trial_params.height << " frames" << std::endl;
+	std::cout << "Levels  Quads  Threads  Tile   Time      Rays/s" << std::endl;
+	cdouble default_time = run_trial(scene, trial_params, best, trials, image, depth_buffer, reference).time;
+	double best_time = default_time;
+	//The candidate replaces the best settings if it is clearly faster and traces the same frame
+	bool changed = true;
+	const std::function<double(const tune_profile_c &candidate)> try_settings = [&](const tune_profile_c &candidate) {
+		const tune_trial_c &trial = run_trial(scene, trial_params, candidate, trials, image, depth_buffer, reference);
+		if(trial.same && trial.time < best_time * (1 - TUNE_MARGIN)) {
+			best = candidate;
+			best_time = trial.time;
+			changed = true;
+		}
+		return trial.time;
+	};
+	for(uint pass=0;pass<TUNE_PASSES&&changed;pass++) {
+		changed = false;
+		#ifdef CUBE_AMOUNT
+			//Fewer levels only get slower once they are much slower than the best settings
+			for(uint levels=CUBE_AMOUNT;levels>0;levels--) {
+				double fastest = 0;
+				for(uint quads=0;quads<2;quads++) {
+					tune_profile_c candidate = best;
+					candidate.cube_levels = levels;
+					candidate.quad_test = quads;
+					cdouble time = try_settings(candidate);
+					if(quads == 0 || time < fastest) fastest = time;
+				}
+				if(fastest > best_time * TUNE_GIVE_UP) break;
+			}
+		#endif
+		for(uint i=0;i<sizeof(thread_options)/sizeof(thread_options[0]);i++) {
+			if(thread_options[i] == 0) continue;
+			tune_profile_c candidate = best;
+			candidate.threads = thread_options[i];
+			try_settings(candidate);
+		}
+		for(uint i=0;i<sizeof(tile_options)/sizeof(tile_options[0]);i++) {
+			tune_profile_c candidate = best;
+			candidate.tile = tile_options[i];
+			try_settings(candidate);
+		}
+	}
+	best.hash = scene.get_hash();
+	best.cores = cores;
+	best.apply(scene);
+	profile = best;
+	std::cout << "Best: " << best.cube_levels << " levels, " << (best.quad_test ? "quads" : "cubes one by one") << ", " << best.threads << " threads and ";
+	if(best.tile > 0) std::cout << "tiles of " << best.tile << " columns";
+	else std::cout << "the columns split evenly";
+	std::cout << ", " << int(trial_pixels * 1000.0 / best_time) << " rays/s, " << int(default_time / best_time * 100.0 + 0.5) / 100.0 << "x the defaults" << std::endl;
+	for(uint i=0;i<trials.size();i++) {
+		if(!trials[i].same) return false;
+	}
+	return true;
+}
@@ -0,0 +1,40 @@
+/** tune.hpp **/
+
+#ifndef TUNE_HPP
+#define TUNE_HPP
+
+#include "global.hpp"
+#include "scene.hpp"
+#include "render.hpp"
+#include <stdint.h>
+
+//The settings found by --tune are saved into this file and used by every frame rendered after it with the same scene on the same machine
+//Comment out to ignore the file
+#define TUNE_PROFILE "tune.profile"
+
+#define TUNE_PIXELS 60000 //The trial frames are scaled down to about this many pixels
+#define TUNE_RUNS 2 //Trial frames traced for every candidate; the fastest one counts
+#define TUNE_MARGIN 0.03 //Share a candidate must be faster than the best one so far to replace it as the times are noisy
+#define TUNE_PASSES 2 //Times the settings are tuned one after another at most
+#define TUNE_GIVE_UP 2.0 //Fewer cube levels aren't tried once the last ones took this many times as long as the best settings
+
+//How the rays of a frame are traced, see scene_c::cube_levels, scene_c::quad_test, render_params_c::threads and render_params_c::tile
+//None of these change the frame, only how fast it is traced
+class tune_profile_c {
+	public:
+		uint64_t hash; //The scene the settings were tuned for
+		uint cores; //The machine the settings were tuned on
+		uint cube_levels;
+		bool quad_test;
+		uint threads;
+		uint tile;
+		tune_profile_c();
+		bool load(cchar *path, const uint64_t scene_hash); //Fails if the file is missing or was tuned for another scene or machine
+		bool save(cchar *path) const;
+		void apply(scene_c &scene) const;
+		void apply(render_params_c &params) const; //Only the threads and the tile that haven't been given are changed
+};
+
+bool run_autotune(scene_c &scene, const render_params_c &params, tune_profile_c &profile);
+
+#endif
@@ -0,0 +1,427 @@
+/** regression.cpp **/
+
+//Renders a fixed set of scenes and compares them to the golden images in tests/golden
+//The other ways of tracing the same frame (streams, cube traversals, tiles, progressive frames, reused hits, edits and the paged terrain)
+//	and the frame post processed in half floats are compared to the same golden images as the frames are meant to be the same
+//A progressive frame stopped early has a golden image of its own for the pixels filled in from the traced ones
+//The time of every stage is compared to its budget in tests/budgets.txt
+//	A fixed amount of work is timed with every frame and the budgets are scaled by how much slower or faster it is than when they were saved
+//Run from the root of the repository with 'make test'
+//	--update saves the images and the times as the new golden images and budgets after a change that is meant to change them
+
+#include "global.hpp"
+#include "scene.hpp"
+#include "render.hpp"
+#include "terrain.hpp"
+#include "arena.hpp"
+#include "bmp.hpp"
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#ifdef _WIN32
+	#include <direct.h>
+#else
+	#include <sys/stat.h>
+#endif
+
+#define TEST_DIR "tests/"
+#define GOLDEN_DIR TEST_DIR "golden/"
+#define RESULT_DIR TEST_DIR "out/" //The rendered images and the synthetic heightmaps are saved here
+#define BUDGETS TEST_DIR "budgets.txt"
+#define TEST_PARAMS "size=240x160" //Given to every case before its own parameters
+#define TOLERANCE 24 //Levels a channel of a pixel may differ from the golden image
+#define HALF_TOLERANCE 2 //Levels the frame post processed in half floats may differ from the one post processed in floats
+#define MIN_PSNR 40.0 //Decibels the image must be from the golden image at least
+#define BUDGET_MARGIN 0.3 //Share of its budget a stage may take longer than the budget
+#define BUDGET_SLACK 2.0 //Milliseconds a stage may take longer on top of the margin as the shortest stages are mostly noise
+#define TEST_RUNS 7 //Frames rendered for every case; the median time of every stage counts
+#define TEST_WARMUP 1 //Frames rendered before them that aren't timed as the caches are still cold
+#define TEST_RETRIES 2 //Times the cases over their budgets are timed again after the others as the machine can be slower for a while
+#define CALIBRATION_SIZE 1048576 //Floats the fixed work reads around
+#define CALIBRATION_STEPS 2000000
+#define COARSE_SAMPLES 4000 //Pixels the coarse progressive frame traces, a part of the third pass
+#define TERRAIN RESULT_DIR "terrain.chunks"
+#define TERRAIN_TEST_CACHE 16 //Chunks in the cache of the paged terrain; less than the terrain has so that chunks are thrown away
+
+#define SYNTHETIC_WIDTH 192
+#define SYNTHETIC_HEIGHT 128
+#define RIDGES RESULT_DIR "ridges.pgm"
+#define PLAINS RESULT_DIR "plains.pgm"
+
+#define STAGES 4
+static cchar * const stage_names[STAGES] = {"build", "trace", "post", "scale"};
+
+//How a case traces its frame other than with its parameters
+#define MODE_DEFAULT 0
+#define MODE_NO_QUADS 1 //Test the cubes one by one instead of 4 at a time
+#define MODE_LOW_LEVELS 2 //Leave out the top cube level
+#define MODE_PROGRESSIVE 3 //Render the frame in passes; the whole frame is timed as tracing
+#define MODE_REUSE 4 //Reuse the hits of a frame traced from a bit to the side
+#define MODE_EDIT 5 //Edit a part of the heights away and back between frames and only trace what the edits change
+#define MODE_TERRAIN 6 //Trace the terrain paged from a file; building the scene times splitting the terrain
+#define MODE_COARSE 7 //Like MODE_PROGRESSIVE but stop after COARSE_SAMPLES pixels so that the rest are filled in from them
+
+class test_case_c {
+	public:
+		cchar *name;
+		cchar *golden; //The image of another case that the frame must match or NULL for an image of its own
+		cchar *heightmap;
+		uint acc;
+		cchar *params;
+		uint mode;
+		uint tolerance; //Levels a channel of a pixel may differ from the golden image
+};
+
+//The paged terrain has no border so it is compared from above where the border can't be seen
+#define TOP_VIEW "camera=96,60,90 look=96,0,60"
+
+static const test_case_c cases[] = {
+	{"stock", NULL, HEIGHTMAP, 1, "", MODE_DEFAULT, TOLERANCE},
+	{"stock_acc2_phong", NULL, HEIGHTMAP, 2, "flags=ambient,diffuse,phong", MODE_DEFAULT, TOLERANCE},
+	{"stock_acc4_diffuse", NULL, HEIGHTMAP, 4, "flags=ambient,diffuse", MODE_DEFAULT, TOLERANCE},
+	{"stock_maps_no_post", NULL, HEIGHTMAP, 1, "flags=-antialiasing,-dof,-bloom", MODE_DEFAULT, TOLERANCE},
+	{"stock_half_frame", "stock", HEIGHTMAP, 1, "frame=half", MODE_DEFAULT, HALF_TOLERANCE},
+	{"ridges", NULL, RIDGES, 1, "", MODE_DEFAULT, TOLERANCE},
+	{"ridges_acc2_normal", NULL, RIDGES, 2, "flags=ambient,diffuse,normal sun=-10,-6,4", MODE_DEFAULT, TOLERANCE},
+	{"plains", NULL, PLAINS, 1, "camera=96,60,160 look=96,0,40", MODE_DEFAULT, TOLERANCE},
+	{"stock_streams", "stock", HEIGHTMAP, 1, "rays=stream", MODE_DEFAULT, TOLERANCE},
+	{"stock_acc2_no_quads", "stock_acc2_phong", HEIGHTMAP, 2, "flags=ambient,diffuse,phong", MODE_NO_QUADS, TOLERANCE},
+	{"stock_acc4_low_levels", "stock_acc4_diffuse", HEIGHTMAP, 4, "flags=ambient,diffuse", MODE_LOW_LEVELS, TOLERANCE},
+	{"stock_tiles", "stock", HEIGHTMAP, 1, "tile=8", MODE_DEFAULT, TOLERANCE},
+	{"stock_progressive", "stock", HEIGHTMAP, 1, "", MODE_PROGRESSIVE, TOLERANCE},
+	{"stock_coarse", NULL, HEIGHTMAP, 1, "threads=1", MODE_COARSE, TOLERANCE}, //The samples run out at the same pixel with a single thread
+	{"stock_reuse", "stock", HEIGHTMAP, 1, "", MODE_REUSE, TOLERANCE},
+	{"stock_edit", "stock", HEIGHTMAP, 1, "", MODE_EDIT, TOLERANCE},
+	{"stock_top", NULL, HEIGHTMAP, 1, TOP_VIEW, MODE_DEFAULT, TOLERANCE},
+	{"stock_top_terrain", "stock_top", HEIGHTMAP, 1, TOP_VIEW, MODE_TERRAIN, TOLERANCE}
+};
+#define CASES (sizeof(cases) / sizeof(cases[0]))
+
+//The synthetic heightmaps are written as 8 bit pgm where black is the highest
+static bool write_pgm(cchar *path, float (*height)(cfloat x, cfloat z)) {
+	FILE *file = fopen(path, "wb");
+	if(file == NULL) {
+		std::cout << "Couldn't create " << path << "!" << std::endl;
+		return false;
+	}
+	fprintf(file, "P5\n%d %d\n255\n", SYNTHETIC_WIDTH, SYNTHETIC_HEIGHT);
+	for(uint j=0;j<SYNTHETIC_HEIGHT;j++) {
+		for(uint i=0;i<SYNTHETIC_WIDTH;i++) {
+			cfloat value = 255 - height(i / (float)SYNTHETIC_WIDTH, j / (float)SYNTHETIC_HEIGHT) * 255;
+			fputc(value < 0 ? 0 : value > 255 ? 255 : (int)value, file);
+		}
+	}
+	return fclose(file) == 0;
+}
+
+//Sharp ridges running diagonally across the scene
+static float ridges(cfloat x, cfloat z) {
+	cfloat wave = fabs(sin((x * 3 + z * 2) * 3.14159265f + 0.8f * sin(z * 6)));
+	return 0.15f + 0.7f * wave * wave * (0.6f + 0.4f * cos(x * 5));
+}
+
+//Flat ground with a few low hills
+static float plains(cfloat x, cfloat z) {
+	cfloat hill1 = exp(-((x - 0.3f) * (x - 0.3f) + (z - 0.6f) * (z - 0.6f)) * 60);
+	cfloat hill2 = exp(-((x - 0.7f) * (x - 0.7f) + (z - 0.3f) * (z - 0.3f)) * 30);
+	return 0.05f + 0.2f * hill1 + 0.12f * hill2;
+}
+
+static double elapsed(const std::chrono::steady_clock::time_point &start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+//Reads the budgets, lines of "case stage milliseconds"; a missing budget is never exceeded
+//The time of the fixed work during the case is on the line of the stage calibration
+static void read_budgets(double budgets[][STAGES], double *calibrations) {
+	for(uint i=0;i<CASES;i++) {
+		for(uint k=0;k<STAGES;k++) budgets[i][k] = -1;
+		calibrations[i] = -1;
+	}
+	FILE *file = fopen(BUDGETS, "r");
+	if(file == NULL) return;
+	char name[256], stage[256];
+	double time;
+	while(fscanf(file, "%255s %255s %lf", name, stage, &time) == 3) {
+		for(uint i=0;i<CASES;i++) {
+			if(strcmp(name, cases[i].name) != 0) continue;
+			if(strcmp(stage, "calibration") == 0) calibrations[i] = time;
+			for(uint k=0;k<STAGES;k++) {
+				if(strcmp(stage, stage_names[k]) == 0) budgets[i][k] = time;
+			}
+		}
+	}
+	fclose(file);
+}
+
+static bool write_budgets(const double times[][STAGES], const double *calibrations) {
+	FILE *file = fopen(BUDGETS, "w");
+	if(file == NULL) {
+		std::cout << "Couldn't create " << BUDGETS << "!" << std::endl;
+		return false;
+	}
+	for(uint i=0;i<CASES;i++) {
+		fprintf(file, "%s calibration %.1f\n", cases[i].name, calibrations[i]);
+		for(uint k=0;k<STAGES;k++) fprintf(file, "%s %s %.1f\n", cases[i].name, stage_names[k], times[i][k]);
+	}
+	return fclose(file) == 0;
+}
+
+//Copies a file as it is
+static bool copy_file(cchar *from, cchar *to) {
+	FILE *input = fopen(from, "rb");
+	if(input == NULL) return false;
+	FILE *output = fopen(to, "wb");
+	if(output == NULL) {
+		fclose(input);
+		return false;
+	}
+	char buffer[65536];
+	size_t amount;
+	bool copied = true;
+	while((amount = fread(buffer, 1, sizeof(buffer), input)) > 0) copied&= fwrite(buffer, 1, amount, output) == amount;
+	fclose(input);
+	return fclose(output) == 0 && copied;
+}
+
+//Compares the rendered image to the golden image
+//Returns false if they have different sizes or a pixel or the PSNR is out of the tolerance
+static bool compare_images(cchar *result_path, cchar *golden_path, cuint tolerance, uint &max_difference, double &psnr) {
+	uint width, height, golden_width, golden_height;
+	uchar *result = load_bmp(result_path, width, height);
+	uchar *golden = load_bmp(golden_path, golden_width, golden_height);
+	bool same = result != NULL && golden != NULL && width == golden_width && height == golden_height;
+	max_difference = 0;
+	psnr = 0;
+	if(same) {
+		double error = 0;
+		for(uint i=0;i<width*height*3;i++) {
+			cint difference = abs((int)result[i] - (int)golden[i]);
+			if((uint)difference > max_difference) max_difference = difference;
+			error+= difference * difference;
+		}
+		error/= width * height * 3;
+		psnr = error == 0 ? 99 : 10 * log10(255.0 * 255.0 / error);
+		same = max_difference <= tolerance && psnr >= MIN_PSNR;
+	}
+	else if(result != NULL && golden != NULL) std::cout << "     The golden image is " << golden_width << "x" << golden_height << "!" << std::endl;
+	delete [] result;
+	delete [] golden;
+	return same;
+}
+
+//Loads the scene of the case without any meshes; the paged terrain is split from the heightmap again every time
+static bool load_case(const test_case_c &test, scene_c &scene, terrain_c &terrain) {
+	if(test.mode == MODE_TERRAIN) {
+		remove(TERRAIN);
+		return scene.load_paged(test.heightmap, test.acc, TERRAIN, terrain, TERRAIN_TEST_CACHE);
+	}
+	if(!scene.load(test.heightmap, test.acc, NULL, false)) return false;
+	if(test.mode == MODE_NO_QUADS) scene.quad_test = false;
+	if(test.mode == MODE_LOW_LEVELS && scene.cube_levels > 0) scene.cube_levels--;
+	return true;
+}
+
+//Traces the frames the timed frame builds on: one from a bit to the side for reusing its hits
+//or one before a part of the heights is flattened and one before they are put back for tracing only what the edits change
+static bool trace_history(const test_case_c &test, scene_c &scene, const render_params_c &params, history_c &history, float *image, float *depth_buffer) {
+	if(test.mode == MODE_REUSE) {
+		render_params_c moved = params;
+		moved.camera_x+= 2;
+		moved.target_x+= 2;
+		history.reuse = true;
+		trace_frame(scene, moved, image, depth_buffer, params.width, 0, params.width, 0, params.height, &history);
+	}
+	if(test.mode == MODE_EDIT) {
+		cuint x1 = scene.grid_width / 3, x2 = scene.grid_width / 2;
+		cuint z1 = scene.grid_height / 3, z2 = scene.grid_height / 2;
+		std::vector<float> old_heights, flat((x2 - x1) * (z2 - z1), 0);
+		for(uint j=z1;j<z2;j++) old_heights.insert(old_heights.end(), scene.heights + j * scene.grid_width + x1, scene.heights + j * scene.grid_width + x2);
+		cube_c changed;
+		trace_frame(scene, params, image, depth_buffer, params.width, 0, params.width, 0, params.height, &history);
+		if(!scene.edit(x1, x2, z1, z2, &flat[0], changed)) return false;
+		history.edit(changed);
+		trace_frame(scene, params, image, depth_buffer, params.width, 0, params.width, 0, params.height, &history);
+		if(!scene.edit(x1, x2, z1, z2, &old_heights[0], changed)) return false;
+		history.edit(changed);
+	}
+	return true;
+}
+
+static double median(std::vector<double> &times) {
+	std::sort(times.begin(), times.end());
+	return times[times.size() / 2];
+}
+
+//Times float math on reads from around a buffer that has nothing to do with the renderer so that changes to the renderer don't change it
+static double calibrate(const std::vector<float> &data) {
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	float sum = 0;
+	uint index = 0;
+	for(uint n=0;n<CALIBRATION_STEPS;n++) {
+		index = (index * 1103515245u + 12345u) % CALIBRATION_SIZE;
+		sum = sum * 0.999f + sqrt(data[index] + sum);
+	}
+	volatile float sink = sum;
+	(void)sink;
+	return elapsed(start);
+}
+
+//Renders the case a few times and saves the image into the result directory
+//The median time of every stage goes into times and the median time of the fixed work timed with the frames into calibration
+static bool render_case(const test_case_c &test, const std::vector<float> &data, double *times, double &calibration) {
+	render_params_c params;
+	std::string text = std::string(TEST_PARAMS) + " " + test.params;
+	for(char *arg=strtok(&text[0], " ");arg!=NULL;arg=strtok(NULL, " ")) {
+		if(!parse_render_param(arg, params)) {
+			std::cout << "Bad parameter " << arg << " in " << test.name << "!" << std::endl;
+			return false;
+		}
+	}
+	cuint final_x = params.width / params.scale_down;
+	cuint final_y = params.height / params.scale_down;
+	arena_c arena("Test", frame_memory(params));
+	uchar *final = new uchar[final_x * final_y * 3];
+	std::vector<double> run_times[STAGES], calibrations;
+	scene_c scene;
+	terrain_c terrain;
+	bool rendered = true;
+	for(uint run=0;run<TEST_WARMUP+TEST_RUNS&&rendered;run++) {
+		calibrations.push_back(calibrate(data));
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		rendered = load_case(test, scene, terrain);
+		run_times[0].push_back(elapsed(start));
+		if(!rendered) break;
+		arena.reset();
+		if(test.mode == MODE_PROGRESSIVE || test.mode == MODE_COARSE) {
+			progressive_c progressive;
+			if(test.mode == MODE_COARSE) progressive.samples = COARSE_SAMPLES;
+			start = std::chrono::steady_clock::now();
+			rendered = render_progressive(scene, params, final, final_x * 3, arena, progressive) > 0;
+			run_times[1].push_back(elapsed(start));
+			run_times[2].push_back(0);
+			run_times[3].push_back(0);
+			continue;
+		}
+		float *image = arena.alloc<float>(params.width * params.height * 3);
+		float *depth_buffer = arena.alloc<float>(params.width * params.height);
+		history_c history;
+		const bool history_used = test.mode == MODE_REUSE || test.mode == MODE_EDIT;
+		if(history_used && !trace_history(test, scene, params, history, image, depth_buffer)) {
+			rendered = false;
+			break;
+		}
+		start = std::chrono::steady_clock::now();
+		trace_frame(scene, params, image, depth_buffer, params.width, 0, params.width, 0, params.height, history_used ? &history : NULL);
+		run_times[1].push_back(elapsed(start));
+		start = std::chrono::steady_clock::now();
+		post_process(params, image, depth_buffer, arena);
+		run_times[2].push_back(elapsed(start));
+		start = std::chrono::steady_clock::now();
+		finish_frame(params, image, final, final_x * 3);
+		run_times[3].push_back(elapsed(start));
+	}
+	if(rendered) {
+		for(uint k=0;k<STAGES;k++) {
+			run_times[k].erase(run_times[k].begin(), run_times[k].begin() + TEST_WARMUP);
+			times[k] = median(run_times[k]);
+		}
+		calibrations.erase(calibrations.begin(), calibrations.begin() + TEST_WARMUP);
+		calibration = median(calibrations);
+		const std::string path = std::string(RESULT_DIR) + test.name + ".bmp";
+		rendered = save_bmp(final, final_x, final_y, path.c_str());
+	}
+	delete [] final;
+	return rendered;
+}
+
+//The budget of the stage k of the case i is longer when the fixed work took longer than when the budgets were saved
+static double scaled_budget(const double budgets[][STAGES], const double *saved_calibrations, const double *calibrations, cuint i, cuint k) {
+	return saved_calibrations[i] > 0 ? budgets[i][k] * calibrations[i] / saved_calibrations[i] : budgets[i][k];
+}
+
+//Tells if the stage k of the case i took longer than its budget scaled by how much slower the machine was
+static bool over_budget(const double budgets[][STAGES], const double times[][STAGES], const double *saved_calibrations, const double *calibrations, cuint i, cuint k) {
+	return budgets[i][k] >= 0 && times[i][k] > scaled_budget(budgets, saved_calibrations, calibrations, i, k) * (1 + BUDGET_MARGIN) + BUDGET_SLACK;
+}
+
+int main(int argc, char **argv) {
+	const bool update = argc > 1 && strcmp(argv[1], "--update") == 0;
+	if(argc > 2 || (argc == 2 && !update)) {
+		std::cout << "Usage: " << argv[0] << " [--update]" << std::endl;
+		return 1;
+	}
+	#ifdef _WIN32
+		_mkdir(RESULT_DIR);
+	#else
+		mkdir(RESULT_DIR, 0777);
+	#endif
+	if(!write_pgm(RIDGES, ridges) || !write_pgm(PLAINS, plains)) return 1;
+	static double budgets[CASES][STAGES], times[CASES][STAGES];
+	static double saved_calibrations[CASES], calibrations[CASES];
+	read_budgets(budgets, saved_calibrations);
+	std::vector<float> data(CALIBRATION_SIZE);
+	for(uint n=0;n<CALIBRATION_SIZE;n++) data[n] = n % 7 * 0.5f;
+	static bool rendered[CASES];
+	for(uint i=0;i<CASES;i++) rendered[i] = render_case(cases[i], data, times[i], calibrations[i]);
+	//The machine can be slower for a while so the cases over their budgets are timed again once the others have been timed
+	for(uint retry=0;retry<TEST_RETRIES&&!update;retry++) {
+		for(uint i=0;i<CASES;i++) {
+			bool over = false;
+			for(uint k=0;k<STAGES;k++) over|= over_budget(budgets, times, saved_calibrations, calibrations, i, k);
+			if(rendered[i] && over) rendered[i] = render_case(cases[i], data, times[i], calibrations[i]);
+		}
+	}
+	uint failed = 0;
+	std::string report;
+	for(uint i=0;i<CASES;i++) {
+		const test_case_c &test = cases[i];
+		const std::string result_path = std::string(RESULT_DIR) + test.name + ".bmp";
+		const std::string golden_path = std::string(GOLDEN_DIR) + (test.golden == NULL ? test.name : test.golden) + ".bmp";
+		if(!rendered[i]) {
+			report+= std::string(test.name) + ": couldn't be rendered\n";
+			failed++;
+			continue;
+		}
+		if(update) {
+			//The cases tracing the frame another way keep comparing to the image of their case
+			if(test.golden == NULL && !copy_file(result_path.c_str(), golden_path.c_str())) {
+				std::cout << "Couldn't save " << golden_path << "!" << std::endl;
+				return 1;
+			}
+			continue;
+		}
+		char line[1024];
+		uint max_difference;
+		double psnr;
+		bool passed = compare_images(result_path.c_str(), golden_path.c_str(), test.tolerance, max_difference, psnr);
+		int length = snprintf(line, sizeof(line), "%-20s max difference %3u, PSNR %5.1f dB", test.name, max_difference, psnr);
+		for(uint k=0;k<STAGES;k++) {
+			const bool over = over_budget(budgets, times, saved_calibrations, calibrations, i, k);
+			passed&= !over;
+			if(budgets[i][k] >= 0) {
+				cdouble budget = scaled_budget(budgets, saved_calibrations, calibrations, i, k);
+				length+= snprintf(line + length, sizeof(line) - length, ", %s %.0f/%.0f ms%s", stage_names[k], times[i][k], budget, over ? " OVER" : "");
+			}
+			else length+= snprintf(line + length, sizeof(line) - length, ", %s %.0f ms", stage_names[k], times[i][k]);
+		}
+		report+= std::string(line) + (passed ? "\n" : "  FAILED\n");
+		if(!passed) failed++;
+	}
+	if(update) {
+		if(!write_budgets(times, calibrations)) return 1;
+		uint images = 0;
+		for(uint i=0;i<CASES;i++) images+= cases[i].golden == NULL;
+		std::cout << "Saved " << images << " golden images into " << GOLDEN_DIR << " and the budgets into " << BUDGETS << std::endl;
+		return failed == 0 ? 0 : 1;
+	}
+	std::cout << std::endl << report;
+	std::cout << CASES - failed << " of " << CASES << " cases passed" << std::endl;
+	return failed == 0 ? 0 : 1;
+}